@@ -0,0 +1,99 @@
+/***************************************************************************************************************************************************************************************************************************
+ *
+ * MODULE:       r.waterbalance
+ *
+ * AUTHOR(S):    Ian Ondo
+ *              
+ * PURPOSE:      Listes creuses des événements d'eau en excès (pas de temps, quantité) de chaque cellule.
+ *				 Seuls les pas de temps où une cellule produit de l'eau disponible au ruissellement sont stockés,
+ *               dans des blocs alloués par une arène commune à tout le paysage.
+ *
+ ************************************************************************************************************************************************************************************************************************/
+
+/***********************************************************************************************
+ *
+ *				Events.c
+ *				Ce fichier définit les fonctions des listes d'événements d'eau en excès
+ *				utilisées par la fonction principale du programme du module r.waterbalance
+ *
+ ***********************************************************************************************/
+
+/* Each cell keeps the time steps at which it produced excess water, in append
+   order. The routing of a downstream cell only walks the events of a contributor
+   that fall in the support window of its response function: EventSeek() skips
+   whole blocks older than the window, from a cursor that EventForget() moves
+   past the blocks no window can reach any more, so the seek does not walk the
+   whole history at every step. Blocks come from chunks of ARENA_BLOCKS
+   blocks, so a run makes a few large allocations instead of one per event. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <grass/gis.h>
+#include <grass/glocale.h>
+#include "Events.h"
+
+EventArena *CreateEventArena(void)
+{
+        EventArena *A = (EventArena *)G_malloc(sizeof(EventArena));
+
+        A->chunks       = NULL;
+        A->nchunks      = 0;
+        A->capacity     = 0;
+        A->used         = ARENA_BLOCKS;
+        A->nblocks      = 0;
+        A->nevents      = 0;
+
+        return A;
+};
+
+void DestroyEventArena(EventArena *A)
+{
+        int i;
+
+        for(i = 0; i < A->nchunks; i++)
+                G_free(A->chunks[i]);
+        if(A->chunks)
+                G_free(A->chunks);
+        G_free(A);
+};
+
+static EventBlock *NewBlock(EventArena *A)
+{
+        EventBlock *b;
+
+        /* Le dernier bloc de mémoire est plein : en alloue un nouveau */
+        if(A->used == ARENA_BLOCKS){
+                if(A->nchunks == A->capacity){
+                        A->capacity = A->capacity ? 2 * A->capacity : 16;
+                        A->chunks   = (EventBlock **)G_realloc(A->chunks, A->capacity * sizeof(EventBlock *));
+                }
+                A->chunks[A->nchunks++] = (EventBlock *)G_malloc(ARENA_BLOCKS * sizeof(EventBlock));
+                A->used = 0;
+        }
+        b = &A->chunks[A->nchunks-1][A->used++];
+        b->next = NULL;
+        b->n    = 0;
+        A->nblocks++;
+
+        return b;
+};
+
+void EventAppend(EventArena *A, EventList *L, int step, double amount)
+{
+        EventBlock *b = L->tail;
+
+        if(b == NULL || b->n == EVENT_BLOCK){
+                b = NewBlock(A);
+                if(L->tail)
+                        L->tail->next = b;
+                else L->head = b;
+                if(L->first == NULL)
+                        L->first = b;
+                L->tail = b;
+        }
+        b->ev[b->n].step   = step;
+        b->ev[b->n].amount = (real)amount;
+        b->n++;
+        L->count++;
+        A->nevents++;
+};
@@ -0,0 +1,138 @@
+/***************************************************************************************************************************************************************************************************************************
+ *
+ * MODULE:       r.waterbalance
+ *
+ * AUTHOR(S):    Ian Ondo
+ *              
+ * PURPOSE:      Listes creuses des événements d'eau en excès (pas de temps, quantité) de chaque cellule.
+ *				 Seuls les pas de temps où une cellule produit de l'eau disponible au ruissellement sont stockés,
+ *               dans des blocs alloués par une arène commune à tout le paysage.
+ *
+ ************************************************************************************************************************************************************************************************************************/
+
+/***********************************************************************************************
+ *
+ *				Events.h
+ *				Ce fichier d'en-tête déclare les fonctions et structures des données
+ *				des listes d'événements d'eau en excès du module r.waterbalance
+ *
+ ***********************************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "utils.h"
+
+#ifndef _EVENTS_H
+#define _EVENTS_H
+
+/*
+ * Constants
+ * ---------
+ */
+
+// EVENT_BLOCK represents the number of events stored in one block of a list.
+#define EVENT_BLOCK   14
+
+// ARENA_BLOCKS represents the number of blocks allocated at once by the arena.
+#define ARENA_BLOCKS  4096
+
+/*
+ * Type: ExcessEvent
+ * --------------
+ * Excess water produced by a cell at the end of a time step.
+ */
+typedef struct ExcessEvent
+{
+        int step;
+        real amount;
+}ExcessEvent;
+
+/*
+ * Type: EventBlock
+ * --------------
+ * A block of events. Events are appended in increasing step order,
+ * so ev[n-1] holds the last step of the block.
+ */
+typedef struct EventBlock
+{
+        struct EventBlock *next;
+        int n;
+        ExcessEvent ev[EVENT_BLOCK];
+}EventBlock;
+
+/*
+ * Type: EventList
+ * --------------
+ * The events of one cell: a chain of blocks, oldest first. first is the
+ * oldest block routing can still read (see EventForget); the blocks before
+ * it stay in the chain for SaveState().
+ */
+typedef struct EventList
+{
+        EventBlock *head, *tail, *first;
+        int count;
+}EventList;
+
+/*
+ * Type: EventArena
+ * --------------
+ * Hands out blocks from large chunks. Blocks are never freed one by one:
+ * the whole arena is released by DestroyEventArena().
+ */
+typedef struct EventArena
+{
+        EventBlock **chunks;
+        int nchunks, capacity;
+        int used;                       /* blocks used in the last chunk */
+        long nblocks, nevents;
+}EventArena;
+
+/*
+ * Functions: CreateEventArena, DestroyEventArena
+ * Usage: arena = CreateEventArena();
+ *        DestroyEventArena(arena);
+ * -------------------------
+ */
+EventArena *CreateEventArena(void);
+void DestroyEventArena(EventArena *A);
+
+/*
+ * Function: EventAppend
+ * Usage: EventAppend(arena, &list, step, amount);
+ * -------------------------
+ * Appends an event to a list. Steps must be appended in increasing order.
+ */
+void EventAppend(EventArena *A, EventList *L, int step, double amount);
+
+/*
+ * Function: EventForget
+ * Usage: EventForget(&list, floor);
+ * -------------------------
+ * Moves the read cursor of a list past the blocks whose last step is below
+ * floor. floor must never decrease: it is the oldest step any window can
+ * still reach.
+ */
+static inline void EventForget(EventList *L, int floor)
+{
+        while(L->first && L->first->ev[L->first->n-1].step < floor)
+                L->first = L->first->next;
+}
+
+/*
+ * Function: EventSeek
+ * Usage: b = EventSeek(&list, lo);
+ * -------------------------
+ * Returns the first block from the read cursor holding an event with
+ * step >= lo, or NULL. The events of that block with a smaller step must
+ * still be skipped.
+ */
+static inline const EventBlock *EventSeek(const EventList *L, int lo)
+{
+        const EventBlock *b = L->first;
+
+        while(b && b->ev[b->n-1].step < lo)
+                b = b->next;
+        return b;
+}
+
+#endif  /* not defined _EVENTS_H */
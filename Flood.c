@@ -0,0 +1,340 @@
+/***************************************************************************************************************************************************************************************************************************
+ *
+ * MODULE:       r.waterbalance
+ *
+ * AUTHOR(S):    Ian Ondo
+ *
+ * PURPOSE:      Conditionnement des altitudes avant le calcul des directions d'écoulement : les dépressions sont remplies
+ *				 par inondation prioritaire et les zones plates reçoivent une pente infime vers leur exutoire, de sorte que
+ *               chaque cellule ait une voisine plus basse ou soit un exutoire de la grille.
+ *
+ ************************************************************************************************************************************************************************************************************************/
+
+/***********************************************************************************************
+ *
+ *				Flood.c
+ *				Ce fichier définit les fonctions du conditionnement des altitudes
+ *				utilisées par la fonction principale du programme du module r.waterbalance
+ *
+ ***********************************************************************************************/
+
+/* The priority queue of the flood is a radix heap (Ahuja et al., 1990): the
+   altitudes popped never decrease, so a key only needs to be compared with
+   the last key popped. Bucket b > 0 holds the keys whose highest bit differing
+   from that key is bit b-1, bucket 0 the keys equal to it. Popping empties
+   bucket 0; when it is empty, the first non-empty bucket is spread over the
+   lower ones around its smallest key. Each key moves down at most 32 times.
+
+   Single precision altitudes are mapped to unsigned keys of the same order:
+   the sign bit is set for positive values, all bits are flipped for negative
+   ones. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <grass/gis.h>
+#include <grass/glocale.h>
+#include "Flood.h"
+
+#define FLOOD_CLOSED    1                       /* cell reached by the flood */
+#define FLOOD_DRAINS    2                       /* cell with a lower neighbour, or outlet */
+#define FLOOD_FLAT      4                       /* valid cell which does not drain */
+
+static const int frow[8] = {0, -1, -1, -1, 0, 1, 1, 1};
+static const int fcol[8] = {1, 1, 0, -1, -1, -1, 0, 1};
+
+typedef struct RadixEntry
+{
+        uint32_t key;
+        uint32_t item;
+}RadixEntry;
+
+typedef struct RadixQueue
+{
+        RadixEntry *bucket[RADIX_BUCKETS];
+        int n[RADIX_BUCKETS], capacity[RADIX_BUCKETS];
+        uint32_t last;
+        long size;
+}RadixQueue;
+
+static inline uint32_t AltitudeKey(double z)
+{
+        float f = (float)z;
+        uint32_t u;
+
+        memcpy(&u, &f, sizeof(u));
+        return (u & 0x80000000u) ? ~u : (u | 0x80000000u);
+};
+
+static inline int RadixBucket(const RadixQueue *Q, uint32_t key)
+{
+        return (key == Q->last) ? 0 : 32 - __builtin_clz(key ^ Q->last);
+};
+
+static inline void RadixAppend(RadixQueue *Q, int b, RadixEntry e)
+{
+        if(Q->n[b] == Q->capacity[b]){
+                Q->capacity[b] = Q->capacity[b] ? 2 * Q->capacity[b] : 64;
+                Q->bucket[b] = (RadixEntry *)G_realloc(Q->bucket[b], Q->capacity[b] * sizeof(RadixEntry));
+        }
+        Q->bucket[b][Q->n[b]++] = e;
+};
+
+static void RadixPush(RadixQueue *Q, uint32_t key, uint32_t item)
+{
+        RadixEntry e;
+
+        e.key   = key;
+        e.item  = item;
+        RadixAppend(Q, RadixBucket(Q, key), e);
+        Q->size++;
+};
+
+static uint32_t RadixPop(RadixQueue *Q)
+{
+        RadixEntry *B;
+        uint32_t min;
+        int b, i, n;
+
+        if(!Q->n[0]){
+                for(b = 1; !Q->n[b]; b++)
+                        ;
+                B = Q->bucket[b];
+                n = Q->n[b];
+                for(min = B[0].key, i = 1; i < n; i++)
+                        if(B[i].key < min)
+                                min = B[i].key;
+                Q->last = min;
+                Q->n[b] = 0;
+                /* Les clés de ce seau ne diffèrent de la plus petite qu'en dessous du bit b-1 */
+                for(i = 0; i < n; i++)
+                        RadixAppend(Q, RadixBucket(Q, B[i].key), B[i]);
+        }
+        Q->size--;
+
+        return Q->bucket[0][--Q->n[0]].item;
+};
+
+static void FreeRadixQueue(RadixQueue *Q)
+{
+        int b;
+
+        for(b = 0; b < RADIX_BUCKETS; b++)
+                G_free(Q->bucket[b]);
+};
+
+/* Cellule du bord de la grille ou voisine d'une cellule nulle : l'eau quitte la grille */
+static int IsOutlet(const double *z, int nrows, int ncols, int r, int c)
+{
+        int k;
+
+        if(r == 0 || c == 0 || r == nrows - 1 || c == ncols - 1)
+                return 1;
+        for(k = 0; k < 8; k++)
+                if(isnan(z[(size_t)(r + frow[k]) * ncols + c + fcol[k]]))
+                        return 1;
+        return 0;
+};
+
+void FillDepressions(double *z, int nrows, int ncols, FloodStats *st)
+{
+        size_t ncells = (size_t)nrows * ncols, head = 0, tail = 0;
+        unsigned char *state = (unsigned char *)G_calloc(ncells, 1);
+        uint32_t *pit = (uint32_t *)G_malloc(ncells * sizeof(uint32_t));
+        uint32_t i, j;
+        RadixQueue Q;
+        double d;
+        int r, c, nr, nc, k;
+
+        memset(&Q, 0, sizeof(Q));
+
+        /* Le flot part des exutoires */
+        for(r = 0; r < nrows; r++)
+                for(c = 0; c < ncols; c++){
+                        i = (uint32_t)r * ncols + c;
+                        if(isnan(z[i]))
+                                state[i] = FLOOD_CLOSED;
+                        else if(IsOutlet(z, nrows, ncols, r, c)){
+                                state[i] = FLOOD_CLOSED;
+                                RadixPush(&Q, AltitudeKey(z[i]), i);
+                                st->radix_pushes++;
+                        }
+                }
+
+        for(;;)
+        {
+                /* Les cellules au niveau d'une cuvette passent avant la file de priorité */
+                if(head < tail)
+                        i = pit[head++];
+                else if(Q.size)
+                        i = RadixPop(&Q);
+                else
+                        break;
+
+                r = (int)(i / ncols);
+                c = (int)(i % ncols);
+                for(k = 0; k < 8; k++){
+                        nr = r + frow[k];
+                        nc = c + fcol[k];
+                        if(nr < 0 || nr >= nrows || nc < 0 || nc >= ncols)
+                                continue;
+                        j = (uint32_t)nr * ncols + nc;
+                        if(state[j] & FLOOD_CLOSED)
+                                continue;
+                        state[j] = FLOOD_CLOSED;
+                        if(z[j] <= z[i]){
+                                /* Cuvette : la cellule est relevée au niveau de son déversoir */
+                                if((d = z[i] - z[j]) > 0.0){
+                                        st->filled++;
+                                        st->fill_sum += d;
+                                        if(d > st->fill_max)
+                                                st->fill_max = d;
+                                        z[j] = z[i];
+                                }
+                                pit[tail++] = j;
+                                st->pit_pushes++;
+                        }
+                        else {
+                                RadixPush(&Q, AltitudeKey(z[j]), j);
+                                st->radix_pushes++;
+                        }
+                }
+        }
+
+        FreeRadixQueue(&Q);
+        G_free(pit);
+        G_free(state);
+};
+
+/* Parcours en largeur des cellules plates de même altitude depuis les cellules de la file */
+static int FlatDistances(const double *z, const unsigned char *state, int *dist, uint32_t *queue, size_t head, size_t tail, int nrows, int ncols)
+{
+        uint32_t i, j;
+        int r, c, nr, nc, k, far = 0;
+
+        while(head < tail)
+        {
+                i = queue[head++];
+                r = (int)(i / ncols);
+                c = (int)(i % ncols);
+                for(k = 0; k < 8; k++){
+                        nr = r + frow[k];
+                        nc = c + fcol[k];
+                        if(nr < 0 || nr >= nrows || nc < 0 || nc >= ncols)
+                                continue;
+                        j = (uint32_t)nr * ncols + nc;
+                        if(!(state[j] & FLOOD_FLAT) || dist[j] || z[j] != z[i])
+                                continue;
+                        dist[j] = dist[i] + 1;
+                        if(dist[j] > far)
+                                far = dist[j];
+                        queue[tail++] = j;
+                }
+        }
+        return far;
+};
+
+void ResolveFlats(double *z, int nrows, int ncols, FloodStats *st)
+{
+        size_t ncells = (size_t)nrows * ncols, i, j, tail;
+        unsigned char *state = (unsigned char *)G_calloc(ncells, 1);
+        uint32_t *queue = (uint32_t *)G_malloc(ncells * sizeof(uint32_t));
+        int *away = (int *)G_calloc(ncells, sizeof(int));
+        int *towards = (int *)G_calloc(ncells, sizeof(int));
+        int r, c, nr, nc, k, high, mask;
+        double gap;
+        float f;
+
+        /* Cellules qui drainent (voisine plus basse ou exutoire) et cellules plates */
+        for(r = 0; r < nrows; r++)
+                for(c = 0; c < ncols; c++){
+                        i = (size_t)r * ncols + c;
+                        if(isnan(z[i]))
+                                continue;
+                        if(IsOutlet(z, nrows, ncols, r, c))
+                                state[i] = FLOOD_DRAINS;
+                        else
+                                for(k = 0; k < 8; k++)
+                                        if(z[(size_t)(r + frow[k]) * ncols + c + fcol[k]] < z[i]){
+                                                state[i] = FLOOD_DRAINS;
+                                                break;
+                                        }
+                        if(!state[i])
+                                state[i] = FLOOD_FLAT;
+                }
+
+        /* Eloignement des terrains plus hauts : depuis les cellules plates bordées d'une cellule plus haute */
+        tail = 0;
+        for(r = 0; r < nrows; r++)
+                for(c = 0; c < ncols; c++){
+                        i = (size_t)r * ncols + c;
+                        if(!(state[i] & FLOOD_FLAT))
+                                continue;
+                        for(k = 0; k < 8; k++){
+                                nr = r + frow[k];
+                                nc = c + fcol[k];
+                                if(nr >= 0 && nr < nrows && nc >= 0 && nc < ncols && z[(size_t)nr * ncols + nc] > z[i]){
+                                        away[i]         = 1;
+                                        queue[tail++]   = (uint32_t)i;
+                                        break;
+                                }
+                        }
+                }
+        high = FlatDistances(z, state, away, queue, 0, tail, nrows, ncols);
+        if(tail && high < 1)
+                high = 1;
+
+        /* Rapprochement de l'exutoire : depuis les cellules qui drainent une zone plate de même altitude */
+        tail = 0;
+        for(r = 0; r < nrows; r++)
+                for(c = 0; c < ncols; c++){
+                        i = (size_t)r * ncols + c;
+                        if(!(state[i] & FLOOD_DRAINS))
+                                continue;
+                        for(k = 0; k < 8; k++){
+                                nr = r + frow[k];
+                                nc = c + fcol[k];
+                                if(nr < 0 || nr >= nrows || nc < 0 || nc >= ncols)
+                                        continue;
+                                j = (size_t)nr * ncols + nc;
+                                if((state[j] & FLOOD_FLAT) && z[j] == z[i]){
+                                        queue[tail++] = (uint32_t)i;
+                                        break;
+                                }
+                        }
+                }
+        FlatDistances(z, state, towards, queue, 0, tail, nrows, ncols);
+
+        /* Incrément combiné : le pas de 2 vers l'exutoire l'emporte sur le pas de 1 loin des terrains plus hauts */
+        st->mask_max = 0;
+        for(i = 0; i < ncells; i++)
+                if((state[i] & FLOOD_FLAT) && towards[i]){
+                        away[i] = 2 * towards[i] + (away[i] ? high - away[i] : 0);
+                        if(away[i] > st->mask_max)
+                                st->mask_max = away[i];
+                }
+        if(st->mask_max >= (1 << 27))
+                G_warning(_("Zones plates trop etendues: leur pente est arrondie en double precision"));
+
+        /* Pente infime : l'incrément le plus grand reste sous la moitié de l'écart avec l'altitude simple précision suivante */
+        for(i = 0; i < ncells; i++){
+                if(!(state[i] & FLOOD_FLAT))
+                        continue;
+                if(!towards[i]){
+                        st->unresolved++;
+                        continue;
+                }
+                mask    = away[i];
+                f       = (float)z[i];
+                gap     = (double)nextafterf(f, INFINITY) - (double)f;
+                z[i]   += mask * gap / (2.0 * (st->mask_max + 1));
+                st->flats++;
+        }
+
+        G_free(towards);
+        G_free(away);
+        G_free(queue);
+        G_free(state);
+};
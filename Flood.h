@@ -0,0 +1,81 @@
+/***************************************************************************************************************************************************************************************************************************
+ *
+ * MODULE:       r.waterbalance
+ *
+ * AUTHOR(S):    Ian Ondo
+ *
+ * PURPOSE:      Conditionnement des altitudes avant le calcul des directions d'écoulement : les dépressions sont remplies
+ *				 par inondation prioritaire et les zones plates reçoivent une pente infime vers leur exutoire, de sorte que
+ *               chaque cellule ait une voisine plus basse ou soit un exutoire de la grille.
+ *
+ ************************************************************************************************************************************************************************************************************************/
+
+/***********************************************************************************************
+ *
+ *				Flood.h
+ *				Ce fichier d'en-tête déclare les fonctions et structures des données
+ *				du conditionnement des altitudes du module r.waterbalance
+ *
+ ***********************************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifndef _FLOOD_H
+#define _FLOOD_H
+
+/*
+ * Constants
+ * ---------
+ */
+
+// RADIX_BUCKETS represents the number of buckets of the radix queue: one for the
+// last key popped and one per bit of the 32-bit keys.
+#define RADIX_BUCKETS   33
+
+/*
+ * Type: FloodStats
+ * --------------
+ * Counters of FillDepressions and ResolveFlats.
+ */
+typedef struct FloodStats
+{
+        long filled;                            /* cells raised to their spill level */
+        double fill_sum, fill_max;              /* depth of the filling (m) */
+        long radix_pushes, pit_pushes;          /* cells queued by altitude / at the level of a pit */
+        long flats;                             /* flat cells given a slope */
+        long unresolved;                        /* flat cells with no way out, left as is */
+        int mask_max;                           /* largest increment of a flat cell */
+}FloodStats;
+
+/*
+ * Function: FillDepressions
+ * Usage: FillDepressions(z, nrows, ncols, &stats);
+ * -------------------------
+ * Priority-Flood (Barnes et al., 2014): z holds the nrows x ncols altitudes
+ * row by row, NaN for NULL cells. The flood starts from the outlets (cells on
+ * the border of the grid or next to a NULL cell) and raises every cell which
+ * has no descending path to an outlet to the level of its spill point. Cells
+ * are taken in order of altitude from a radix queue; cells at the level of a
+ * pit are taken from a plain FIFO first.
+ *
+ * The altitudes must be single precision values (the module rounds them when
+ * the segment file is written): the keys of the queue are their bit patterns.
+ */
+void FillDepressions(double *z, int nrows, int ncols, FloodStats *st);
+
+/*
+ * Function: ResolveFlats
+ * Usage: ResolveFlats(z, nrows, ncols, &stats);
+ * -------------------------
+ * Flat resolution (Barnes, Lehman and Mulla, 2014) on filled altitudes. A flat
+ * cell has no lower neighbour and is not an outlet. Each flat cell gets the
+ * increment 2*T + (H - A), where T is its distance to the cells draining the
+ * flat and A its distance to the higher cells around it (H the largest A), so
+ * that water flows away from higher terrain toward the outlet of the flat.
+ * The increment is scaled below half the gap between two single precision
+ * altitudes: flats gain a slope and no cell passes a neighbour of another level.
+ */
+void ResolveFlats(double *z, int nrows, int ncols, FloodStats *st);
+
+#endif  /* not defined _FLOOD_H */
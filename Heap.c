@@ -0,0 +1,142 @@
+/***************************************************************************************************************************************************************************************************************************
+ *
+ * MODULE:       r.waterbalance
+ *
+ * AUTHOR(S):    Ian Ondo
+ *
+ * PURPOSE:      File de priorité indexée (tas 4-aire) de la recherche des bassins de drainage par l'algorithme de Dijkstra :
+ *				 les cellules sont traitées par temps de trajet croissant et le temps d'une cellule déjà dans la file
+ *               peut être diminué sans la dupliquer.
+ *
+ ************************************************************************************************************************************************************************************************************************/
+
+/***********************************************************************************************
+ *
+ *				Heap.c
+ *				Ce fichier définit les fonctions de la file de priorité indexée
+ *				utilisées par la fonction principale du programme du module r.waterbalance
+ *
+ ***********************************************************************************************/
+
+/* The children of entry i are HEAP_ARITY*i+1 to HEAP_ARITY*i+HEAP_ARITY, its
+   parent (i-1)/HEAP_ARITY. Sifting moves a hole instead of swapping entries,
+   and updates pos for every entry it moves. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <grass/gis.h>
+#include "Heap.h"
+
+Heap *CreateHeap(int capacity)
+{
+        Heap *H = (Heap *)G_calloc(1, sizeof(Heap));
+        int i;
+
+        if(capacity < 16)
+                capacity = 16;
+        H->capacity     = capacity;
+        H->entries      = (HeapEntry *)G_malloc(capacity * sizeof(HeapEntry));
+        H->nitems       = capacity;
+        H->pos          = (int *)G_malloc(capacity * sizeof(int));
+        for(i = 0; i < capacity; i++)
+                H->pos[i] = -1;
+
+        return H;
+};
+
+void DestroyHeap(Heap *H)
+{
+        if(!H)
+                return;
+        G_free(H->entries);
+        G_free(H->pos);
+        G_free(H);
+};
+
+static void SiftUp(Heap *H, int i, HeapEntry e)
+{
+        int parent;
+
+        while(i > 0){
+                parent = (i - 1) / HEAP_ARITY;
+                if(H->entries[parent].key <= e.key)
+                        break;
+                H->entries[i] = H->entries[parent];
+                H->pos[H->entries[i].item] = i;
+                i = parent;
+        }
+        H->entries[i] = e;
+        H->pos[e.item] = i;
+};
+
+static void SiftDown(Heap *H, int i, HeapEntry e)
+{
+        int child, last, best;
+
+        for(;;){
+                child = HEAP_ARITY * i + 1;
+                if(child >= H->n)
+                        break;
+                last = child + HEAP_ARITY;
+                if(last > H->n)
+                        last = H->n;
+                /* Plus petit des enfants */
+                for(best = child++; child < last; child++)
+                        if(H->entries[child].key < H->entries[best].key)
+                                best = child;
+                if(e.key <= H->entries[best].key)
+                        break;
+                H->entries[i] = H->entries[best];
+                H->pos[H->entries[i].item] = i;
+                i = best;
+        }
+        H->entries[i] = e;
+        H->pos[e.item] = i;
+};
+
+void HeapPush(Heap *H, int item, double key)
+{
+        HeapEntry e;
+        int n;
+
+        if(H->n == H->capacity){
+                H->capacity *= 2;
+                H->entries = (HeapEntry *)G_realloc(H->entries, H->capacity * sizeof(HeapEntry));
+        }
+        if(item >= H->nitems){
+                n = H->nitems;
+                while(item >= H->nitems)
+                        H->nitems *= 2;
+                H->pos = (int *)G_realloc(H->pos, H->nitems * sizeof(int));
+                for(; n < H->nitems; n++)
+                        H->pos[n] = -1;
+        }
+        e.key   = key;
+        e.item  = item;
+        SiftUp(H, H->n++, e);
+        H->pushes++;
+};
+
+int HeapPop(Heap *H, double *key)
+{
+        HeapEntry top = H->entries[0];
+
+        H->pos[top.item] = -1;
+        if(--H->n > 0)
+                SiftDown(H, 0, H->entries[H->n]);
+        if(key)
+                *key = top.key;
+        H->pops++;
+
+        return top.item;
+};
+
+void HeapDecreaseKey(Heap *H, int item, double key)
+{
+        HeapEntry e;
+
+        e.key   = key;
+        e.item  = item;
+        SiftUp(H, H->pos[item], e);
+        H->decreases++;
+};
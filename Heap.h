@@ -0,0 +1,111 @@
+/***************************************************************************************************************************************************************************************************************************
+ *
+ * MODULE:       r.waterbalance
+ *
+ * AUTHOR(S):    Ian Ondo
+ *
+ * PURPOSE:      File de priorité indexée (tas 4-aire) de la recherche des bassins de drainage par l'algorithme de Dijkstra :
+ *				 les cellules sont traitées par temps de trajet croissant et le temps d'une cellule déjà dans la file
+ *               peut être diminué sans la dupliquer.
+ *
+ ************************************************************************************************************************************************************************************************************************/
+
+/***********************************************************************************************
+ *
+ *				Heap.h
+ *				Ce fichier d'en-tête déclare les fonctions et structures des données
+ *				de la file de priorité indexée du module r.waterbalance
+ *
+ ***********************************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifndef _HEAP_H
+#define _HEAP_H
+
+/*
+ * Constants
+ * ---------
+ */
+
+// HEAP_ARITY represents the number of children of a node of the heap: with 4,
+// the children of a node share one or two cache lines and the heap is half as deep.
+#define HEAP_ARITY    4
+
+/*
+ * Type: HeapEntry
+ * --------------
+ * An item of the heap (an index chosen by the caller) and its key. Keys are
+ * kept in the heap array so that sifting does not follow the items.
+ */
+typedef struct HeapEntry
+{
+        double key;
+        int item;
+}HeapEntry;
+
+/*
+ * Type: Heap
+ * --------------
+ * Indexed min-heap: pos[item] is the position of item in entries, -1 when
+ * the item is not in the heap. Items range from 0 to nitems-1; pos grows
+ * with the largest item pushed.
+ */
+typedef struct Heap
+{
+        int n, capacity;
+        HeapEntry *entries;
+        int *pos;
+        int nitems;
+
+        /* Statistiques */
+        long pushes, pops, decreases;
+}Heap;
+
+/*
+ * Functions: CreateHeap, DestroyHeap
+ * Usage: heap = CreateHeap(capacity);
+ *        DestroyHeap(heap);
+ * -------------------------
+ * capacity is the initial number of entries and items; both grow on demand.
+ */
+Heap *CreateHeap(int capacity);
+void DestroyHeap(Heap *H);
+
+/*
+ * Functions: HeapPush, HeapPop, HeapDecreaseKey
+ * Usage: HeapPush(heap, item, key);
+ *        item = HeapPop(heap, &key);
+ *        HeapDecreaseKey(heap, item, key);
+ * --------------------------------------------
+ * HeapPush inserts an item which is not in the heap. HeapPop removes the item
+ * of smallest key and returns it, with its key if key is not NULL; the heap
+ * must not be empty. HeapDecreaseKey lowers the key of an item in the heap.
+ */
+void HeapPush(Heap *H, int item, double key);
+int HeapPop(Heap *H, double *key);
+void HeapDecreaseKey(Heap *H, int item, double key);
+
+/*
+ * Functions: HeapIsEmpty, HeapContains, HeapKey
+ * Usage: if (HeapContains(heap, item) && key < HeapKey(heap, item)) ...
+ * -----------------------------------
+ * HeapKey is only defined for an item in the heap.
+ */
+static inline int HeapIsEmpty(const Heap *H)
+{
+        return H->n == 0;
+}
+
+static inline int HeapContains(const Heap *H, int item)
+{
+        return item < H->nitems && H->pos[item] >= 0;
+}
+
+static inline double HeapKey(const Heap *H, int item)
+{
+        return H->entries[H->pos[item]].key;
+}
+
+#endif  /* not defined _HEAP_H */
@@ -0,0 +1,168 @@
+/***************************************************************************************************************************************************************************************************************************
+ *
+ * MODULE:       r.waterbalance
+ *
+ * AUTHOR(S):    Ian Ondo
+ *              
+ * PURPOSE:      Classes de fonctions de réponse du ruissellement.
+ *				 Les contributeurs dont les paramètres (moyenne, forme) de la loi inverse gaussienne tombent dans la même case
+ *               d'une grille de quantification partagent une seule table de valeurs de la fonction de réponse.
+ *
+ ************************************************************************************************************************************************************************************************************************/
+
+/***********************************************************************************************
+ *
+ *				Kernel.c
+ *				Ce fichier définit les fonctions du réservoir de classes de fonctions de réponse
+ *				utilisées par la fonction principale du programme du module r.waterbalance
+ *
+ ***********************************************************************************************/
+
+/* On a uniform hillslope, contributors at the same flow distance from their
+   outlet have the same travel time mean and variance up to rounding, whichever
+   cell they drain to. Quantising (mu, lambda) on a logarithmic grid makes them
+   share one class, so the number of kernel tables, and the work needed to fill
+   them, depends on the number of distinct classes instead of the basin sizes. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <grass/gis.h>
+#include <grass/glocale.h>
+#include "Kernel.h"
+
+KernelPool *CreateKernelPool(double quantum)
+{
+        KernelPool *K = (KernelPool *)G_malloc(sizeof(KernelPool));
+
+        K->classes       = NULL;
+        K->nclasses      = 0;
+        K->capacity      = 0;
+        K->nslots        = 1024;
+        K->slots         = (int *)G_calloc(K->nslots, sizeof(int));
+        K->quantum       = quantum;
+        K->log_step      = (quantum > 0.0) ? log1p(quantum) : 0.0;
+        K->lookups       = 0;
+        K->max_rel_error = 0.0;
+
+        return K;
+};
+
+void DestroyKernelPool(KernelPool *K)
+{
+        int i;
+
+        for(i = 0; i < K->nclasses; i++)
+                if(K->classes[i].table)
+                        G_free(K->classes[i].table);
+        if(K->classes)
+                G_free(K->classes);
+        G_free(K->slots);
+        G_free(K);
+};
+
+/* Quantifie un paramètre : indice de la puissance de (1+quantum) la plus proche,
+   ou représentation binaire exacte sans quantification ou pour une valeur non finie */
+static long long Quantise(const KernelPool *K, double v)
+{
+        long long bits;
+
+        if(K->log_step > 0.0 && v > 0.0 && isfinite(v))
+                return llround(log(v) / K->log_step);
+        memcpy(&bits, &v, sizeof(bits));
+        return bits;
+};
+
+static double Representative(const KernelPool *K, double v, long long q)
+{
+        if(K->log_step > 0.0 && v > 0.0 && isfinite(v))
+                return exp((double)q * K->log_step);
+        return v;
+};
+
+static unsigned long long Hash(int comp, int outlet, long long a, long long b)
+{
+        unsigned long long h = (unsigned long long)a * 0x9E3779B97F4A7C15ULL;
+
+        h ^= (unsigned long long)b + 0x7F4A7C159E3779B9ULL + (h << 6) + (h >> 2);
+        h ^= (unsigned long long)(comp * 2 + outlet) * 0xBF58476D1CE4E5B9ULL;
+        h ^= h >> 31;
+        return h;
+};
+
+static void TrackError(KernelPool *K, const KernelClass *c, double mu, double lambda)
+{
+        double e;
+
+        if(mu > 0.0 && isfinite(mu)){
+                e = fabs(c->mu - mu) / mu;
+                if(e > K->max_rel_error) K->max_rel_error = e;
+        }
+        if(lambda > 0.0 && isfinite(lambda)){
+                e = fabs(c->lambda - lambda) / lambda;
+                if(e > K->max_rel_error) K->max_rel_error = e;
+        }
+};
+
+static void Rehash(KernelPool *K)
+{
+        KernelClass *c;
+        int i, s;
+
+        G_free(K->slots);
+        K->nslots *= 2;
+        K->slots   = (int *)G_calloc(K->nslots, sizeof(int));
+        for(i = 0; i < K->nclasses; i++){
+                c = &K->classes[i];
+                s = (int)(Hash(c->comp, c->outlet, c->qmu, c->qlambda) & (unsigned long long)(K->nslots - 1));
+                while(K->slots[s])
+                        s = (s + 1) & (K->nslots - 1);
+                K->slots[s] = i + 1;
+        }
+};
+
+int KernelClassFind(KernelPool *K, int comp, int outlet, double mu, double lambda, int *created)
+{
+        long long qmu = Quantise(K, mu), qlambda = Quantise(K, lambda);
+        KernelClass *c;
+        int s;
+
+        K->lookups++;
+        *created = 0;
+
+        s = (int)(Hash(comp, outlet, qmu, qlambda) & (unsigned long long)(K->nslots - 1));
+        while(K->slots[s]){
+                c = &K->classes[K->slots[s] - 1];
+                if(c->comp == comp && c->outlet == outlet && c->qmu == qmu && c->qlambda == qlambda){
+                        TrackError(K, c, mu, lambda);
+                        return K->slots[s] - 1;
+                }
+                s = (s + 1) & (K->nslots - 1);
+        }
+
+        /* Nouvelle classe */
+        if(K->nclasses == K->capacity){
+                K->capacity = K->capacity ? 2 * K->capacity : 256;
+                K->classes  = (KernelClass *)G_realloc(K->classes, K->capacity * sizeof(KernelClass));
+        }
+        c = &K->classes[K->nclasses];
+        c->comp    = comp;
+        c->outlet  = outlet;
+        c->qmu     = qmu;
+        c->qlambda = qlambda;
+        c->mu      = Representative(K, mu, qmu);
+        c->lambda  = Representative(K, lambda, qlambda);
+        c->t_min   = 1;
+        c->t_max   = 0;
+        c->lost    = 0.0;
+        c->table   = NULL;
+        K->slots[s] = ++K->nclasses;
+        *created = 1;
+        TrackError(K, c, mu, lambda);
+
+        if(2 * K->nclasses > K->nslots)
+                Rehash(K);
+
+        return K->nclasses - 1;
+};
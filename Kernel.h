@@ -0,0 +1,82 @@
+/***************************************************************************************************************************************************************************************************************************
+ *
+ * MODULE:       r.waterbalance
+ *
+ * AUTHOR(S):    Ian Ondo
+ *              
+ * PURPOSE:      Classes de fonctions de réponse du ruissellement.
+ *				 Les contributeurs dont les paramètres (moyenne, forme) de la loi inverse gaussienne tombent dans la même case
+ *               d'une grille de quantification partagent une seule table de valeurs de la fonction de réponse.
+ *
+ ************************************************************************************************************************************************************************************************************************/
+
+/***********************************************************************************************
+ *
+ *				Kernel.h
+ *				Ce fichier d'en-tête déclare les fonctions et structures des données
+ *				du réservoir de classes de fonctions de réponse du module r.waterbalance
+ *
+ ***********************************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "utils.h"
+
+#ifndef _KERNEL_H
+#define _KERNEL_H
+
+/*
+ * Type: KernelClass
+ * --------------
+ * One response function shared by every contributor of the class.
+ * mu and lambda are the centre of the quantisation cell; table holds the
+ * response of each lag of the support window [t_min, t_max].
+ */
+typedef struct KernelClass
+{
+        int comp, outlet;               /* flow component and outlet flag */
+        long long qmu, qlambda;         /* quantised parameters (hash key) */
+        double mu, lambda;
+        int t_min, t_max;
+        double lost;                    /* mass dropped by the window */
+        real *table;
+}KernelClass;
+
+/*
+ * Type: KernelPool
+ * --------------
+ * Open addressing hash table of classes. quantum is the relative step of the
+ * quantisation grid: parameters are rounded to the nearest power of (1+quantum).
+ * quantum = 0 only merges contributors with identical parameters.
+ */
+typedef struct KernelPool
+{
+        KernelClass *classes;
+        int nclasses, capacity;
+        int *slots;                     /* class index + 1, 0 for an empty slot */
+        int nslots;
+        double quantum, log_step;
+        long lookups;
+        double max_rel_error;           /* largest relative change of mu or lambda caused by the grid */
+}KernelPool;
+
+/*
+ * Functions: CreateKernelPool, DestroyKernelPool
+ * Usage: pool = CreateKernelPool(quantum);
+ *        DestroyKernelPool(pool);
+ * -------------------------
+ */
+KernelPool *CreateKernelPool(double quantum);
+void DestroyKernelPool(KernelPool *K);
+
+/*
+ * Function: KernelClassFind
+ * Usage: cls = KernelClassFind(pool, comp, outlet, mu, lambda, &created);
+ * -------------------------
+ * Returns the index of the class of (comp, outlet, mu, lambda), creating it
+ * when needed. A new class has its representative mu and lambda set and
+ * table = NULL: the caller fills the window and the table.
+ */
+int KernelClassFind(KernelPool *K, int comp, int outlet, double mu, double lambda, int *created);
+
+#endif  /* not defined _KERNEL_H */
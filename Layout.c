@@ -0,0 +1,105 @@
+/***************************************************************************************************************************************************************************************************************************
+ *
+ * MODULE:       r.waterbalance
+ *
+ * AUTHOR(S):    Ian Ondo
+ *              
+ * PURPOSE:      Ordre de rangement en mémoire des cellules du paysage : par lignes, ou le long d'une courbe de remplissage
+ *				 (Morton ou Hilbert) par blocs, afin que les cellules voisines et les cellules amont d'une cellule
+ *               soient proches en mémoire.
+ *
+ ************************************************************************************************************************************************************************************************************************/
+
+/***********************************************************************************************
+ *
+ *				Layout.c
+ *				Ce fichier définit les fonctions du rangement des cellules
+ *				utilisées par la fonction principale du programme du module r.waterbalance
+ *
+ ***********************************************************************************************/
+
+/* In row order, the 8 neighbours of a cell lie in three rows ncols cells apart,
+   and a basin built by FindBasin() spreads over as many rows as it is long.
+   Inside a 16x16 block ordered along a space-filling curve, cells that are close
+   on the grid are close in memory: a neighbour is usually in the same or the
+   next few cache lines, and a small basin fits in a few pages. Blocks stay in
+   row order so that the row by row sweep of the routing still walks the cell
+   array forward, one band of blocks at a time. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <grass/gis.h>
+#include <grass/glocale.h>
+#include "Layout.h"
+
+/* Indice de Morton (Z) de (x, y) dans un bloc : entrelace les bits de y et de x */
+static uint32_t MortonIndex(uint32_t x, uint32_t y, int bits)
+{
+        uint32_t d = 0;
+        int b;
+
+        for(b = 0; b < bits; b++)
+                d |= ((x >> b) & 1u) << (2*b) | ((y >> b) & 1u) << (2*b + 1);
+        return d;
+};
+
+/* Indice de (x, y) le long de la courbe de Hilbert d'un bloc de côté n */
+static uint32_t HilbertIndex(uint32_t x, uint32_t y, uint32_t n)
+{
+        uint32_t rx, ry, s, d = 0, t;
+
+        for(s = n / 2; s > 0; s /= 2){
+                rx = (x & s) > 0;
+                ry = (y & s) > 0;
+                d += s * s * ((3 * rx) ^ ry);
+                /* Rotation du quadrant */
+                if(ry == 0){
+                        if(rx == 1){
+                                x = s - 1 - x;
+                                y = s - 1 - y;
+                        }
+                        t = x; x = y; y = t;
+                }
+        }
+        return d;
+};
+
+CellLayout *CreateCellLayout(int kind, int nrows, int ncols)
+{
+        CellLayout *L = (CellLayout *)G_malloc(sizeof(CellLayout));
+        int shift   = (kind == LAYOUT_ROWMAJOR) ? 0 : LAYOUT_SHIFT;
+        uint32_t B  = 1u << shift;
+        uint32_t nbrows = (nrows + B - 1) / B, nbcols = (ncols + B - 1) / B;
+        uint32_t x, y;
+        int i;
+
+        if((double)nbrows * nbcols * B * B > 4294967295.0)
+                G_fatal_error(_("La carte est trop grande pour des indices de cellules sur 32 bits"));
+
+        L->kind     = kind;
+        L->shift    = shift;
+        L->mask     = B - 1;
+        L->ncells   = nbrows * nbcols * B * B;
+        L->row_off  = (uint32_t *)G_malloc(nrows * sizeof(uint32_t));
+        L->col_off  = (uint32_t *)G_malloc(ncols * sizeof(uint32_t));
+        L->local    = (uint32_t *)G_malloc(B * B * sizeof(uint32_t));
+
+        for(i = 0; i < nrows; i++)
+                L->row_off[i] = (uint32_t)(i >> shift) * nbcols * B * B;
+        for(i = 0; i < ncols; i++)
+                L->col_off[i] = (uint32_t)(i >> shift) * B * B;
+        for(y = 0; y < B; y++)
+                for(x = 0; x < B; x++)
+                        L->local[(y << shift) | x] = (kind == LAYOUT_MORTON)  ? MortonIndex(x, y, shift)
+                                                   : (kind == LAYOUT_HILBERT) ? HilbertIndex(x, y, B)
+                                                   : (y << shift) | x;
+        return L;
+};
+
+void DestroyCellLayout(CellLayout *L)
+{
+        G_free(L->row_off);
+        G_free(L->col_off);
+        G_free(L->local);
+        G_free(L);
+};
@@ -0,0 +1,77 @@
+/***************************************************************************************************************************************************************************************************************************
+ *
+ * MODULE:       r.waterbalance
+ *
+ * AUTHOR(S):    Ian Ondo
+ *              
+ * PURPOSE:      Ordre de rangement en mémoire des cellules du paysage : par lignes, ou le long d'une courbe de remplissage
+ *				 (Morton ou Hilbert) par blocs, afin que les cellules voisines et les cellules amont d'une cellule
+ *               soient proches en mémoire.
+ *
+ ************************************************************************************************************************************************************************************************************************/
+
+/***********************************************************************************************
+ *
+ *				Layout.h
+ *				Ce fichier d'en-tête déclare les fonctions et structures des données
+ *				du rangement des cellules du module r.waterbalance
+ *
+ ***********************************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#ifndef _LAYOUT_H
+#define _LAYOUT_H
+
+/*
+ * Constants
+ * ---------
+ */
+
+// LAYOUT_SHIFT represents log2 of the side of a block of cells ordered along the curve.
+#define LAYOUT_SHIFT  4
+
+enum { LAYOUT_ROWMAJOR, LAYOUT_MORTON, LAYOUT_HILBERT };
+
+/*
+ * Type: CellLayout
+ * --------------
+ * Position of cell (row, col) in the cell array:
+ *      row_off[row] + col_off[col] + local[(row & mask) << shift | (col & mask)]
+ * The grid is cut in square blocks of 2^shift cells, stored one after the
+ * other in row order; the cells of a block follow the Morton or Hilbert
+ * curve. Row order is the special case of 1x1 blocks. The tables make every
+ * lookup, neighbours included, three loads and two additions.
+ */
+typedef struct CellLayout
+{
+        int kind;
+        int shift, mask;
+        uint32_t *row_off, *col_off;
+        uint32_t *local;
+        uint32_t ncells;                /* size of the cell array, padding of the last blocks included */
+}CellLayout;
+
+/*
+ * Functions: CreateCellLayout, DestroyCellLayout
+ * Usage: L = CreateCellLayout(LAYOUT_HILBERT, nrows, ncols);
+ *        DestroyCellLayout(L);
+ * -------------------------
+ */
+CellLayout *CreateCellLayout(int kind, int nrows, int ncols);
+void DestroyCellLayout(CellLayout *L);
+
+/*
+ * Function: CellPos
+ * Usage: i = CellPos(L, row, col);
+ * -------------------------
+ * Returns the position of cell (row, col) in the cell array.
+ */
+static inline uint32_t CellPos(const CellLayout *L, int row, int col)
+{
+        return L->row_off[row] + L->col_off[col] + L->local[((row & L->mask) << L->shift) | (col & L->mask)];
+}
+
+#endif  /* not defined _LAYOUT_H */
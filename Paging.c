@@ -0,0 +1,213 @@
+/***************************************************************************************************************************************************************************************************************************
+ *
+ * MODULE:       r.waterbalance
+ *
+ * AUTHOR(S):    Ian Ondo
+ *
+ * PURPOSE:      Géométrie des segments du fichier segmenté des paramètres selon l'accès de chaque phase du calcul,
+ *				 et comptage des pages lues et écrites par phase dans un cache LRU fantôme.
+ *
+ ************************************************************************************************************************************************************************************************************************/
+
+/***********************************************************************************************
+ *
+ *				Paging.c
+ *				Ce fichier définit les fonctions de la géométrie des segments
+ *				utilisées par la fonction principale du programme du module r.waterbalance
+ *
+ ***********************************************************************************************/
+
+/* The segment library keeps a fixed number of segments in memory and reads a
+   whole segment on a miss, but Segment_get_row() and Segment_put_row() read and
+   write the file directly, one call per segment across the row. Square segments
+   keep the upslope searches of FindBasin() within a few segments; with strips
+   spanning the row, a row sweep is one call per row and a cell by cell sweep in
+   row order reads each segment once, whatever the memory. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <grass/gis.h>
+#include <grass/glocale.h>
+#include "Paging.h"
+
+static const char *phase_names[PAGE_PHASES] = {
+        "ecriture", "directions d ecoulement", "initialisation", "bassins de drainage", "calcul", "changement de geometrie"
+};
+
+SegmentGeometry PlanSegmentGeometry(int nrows, int ncols, int side, size_t len, double budget_mb, int shape)
+{
+        SegmentGeometry g;
+        double seg_mb, rows;
+
+        g.shape = shape;
+        g.nrows = nrows;
+        g.ncols = ncols;
+        if(shape == SEG_STRIP){
+                rows = budget_mb * 1048576. / (4. * ncols * len);
+                if(rows > (double)INT_MAX / ((double)ncols * len))
+                        rows = (double)INT_MAX / ((double)ncols * len);
+                if(rows > side) rows = side;
+                if(rows < 1) rows = 1;
+                g.srows = (int)rows;
+                g.scols = ncols;
+        }
+        else
+                g.srows = g.scols = side;
+
+        g.ncolseg       = (ncols + g.scols - 1) / g.scols;
+        g.nseg          = ((nrows + g.srows - 1) / g.srows) * g.ncolseg;
+        seg_mb          = (double)g.srows * g.scols * (len / 1048576.);
+        g.in_memory     = budget_mb / seg_mb;
+        if(g.in_memory < 4) g.in_memory = 4;
+        if(g.in_memory > g.nseg) g.in_memory = g.nseg;
+        g.mem_mb        = seg_mb * g.in_memory;
+
+        return g;
+};
+
+static void ResetCache(PageShadow *S)
+{
+        int i;
+
+        S->prev         = (int *)G_realloc(S->prev, S->geom.nseg * sizeof(int));
+        S->next         = (int *)G_realloc(S->next, S->geom.nseg * sizeof(int));
+        S->state        = (unsigned char *)G_realloc(S->state, S->geom.nseg);
+        for(i = 0; i < S->geom.nseg; i++)
+                S->state[i] = 0;
+        S->mru          = -1;
+        S->lru          = -1;
+        S->resident     = 0;
+        S->last         = -1;
+};
+
+PageShadow *CreatePageShadow(SegmentGeometry geom, size_t len)
+{
+        PageShadow *S = (PageShadow *)G_calloc(1, sizeof(PageShadow));
+
+        S->geom         = geom;
+        S->len          = len;
+        S->phase        = PAGE_WRITE;
+        ResetCache(S);
+
+        return S;
+};
+
+void DestroyPageShadow(PageShadow *S)
+{
+        if(!S)
+                return;
+        G_free(S->prev);
+        G_free(S->next);
+        G_free(S->state);
+        G_free(S);
+};
+
+static void Unlink(PageShadow *S, int seg)
+{
+        if(S->prev[seg] >= 0) S->next[S->prev[seg]] = S->next[seg];
+        else S->mru = S->next[seg];
+        if(S->next[seg] >= 0) S->prev[S->next[seg]] = S->prev[seg];
+        else S->lru = S->prev[seg];
+};
+
+static void PushFront(PageShadow *S, int seg)
+{
+        S->prev[seg] = -1;
+        S->next[seg] = S->mru;
+        if(S->mru >= 0) S->prev[S->mru] = seg;
+        else S->lru = seg;
+        S->mru = seg;
+};
+
+void PageCellMiss(PageShadow *S, int seg, int modified)
+{
+        PageStats *st = &S->stats[S->phase];
+        double bytes = (double)S->geom.srows * S->geom.scols * S->len;
+        int old;
+
+        if(S->state[seg]){
+                Unlink(S, seg);
+        }
+        else {
+                /* Lit le segment, à la place du moins récemment utilisé si le cache est plein */
+                if(S->resident == S->geom.in_memory){
+                        old = S->lru;
+                        Unlink(S, old);
+                        if(S->state[old] == 2){
+                                st->page_outs++;
+                                st->bytes_written += bytes;
+                        }
+                        S->state[old] = 0;
+                        S->resident--;
+                }
+                st->page_ins++;
+                st->bytes_read += bytes;
+                S->state[seg] = 1;
+                S->resident++;
+        }
+        PushFront(S, seg);
+        if(modified)
+                S->state[seg] = 2;
+        S->last = seg;
+};
+
+void PageRow(PageShadow *S, int write)
+{
+        PageStats *st = &S->stats[S->phase];
+
+        st->rows++;
+        if(write){
+                st->row_writes += S->geom.ncolseg;
+                st->bytes_written += (double)S->geom.ncolseg * S->geom.scols * S->len;
+        }
+        else {
+                st->row_reads += S->geom.ncolseg;
+                st->bytes_read += (double)S->geom.ncolseg * S->geom.scols * S->len;
+        }
+};
+
+void PageFlush(PageShadow *S)
+{
+        PageStats *st = &S->stats[S->phase];
+        int seg;
+
+        for(seg = S->mru; seg >= 0; seg = S->next[seg])
+                if(S->state[seg] == 2){
+                        st->page_outs++;
+                        st->bytes_written += (double)S->geom.srows * S->geom.scols * S->len;
+                        S->state[seg] = 1;
+                }
+};
+
+void PageShadowRetile(PageShadow *S, SegmentGeometry geom)
+{
+        int row;
+        int phase = S->phase;
+
+        /* Copie ligne par ligne : lecture dans l'ancienne géométrie, écriture dans la nouvelle */
+        S->phase = PAGE_RETILE;
+        PageFlush(S);
+        for(row = 0; row < S->geom.nrows; row++)
+                PageRow(S, 0);
+        S->geom = geom;
+        ResetCache(S);
+        for(row = 0; row < geom.nrows; row++)
+                PageRow(S, 1);
+        S->phase = phase;
+};
+
+void PageShadowReport(const PageShadow *S)
+{
+        const PageStats *st;
+        int i;
+
+        for(i = 0; i < PAGE_PHASES; i++){
+                st = &S->stats[i];
+                if(st->cells == 0 && st->rows == 0)
+                        continue;
+                G_message(_("Fichier segmente, %s: %ld acces aux cellules (%ld pages lues, %ld ecrites), %ld lignes (%ld lectures, %ld ecritures), %.1f MB lus, %.1f MB ecrits"),
+                          phase_names[i], st->cells, st->page_ins, st->page_outs, st->rows, st->row_reads, st->row_writes,
+                          st->bytes_read / 1048576., st->bytes_written / 1048576.);
+        }
+};
@@ -0,0 +1,161 @@
+/***************************************************************************************************************************************************************************************************************************
+ *
+ * MODULE:       r.waterbalance
+ *
+ * AUTHOR(S):    Ian Ondo
+ *
+ * PURPOSE:      Géométrie des segments du fichier segmenté des paramètres selon l'accès de chaque phase du calcul,
+ *				 et comptage des pages lues et écrites par phase dans un cache LRU fantôme.
+ *
+ ************************************************************************************************************************************************************************************************************************/
+
+/***********************************************************************************************
+ *
+ *				Paging.h
+ *				Ce fichier d'en-tête déclare les fonctions et structures des données
+ *				de la géométrie des segments du module r.waterbalance
+ *
+ ***********************************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifndef _PAGING_H
+#define _PAGING_H
+
+/*
+ * Constants
+ * ---------
+ */
+
+// Segment shapes: square tiles suit the neighbourhood and basin searches,
+// full width strips suit the row by row sweeps.
+#define SEG_SQUARE      0
+#define SEG_STRIP       1
+
+// Phases of the module accessing the segment file.
+#define PAGE_WRITE      0       /* createSEGMENT(), row by row */
+#define PAGE_FLOWDIR    1       /* FlowDirections(), row by row */
+#define PAGE_INIT       2       /* Init(), cell by cell in row order */
+#define PAGE_BASIN      3       /* FindBasin(), upslope searches */
+#define PAGE_PROCESS    4       /* Process(), row by row at each time step */
+#define PAGE_RETILE     5       /* copies between two geometries */
+#define PAGE_PHASES     6
+
+/*
+ * Type: SegmentGeometry
+ * --------------
+ * Segments of srows x scols cells, in_memory of them being kept in memory.
+ */
+typedef struct SegmentGeometry
+{
+        int shape;
+        int nrows, ncols;
+        int srows, scols;
+        int nseg;                       /* segments of the file */
+        int ncolseg;                    /* segments across one row */
+        int in_memory;
+        double mem_mb;
+}SegmentGeometry;
+
+/*
+ * Function: PlanSegmentGeometry
+ * Usage: g = PlanSegmentGeometry(nrows, ncols, side, len, budget_mb, shape);
+ * -------------------------
+ * Square segments have side rows and columns. Strips span the whole row and
+ * have as many rows as fit four of them in budget_mb, at most side. As many
+ * segments as budget_mb allows are kept in memory, at least four.
+ */
+SegmentGeometry PlanSegmentGeometry(int nrows, int ncols, int side, size_t len, double budget_mb, int shape);
+
+/*
+ * Type: PageStats
+ * --------------
+ * Accesses of one phase. Cell accesses go through the segment cache: a miss
+ * reads a whole segment, and evicts the least recently used one, written back
+ * if it was modified. Row accesses bypass the cache and read or write the
+ * part of the row held by each segment across it.
+ */
+typedef struct PageStats
+{
+        long cells, page_ins, page_outs;
+        long rows, row_reads, row_writes;
+        double bytes_read, bytes_written;
+}PageStats;
+
+/*
+ * Type: PageShadow
+ * --------------
+ * Shadow of the segment cache: it replays the least recently used replacement
+ * of the segment library on segment numbers only, to count the pages read and
+ * written by each phase.
+ */
+typedef struct PageShadow
+{
+        SegmentGeometry geom;
+        size_t len;
+        int *prev, *next;               /* prev is more recently used, -1 at the ends */
+        unsigned char *state;           /* 0 not resident, 1 resident, 2 modified */
+        int mru, lru, resident;
+        int last;                       /* segment of the last cell access */
+        int phase;
+        PageStats stats[PAGE_PHASES];
+}PageShadow;
+
+/*
+ * Functions: CreatePageShadow, DestroyPageShadow
+ * Usage: S = CreatePageShadow(geom, len);
+ *        DestroyPageShadow(S);
+ * -------------------------
+ * len is the size of the record of a cell.
+ */
+PageShadow *CreatePageShadow(SegmentGeometry geom, size_t len);
+void DestroyPageShadow(PageShadow *S);
+
+/*
+ * Function: PageShadowRetile
+ * Usage: PageShadowRetile(S, geom);
+ * -------------------------
+ * Counts the copy of the file into a new geometry, which starts with an
+ * empty cache.
+ */
+void PageShadowRetile(PageShadow *S, SegmentGeometry geom);
+
+/*
+ * Functions: PageCellMiss, PageCell
+ * Usage: PageCell(S, row, col, modified);
+ * -------------------------
+ * Counts a cell access, modified when the cell is written.
+ */
+void PageCellMiss(PageShadow *S, int seg, int modified);
+
+static inline void PageCell(PageShadow *S, int row, int col, int modified)
+{
+        int seg = (row / S->geom.srows) * S->geom.ncolseg + col / S->geom.scols;
+
+        S->stats[S->phase].cells++;
+        if(seg == S->last && S->state[seg] > modified)
+                return;
+        PageCellMiss(S, seg, modified);
+}
+
+/*
+ * Functions: PageRow, PageFlush
+ * Usage: PageRow(S, write);
+ *        PageFlush(S);
+ * -------------------------
+ * PageRow() counts the read or the write of a whole row, PageFlush() the
+ * write back of the modified segments.
+ */
+void PageRow(PageShadow *S, int write);
+void PageFlush(PageShadow *S);
+
+/*
+ * Function: PageShadowReport
+ * Usage: PageShadowReport(S);
+ * -------------------------
+ * Prints the accesses of each phase.
+ */
+void PageShadowReport(const PageShadow *S);
+
+#endif  /* not defined _PAGING_H */
@@ -0,0 +1,222 @@
+/***************************************************************************************************************************************************************************************************************************
+ *
+ * MODULE:       r.waterbalance
+ *
+ * AUTHOR(S):    Ian Ondo
+ *
+ * PURPOSE:      Lecture parallèle des lignes des cartes raster des paramètres.
+ *				 Chaque carte lue par createSEGMENT est confiée à un fil d'exécution dédié qui décompresse et convertit
+ *               ses lignes en avance pendant que les lignes précédentes sont rangées dans le fichier segmenté.
+ *
+ ************************************************************************************************************************************************************************************************************************/
+
+/***********************************************************************************************
+ *
+ *				Reader.c
+ *				Ce fichier définit les fonctions du lecteur parallèle de lignes raster
+ *				utilisées par la fonction principale du programme du module r.waterbalance
+ *
+ ***********************************************************************************************/
+
+/* Each lane thread walks its map from the first row to the last: it takes a
+   free buffer from the pool, decodes the row with Rast_get_d_row_nomask()
+   (decompression, conversion of CELL and FCELL to DCELL, NULL cells set to
+   the DCELL NULL value) and queues it. The caller pops one row per map, packs
+   them and gives the buffers back. The rings are those of the writer
+   (Writer.h): single-producer/single-consumer with atomic indices.
+
+   The raster library is not thread-safe as a whole: each lane only touches its
+   own file descriptor, and the MASK, whose row buffer is shared by all maps in
+   Rast_get_d_row(), is read and applied by the caller. Maps are opened before
+   CreateRowReader() and closed by DestroyRowReader() once the threads have
+   stopped. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <grass/gis.h>
+#include <grass/raster.h>
+#include <grass/glocale.h>
+#include "Reader.h"
+#include "utils.h"
+
+static void *ReadThread(void *arg)
+{
+        ReaderLane *L = (ReaderLane *)arg;
+        RowJob job;
+        double t0;
+        int row;
+
+        for(row = 0; row < L->nrows; row++)
+        {
+                sem_wait(&L->bufs_ready);
+                if(atomic_load_explicit(&L->stop, memory_order_acquire))
+                        break;
+                RingPop(&L->pool, &job);
+
+                t0 = TimeNow();
+                Rast_get_d_row_nomask(L->fd, job.buf, row);
+                L->read_time += TimeNow() - t0;
+                L->nread++;
+
+                /* Le nombre de tampons de la voie borne le nombre de lignes : la file ne peut pas être pleine */
+                RingPush(&L->rows, job);
+                sem_post(&L->rows_ready);
+        }
+
+        return NULL;
+};
+
+RowReader *CreateRowReader(const int *fds, int nlanes, int nrows, int ncols, int threads)
+{
+        RowReader *R = (RowReader *)G_malloc(sizeof(RowReader));
+        ReaderLane *L;
+        RowJob job;
+        int i, j;
+
+        R->nlanes       = nlanes;
+        R->ncols        = ncols;
+        R->threads      = threads;
+        R->row          = 0;
+        R->lanes        = (ReaderLane *)G_calloc(nlanes, sizeof(ReaderLane));
+        R->maskfd       = Rast_maskfd();
+        R->mask         = (R->maskfd >= 0) ? Rast_allocate_c_buf() : NULL;
+        R->mask_time    = 0.0;
+
+        for(i = 0; i < nlanes; i++)
+        {
+                L = &R->lanes[i];
+                L->fd    = fds[i];
+                L->nrows = nrows;
+                atomic_init(&L->rows.head, 0);
+                atomic_init(&L->rows.tail, 0);
+                atomic_init(&L->pool.head, 0);
+                atomic_init(&L->pool.tail, 0);
+                atomic_init(&L->stop, 0);
+
+                if(!threads){
+                        L->bufs[0] = L->current = (DCELL *)G_malloc(ncols * sizeof(DCELL));
+                        continue;
+                }
+
+                /* Réserve de tampons recyclés de la voie */
+                for(j = 0; j < maxReadRows; j++){
+                        job.fd  = fds[i];
+                        job.buf = L->bufs[j] = (DCELL *)G_malloc(ncols * sizeof(DCELL));
+                        RingPush(&L->pool, job);
+                }
+                sem_init(&L->rows_ready, 0, 0);
+                sem_init(&L->bufs_ready, 0, maxReadRows);
+
+                if(pthread_create(&L->thread, NULL, ReadThread, L) != 0)
+                        G_fatal_error(_("Impossible de creer le fil de lecture des cartes des parametres"));
+        }
+
+        return R;
+};
+
+void ReaderGetRows(RowReader *R, DCELL **rows)
+{
+        ReaderLane *L;
+        RowJob job;
+        double t0;
+        int i, c;
+
+        for(i = 0; i < R->nlanes; i++)
+        {
+                L = &R->lanes[i];
+                if(R->threads){
+                        /* La ligne n'est pas encore décodée : le rangement attend le lecteur */
+                        if(sem_trywait(&L->rows_ready) != 0){
+                                t0 = TimeNow();
+                                sem_wait(&L->rows_ready);
+                                L->stall_time += TimeNow() - t0;
+                                L->stalls++;
+                        }
+                        RingPop(&L->rows, &job);
+                        L->current = job.buf;
+                }
+                else {
+                        t0 = TimeNow();
+                        Rast_get_d_row_nomask(L->fd, L->current, R->row);
+                        L->read_time += TimeNow() - t0;
+                        L->nread++;
+                }
+                rows[i] = L->current;
+        }
+
+        /* Masque : les cellules à zéro ou nulles du MASK sont nulles dans toutes les cartes */
+        if(R->maskfd >= 0){
+                t0 = TimeNow();
+                Rast_get_c_row_nomask(R->maskfd, R->mask, R->row);
+                for(c = 0; c < R->ncols; c++)
+                        if(R->mask[c] == 0 || Rast_is_c_null_value(&R->mask[c]))
+                                for(i = 0; i < R->nlanes; i++)
+                                        Rast_set_d_null_value(&rows[i][c], 1);
+                R->mask_time += TimeNow() - t0;
+        }
+        R->row++;
+};
+
+void ReaderReleaseRows(RowReader *R)
+{
+        ReaderLane *L;
+        RowJob job;
+        int i;
+
+        if(!R->threads)
+                return;
+        for(i = 0; i < R->nlanes; i++){
+                L = &R->lanes[i];
+                job.fd  = L->fd;
+                job.buf = L->current;
+                RingPush(&L->pool, job);
+                sem_post(&L->bufs_ready);
+        }
+};
+
+void ReaderReport(RowReader *R, double elapsed)
+{
+        double read_time = 0.0, stall_time = 0.0, mb = 0.0;
+        long stalls = 0;
+        int i;
+
+        for(i = 0; i < R->nlanes; i++){
+                read_time  += R->lanes[i].read_time;
+                stall_time += R->lanes[i].stall_time;
+                stalls     += R->lanes[i].stalls;
+                mb         += (double)R->lanes[i].nread * R->ncols * sizeof(DCELL) / 1048576.;
+        }
+        if(elapsed <= 0.0)
+                elapsed = 1e-9;
+        G_message(_("Lecture des cartes des parametres: %d cartes, %.1f MB decodes en %.2fs soit %.1f MB/s (%d fils)"),
+                  R->nlanes, mb, elapsed, mb / elapsed, R->threads ? R->nlanes : 0);
+        G_message(_("Decodage: %.2fs cumules, attente du rangement sur la lecture: %.2fs (%ld lignes), masque: %.2fs"),
+                  read_time, stall_time, stalls, R->mask_time);
+};
+
+void DestroyRowReader(RowReader *R)
+{
+        ReaderLane *L;
+        int i, j;
+
+        for(i = 0; i < R->nlanes; i++)
+        {
+                L = &R->lanes[i];
+                if(R->threads){
+                        /* Réveille le fil s'il attend un tampon */
+                        atomic_store_explicit(&L->stop, 1, memory_order_release);
+                        sem_post(&L->bufs_ready);
+                        pthread_join(L->thread, NULL);
+                        sem_destroy(&L->rows_ready);
+                        sem_destroy(&L->bufs_ready);
+                        for(j = 0; j < maxReadRows; j++)
+                                G_free(L->bufs[j]);
+                }
+                else
+                        G_free(L->bufs[0]);
+                Rast_close(L->fd);
+        }
+        G_free(R->mask);
+        G_free(R->lanes);
+        G_free(R);
+};
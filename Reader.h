@@ -0,0 +1,113 @@
+/***************************************************************************************************************************************************************************************************************************
+ *
+ * MODULE:       r.waterbalance
+ *
+ * AUTHOR(S):    Ian Ondo
+ *
+ * PURPOSE:      Lecture parallèle des lignes des cartes raster des paramètres.
+ *				 Chaque carte lue par createSEGMENT est confiée à un fil d'exécution dédié qui décompresse et convertit
+ *               ses lignes en avance pendant que les lignes précédentes sont rangées dans le fichier segmenté.
+ *
+ ************************************************************************************************************************************************************************************************************************/
+
+/***********************************************************************************************
+ *
+ *				Reader.h
+ *				Ce fichier d'en-tête déclare les fonctions et structures des données
+ *				du lecteur parallèle de lignes raster du module r.waterbalance
+ *
+ ***********************************************************************************************/
+
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <grass/gis.h>
+#include "Writer.h"
+
+#ifndef _READER_H
+#define _READER_H
+
+/*
+ * Constants
+ * ---------
+ */
+
+// maxReadRows represents the number of row buffers of a lane, hence how many rows
+// a reader thread may decode ahead of the caller. Must not exceed maxRowJobs.
+#define maxReadRows   8
+
+/*
+ * Type: ReaderLane
+ * --------------
+ * One reader thread per input map. Decoded rows travel from the thread to the
+ * caller through "rows", in row order; released buffers go back through
+ * "pool". When the maxReadRows buffers are all decoded, the thread waits
+ * until the caller releases one (back-pressure).
+ */
+typedef struct ReaderLane
+{
+        RowRing rows, pool;
+        sem_t rows_ready, bufs_ready;
+        atomic_int stop;
+        pthread_t thread;
+        int fd, nrows;
+        DCELL *bufs[maxReadRows];
+        DCELL *current;                         /* row handed to the caller */
+
+        /* Statistiques */
+        double read_time, stall_time;
+        long nread, stalls;
+}ReaderLane;
+
+typedef struct RowReader
+{
+        int nlanes, ncols;
+        int threads;                            /* 0: rows are read by the caller */
+        int row;                                /* next row handed to the caller */
+        int maskfd;                             /* MASK applied by the caller, -1 without */
+        CELL *mask;
+        ReaderLane *lanes;
+        double mask_time;
+}RowReader;
+
+/*
+ * Function: CreateRowReader
+ * Usage: reader = CreateRowReader(fds, nlanes, nrows, ncols, threads);
+ * -------------------------
+ * Starts one reader thread per map, which decodes rows 0 to nrows-1 of fds[i]
+ * as DCELL with Rast_get_d_row_nomask(). Without threads, the rows are
+ * read when the caller asks for them.
+ */
+RowReader *CreateRowReader(const int *fds, int nlanes, int nrows, int ncols, int threads);
+
+/*
+ * Functions: ReaderGetRows, ReaderReleaseRows
+ * Usage: ReaderGetRows(reader, rows);
+ *        ReaderReleaseRows(reader);
+ * --------------------------------------------
+ * ReaderGetRows sets rows[i] to the next row of map i, waiting for the
+ * reader threads if needed, and applies the MASK as Rast_get_d_row() does.
+ * The caller may modify the rows until ReaderReleaseRows gives the buffers
+ * back to the threads.
+ */
+void ReaderGetRows(RowReader *R, DCELL **rows);
+void ReaderReleaseRows(RowReader *R);
+
+/*
+ * Function: ReaderReport
+ * Usage: ReaderReport(reader, elapsed);
+ * -------------------------
+ * Prints the decoding time of the maps, their throughput over elapsed
+ * seconds and the time the caller waited for the readers.
+ */
+void ReaderReport(RowReader *R, double elapsed);
+
+/*
+ * Function: DestroyRowReader
+ * Usage: DestroyRowReader(reader);
+ * -------------------------
+ * Stops the threads, closes the maps and frees all buffers.
+ */
+void DestroyRowReader(RowReader *R);
+
+#endif  /* not defined _READER_H */
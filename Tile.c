@@ -0,0 +1,160 @@
+/***************************************************************************************************************************************************************************************************************************
+ *
+ * MODULE:       r.waterbalance
+ *
+ * AUTHOR(S):    Ian Ondo
+ *              
+ * PURPOSE:      Stockage sur disque, par tuiles, des données de ruissellement de taille variable de chaque cellule
+ *				 (listes de contributeurs). Les tuiles sont relues à la demande dans un cache LRU
+ *               dont la taille est bornée par la mémoire allouée au module.
+ *
+ ************************************************************************************************************************************************************************************************************************/
+
+/***********************************************************************************************
+ *
+ *				Tile.c
+ *				Ce fichier définit les fonctions du stockage par tuiles
+ *				utilisées par la fonction principale du programme du module r.waterbalance
+ *
+ ***********************************************************************************************/
+
+/* The contributor lists of a cell hold its whole upslope basin, so their total
+   size grows with the number of cells times the basin size, and is what makes
+   large grids run out of memory. Lists are packed per tile once the basins of
+   a band of tiles are known, and written to a temporary file. The routing sweeps
+   the grid row by row: it uses the tiles of one band at a time, so a cache
+   holding one band reads each tile once per time step. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <grass/gis.h>
+#include <grass/glocale.h>
+#include "Tile.h"
+
+TileStore *CreateTileStore(int nrows, int ncols, size_t budget)
+{
+        TileStore *T = (TileStore *)G_malloc(sizeof(TileStore));
+        int i;
+
+        T->nrows        = nrows;
+        T->ncols        = ncols;
+        T->ntrows       = (nrows + TILE_SIZE - 1) / TILE_SIZE;
+        T->ntcols       = (ncols + TILE_SIZE - 1) / TILE_SIZE;
+        T->ntiles       = T->ntrows * T->ntcols;
+        T->path         = G_tempfile();
+        T->fp           = fopen(T->path, "w+b");
+        if(T->fp == NULL)
+                G_fatal_error(_("Impossible de creer le fichier de tuiles <%s>"), T->path);
+        T->offset       = (long long *)G_malloc(T->ntiles * sizeof(long long));
+        T->bytes        = (size_t *)G_calloc(T->ntiles, sizeof(size_t));
+        T->resident     = (TileSlot **)G_calloc(T->ntiles, sizeof(TileSlot *));
+        for(i = 0; i < T->ntiles; i++)
+                T->offset[i] = -1;
+        T->file_bytes   = 0;
+        T->mru          = NULL;
+        T->lru          = NULL;
+        T->budget       = budget;
+        T->cached       = 0;
+        T->last         = -1;
+        T->last_data    = NULL;
+        T->hits         = 0;
+        T->misses       = 0;
+        T->read_bytes   = 0;
+
+        return T;
+};
+
+void DestroyTileStore(TileStore *T)
+{
+        TileSlot *s, *next;
+
+        for(s = T->mru; s; s = next){
+                next = s->next;
+                G_free(s->data);
+                G_free(s);
+        }
+        fclose(T->fp);
+        unlink(T->path);
+        G_free(T->path);
+        G_free(T->offset);
+        G_free(T->bytes);
+        G_free(T->resident);
+        G_free(T);
+};
+
+void TileStorePut(TileStore *T, int tile, const void *data, size_t bytes)
+{
+        if(T->offset[tile] >= 0)
+                G_fatal_error(_("La tuile %d a deja ete ecrite"), tile);
+
+        G_fseek(T->fp, (off_t)T->file_bytes, SEEK_SET);
+        if(bytes && fwrite(data, 1, bytes, T->fp) != bytes)
+                G_fatal_error(_("Ecriture de la tuile %d impossible"), tile);
+        T->offset[tile] = T->file_bytes;
+        T->bytes[tile]  = bytes;
+        T->file_bytes  += bytes;
+};
+
+/* Retire une tuile de la liste LRU */
+static void Unlink(TileStore *T, TileSlot *s)
+{
+        if(s->prev) s->prev->next = s->next; else T->mru = s->next;
+        if(s->next) s->next->prev = s->prev; else T->lru = s->prev;
+        s->prev = s->next = NULL;
+};
+
+/* Place une tuile en tête de la liste LRU */
+static void PushFront(TileStore *T, TileSlot *s)
+{
+        s->prev = NULL;
+        s->next = T->mru;
+        if(T->mru) T->mru->prev = s; else T->lru = s;
+        T->mru  = s;
+};
+
+void *TileStoreGet(TileStore *T, int tile)
+{
+        TileSlot *s;
+
+        if(tile == T->last)
+                return T->last_data;
+        if(T->offset[tile] < 0)
+                return NULL;
+
+        s = T->resident[tile];
+        if(s){
+                T->hits++;
+                Unlink(T, s);
+                PushFront(T, s);
+        }else{
+                T->misses++;
+
+                /* Libère les tuiles les moins récemment utilisées jusqu'à ce que la nouvelle tienne dans le budget */
+                while(T->lru && T->cached + T->bytes[tile] > T->budget){
+                        s = T->lru;
+                        Unlink(T, s);
+                        T->resident[s->tile] = NULL;
+                        T->cached -= s->bytes;
+                        G_free(s->data);
+                        G_free(s);
+                }
+
+                s        = (TileSlot *)G_malloc(sizeof(TileSlot));
+                s->tile  = tile;
+                s->bytes = T->bytes[tile];
+                s->data  = G_malloc(s->bytes ? s->bytes : 1);
+                G_fseek(T->fp, (off_t)T->offset[tile], SEEK_SET);
+                if(s->bytes && fread(s->data, 1, s->bytes, T->fp) != s->bytes)
+                        G_fatal_error(_("Lecture de la tuile %d impossible"), tile);
+                T->read_bytes     += s->bytes;
+                T->cached         += s->bytes;
+                T->resident[tile]  = s;
+                PushFront(T, s);
+        }
+        T->last         = tile;
+        T->last_data    = s->data;
+
+        return s->data;
+};
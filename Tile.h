@@ -0,0 +1,117 @@
+/***************************************************************************************************************************************************************************************************************************
+ *
+ * MODULE:       r.waterbalance
+ *
+ * AUTHOR(S):    Ian Ondo
+ *              
+ * PURPOSE:      Stockage sur disque, par tuiles, des données de ruissellement de taille variable de chaque cellule
+ *				 (listes de contributeurs). Les tuiles sont relues à la demande dans un cache LRU
+ *               dont la taille est bornée par la mémoire allouée au module.
+ *
+ ************************************************************************************************************************************************************************************************************************/
+
+/***********************************************************************************************
+ *
+ *				Tile.h
+ *				Ce fichier d'en-tête déclare les fonctions et structures des données
+ *				du stockage par tuiles du module r.waterbalance
+ *
+ ***********************************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#ifndef _TILE_H
+#define _TILE_H
+
+/*
+ * Constants
+ * ---------
+ */
+
+// TILE_SIZE represents the number of rows and columns of a tile.
+#define TILE_SIZE     64
+
+// TILE_CELLS represents the number of cells of a tile.
+#define TILE_CELLS    (TILE_SIZE * TILE_SIZE)
+
+/*
+ * Type: TileSlot
+ * --------------
+ * A tile held in the cache, linked in least recently used order.
+ */
+typedef struct TileSlot
+{
+        int tile;
+        void *data;
+        size_t bytes;
+        struct TileSlot *prev, *next;   /* prev is more recently used */
+}TileSlot;
+
+/*
+ * Type: TileStore
+ * --------------
+ * Tiles of TILE_SIZE x TILE_SIZE cells, each one an opaque payload written
+ * once with TileStorePut() and read back with TileStoreGet(). Payloads are
+ * appended to one temporary file. Resident tiles are kept until their total
+ * size exceeds budget bytes; the least recently used ones are then dropped.
+ */
+typedef struct TileStore
+{
+        int nrows, ncols;
+        int ntrows, ntcols, ntiles;     /* tiles per column, per row, total */
+        char *path;
+        FILE *fp;
+        long long *offset;              /* file offset of each tile, -1 if not written */
+        size_t *bytes;                  /* payload size of each tile */
+        long long file_bytes;
+        TileSlot **resident;            /* slot of each tile, NULL if not cached */
+        TileSlot *mru, *lru;
+        size_t budget, cached;
+        int last;                       /* tile of the last lookup */
+        void *last_data;
+        long hits, misses;
+        long long read_bytes;
+}TileStore;
+
+/*
+ * Functions: CreateTileStore, DestroyTileStore
+ * Usage: T = CreateTileStore(nrows, ncols, budget_bytes);
+ *        DestroyTileStore(T);
+ * -------------------------
+ * DestroyTileStore() also removes the temporary file.
+ */
+TileStore *CreateTileStore(int nrows, int ncols, size_t budget);
+void DestroyTileStore(TileStore *T);
+
+/*
+ * Function: TileOf
+ * Usage: tile = TileOf(T, row, col);
+ * -------------------------
+ * Returns the tile holding cell (row, col). Tiles are numbered row by row.
+ */
+static inline int TileOf(const TileStore *T, int row, int col)
+{
+        return (row / TILE_SIZE) * T->ntcols + col / TILE_SIZE;
+}
+
+/*
+ * Function: TileStorePut
+ * Usage: TileStorePut(T, tile, data, bytes);
+ * -------------------------
+ * Writes the payload of a tile. Each tile is written at most once.
+ */
+void TileStorePut(TileStore *T, int tile, const void *data, size_t bytes);
+
+/*
+ * Function: TileStoreGet
+ * Usage: data = TileStoreGet(T, tile);
+ * -------------------------
+ * Returns the payload of a tile, reading it from the file when it is not
+ * cached, or NULL if the tile was never written. The pointer stays valid
+ * until the next call with another tile.
+ */
+void *TileStoreGet(TileStore *T, int tile);
+
+#endif  /* not defined _TILE_H */
@@ -0,0 +1,200 @@
+/***************************************************************************************************************************************************************************************************************************
+ *
+ * MODULE:       r.waterbalance
+ *
+ * AUTHOR(S):    Ian Ondo
+ *              
+ * PURPOSE:      Ecriture asynchrone des lignes des cartes raster de sortie.
+ *				 Chaque carte de sortie d'un pas de temps est confiée à un fil d'exécution dédié qui compresse et écrit
+ *               ses lignes pendant que les lignes suivantes sont calculées.
+ *
+ ************************************************************************************************************************************************************************************************************************/
+
+/***********************************************************************************************
+ *
+ *				Writer.c
+ *				Ce fichier définit les fonctions de l'écrivain asynchrone de lignes raster
+ *				utilisées par la fonction principale du programme du module r.waterbalance
+ *
+ ***********************************************************************************************/
+
+/* Process() fills a row buffer taken from the pool of a lane, queues it with
+   WriterPutRow() and immediately starts on the next row. The lane thread pops
+   the jobs in order, calls Rast_put_d_row() (which compresses and writes the
+   row) and gives the buffer back to the pool. Both rings are single-producer/
+   single-consumer, so they only need atomic indices; the semaphores are only
+   used to sleep when a ring is empty.
+
+   The raster library is not thread-safe as a whole: each lane only touches its
+   own file descriptor, the main thread may keep reading input maps with
+   Rast_get_d_row(), but maps are only opened or closed once WriterFlush()
+   has returned. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <grass/gis.h>
+#include <grass/raster.h>
+#include <grass/glocale.h>
+#include "Writer.h"
+#include "utils.h"
+
+static void *LaneThread(void *arg)
+{
+        WriterLane *L = (WriterLane *)arg;
+        RowJob job;
+        double t0;
+
+        for(;;)
+        {
+                sem_wait(&L->jobs_ready);
+                if(!RingPop(&L->jobs, &job))
+                        continue;
+                if(job.buf == NULL)
+                        break;
+
+                t0 = TimeNow();
+                Rast_put_d_row(job.fd, job.buf);
+                L->write_time += TimeNow() - t0;
+                L->rows++;
+
+                /* Rend le tampon au calcul */
+                RingPush(&L->pool, job);
+                sem_post(&L->bufs_ready);
+                atomic_fetch_sub_explicit(&L->pending, 1, memory_order_release);
+        }
+
+        return NULL;
+};
+
+RowWriter *CreateRowWriter(int nlanes, int ncols)
+{
+        RowWriter *W = (RowWriter *)G_malloc(sizeof(RowWriter));
+        WriterLane *L;
+        RowJob job;
+        int i, j;
+
+        W->nlanes     = nlanes;
+        W->lanes      = (WriterLane *)G_calloc(nlanes, sizeof(WriterLane));
+        W->close_time = 0.0;
+        W->nclosed    = 0;
+
+        for(i = 0; i < nlanes; i++)
+        {
+                L = &W->lanes[i];
+                L->ncols = ncols;
+                atomic_init(&L->jobs.head, 0);
+                atomic_init(&L->jobs.tail, 0);
+                atomic_init(&L->pool.head, 0);
+                atomic_init(&L->pool.tail, 0);
+                atomic_init(&L->pending, 0);
+
+                /* Réserve de tampons recyclés de la voie */
+                for(j = 0; j < maxRowJobs; j++){
+                        job.fd  = -1;
+                        job.buf = (DCELL *)G_malloc(ncols * sizeof(DCELL));
+                        RingPush(&L->pool, job);
+                }
+                sem_init(&L->jobs_ready, 0, 0);
+                sem_init(&L->bufs_ready, 0, maxRowJobs);
+
+                if(pthread_create(&L->thread, NULL, LaneThread, L) != 0)
+                        G_fatal_error(_("Impossible de creer le fil d ecriture des cartes de sortie"));
+        }
+
+        return W;
+};
+
+DCELL *WriterGetBuffer(RowWriter *W, int lane)
+{
+        WriterLane *L = &W->lanes[lane];
+        RowJob job;
+        double t0;
+
+        /* Tous les tampons sont en attente d'écriture : le calcul attend l'écrivain */
+        if(sem_trywait(&L->bufs_ready) != 0){
+                t0 = TimeNow();
+                sem_wait(&L->bufs_ready);
+                L->stall_time += TimeNow() - t0;
+                L->stalls++;
+        }
+        RingPop(&L->pool, &job);
+
+        return job.buf;
+};
+
+void WriterPutRow(RowWriter *W, int lane, int fd, DCELL *buf)
+{
+        WriterLane *L = &W->lanes[lane];
+        RowJob job;
+
+        job.fd  = fd;
+        job.buf = buf;
+
+        /* Le nombre de tampons de la voie borne le nombre de travaux : la file ne peut pas être pleine */
+        atomic_fetch_add_explicit(&L->pending, 1, memory_order_relaxed);
+        RingPush(&L->jobs, job);
+        sem_post(&L->jobs_ready);
+};
+
+void WriterFlush(RowWriter *W)
+{
+        struct timespec pause = {0, 50000};
+        int i;
+
+        for(i = 0; i < W->nlanes; i++)
+                while(atomic_load_explicit(&W->lanes[i].pending, memory_order_acquire) > 0)
+                        nanosleep(&pause, NULL);
+};
+
+void WriterClose(RowWriter *W, int fd)
+{
+        double t0 = TimeNow();
+
+        Rast_close(fd);
+        W->close_time += TimeNow() - t0;
+        W->nclosed++;
+};
+
+void WriterReport(RowWriter *W)
+{
+        double write_time = 0.0, stall_time = 0.0;
+        long rows = 0, stalls = 0;
+        int i;
+
+        for(i = 0; i < W->nlanes; i++){
+                write_time += W->lanes[i].write_time;
+                stall_time += W->lanes[i].stall_time;
+                rows       += W->lanes[i].rows;
+                stalls     += W->lanes[i].stalls;
+        }
+        G_message(_("Ecriture des cartes de sortie: %ld lignes en %.2fs (%d fils), fermeture de %d cartes en %.2fs"),
+                  rows, write_time, W->nlanes, W->nclosed, W->close_time);
+        G_message(_("Attente du calcul sur l ecriture: %.2fs (%ld lignes)"), stall_time, stalls);
+};
+
+void DestroyRowWriter(RowWriter *W)
+{
+        WriterLane *L;
+        RowJob job;
+        int i;
+
+        WriterFlush(W);
+
+        for(i = 0; i < W->nlanes; i++)
+        {
+                L = &W->lanes[i];
+                job.fd  = -1;
+                job.buf = NULL;
+                RingPush(&L->jobs, job);
+                sem_post(&L->jobs_ready);
+                pthread_join(L->thread, NULL);
+
+                while(RingPop(&L->pool, &job))
+                        G_free(job.buf);
+                sem_destroy(&L->jobs_ready);
+                sem_destroy(&L->bufs_ready);
+        }
+        G_free(W->lanes);
+        G_free(W);
+};
@@ -0,0 +1,176 @@
+/***************************************************************************************************************************************************************************************************************************
+ *
+ * MODULE:       r.waterbalance
+ *
+ * AUTHOR(S):    Ian Ondo
+ *              
+ * PURPOSE:      Ecriture asynchrone des lignes des cartes raster de sortie.
+ *				 Chaque carte de sortie d'un pas de temps est confiée à un fil d'exécution dédié qui compresse et écrit
+ *               ses lignes pendant que les lignes suivantes sont calculées.
+ *
+ ************************************************************************************************************************************************************************************************************************/
+
+/***********************************************************************************************
+ *
+ *				Writer.h
+ *				Ce fichier d'en-tête déclare les fonctions et structures des données
+ *				de l'écrivain asynchrone de lignes raster du module r.waterbalance
+ *
+ ***********************************************************************************************/
+
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <grass/gis.h>
+
+#ifndef _WRITER_H
+#define _WRITER_H
+
+/*
+ * Constants
+ * ---------
+ */
+
+// maxRowJobs represents the number of row buffers of a lane, hence the maximum number
+// of rows waiting to be written for one output map. Must be a power of two.
+#define maxRowJobs   64
+
+/*
+ * Type: RowJob
+ * --------------
+ * A finished row: the raster file descriptor and the buffer holding the row.
+ * A job with a NULL buffer stops the lane.
+ */
+typedef struct RowJob
+{
+        int fd;
+        DCELL *buf;
+}RowJob;
+
+/*
+ * Type: RowRing
+ * --------------
+ * Bounded single-producer/single-consumer ring. head and tail only grow;
+ * the slot of an index is index & (maxRowJobs-1). The producer owns tail,
+ * the consumer owns head, so no lock is needed.
+ */
+typedef struct RowRing
+{
+        atomic_uint head;
+        atomic_uint tail;
+        RowJob slots[maxRowJobs];
+}RowRing;
+
+/*
+ * Functions: RingPush, RingPop
+ * Usage: if(RingPush(&ring, job)) ...
+ *        if(RingPop(&ring, &job)) ...
+ * --------------------------------------------
+ * RingPush returns 0 when the ring is full, RingPop when it is empty.
+ * Only the producer may push and only the consumer may pop.
+ */
+static inline int RingPush(RowRing *R, RowJob job)
+{
+        unsigned tail = atomic_load_explicit(&R->tail, memory_order_relaxed);
+        unsigned head = atomic_load_explicit(&R->head, memory_order_acquire);
+
+        if(tail - head == maxRowJobs)
+                return 0;
+        R->slots[tail & (maxRowJobs - 1)] = job;
+        atomic_store_explicit(&R->tail, tail + 1, memory_order_release);
+        return 1;
+}
+
+static inline int RingPop(RowRing *R, RowJob *job)
+{
+        unsigned head = atomic_load_explicit(&R->head, memory_order_relaxed);
+        unsigned tail = atomic_load_explicit(&R->tail, memory_order_acquire);
+
+        if(head == tail)
+                return 0;
+        *job = R->slots[head & (maxRowJobs - 1)];
+        atomic_store_explicit(&R->head, head + 1, memory_order_release);
+        return 1;
+}
+
+/*
+ * Type: WriterLane
+ * --------------
+ * One writer thread per output map. Rows travel from the computation to the
+ * thread through "jobs"; written buffers come back through "pool". The lane
+ * owns maxRowJobs buffers: when they are all waiting to be written, the
+ * computation blocks in WriterGetBuffer() (back-pressure).
+ */
+typedef struct WriterLane
+{
+        RowRing jobs, pool;
+        sem_t jobs_ready, bufs_ready;
+        atomic_int pending;
+        pthread_t thread;
+        int ncols;
+
+        /* Statistiques */
+        double write_time, stall_time;
+        long rows, stalls;
+}WriterLane;
+
+typedef struct RowWriter
+{
+        int nlanes;
+        WriterLane *lanes;
+        double close_time;
+        int nclosed;
+}RowWriter;
+
+/*
+ * Function: CreateRowWriter
+ * Usage: writer = CreateRowWriter(nlanes, ncols);
+ * -------------------------
+ * Starts one writer thread per lane. Buffers hold ncols cells.
+ */
+RowWriter *CreateRowWriter(int nlanes, int ncols);
+
+/*
+ * Function: DestroyRowWriter
+ * Usage: DestroyRowWriter(writer);
+ * -------------------------
+ * Writes the pending rows, stops the threads and frees all buffers.
+ */
+void DestroyRowWriter(RowWriter *W);
+
+/*
+ * Functions: WriterGetBuffer, WriterPutRow
+ * Usage: buf = WriterGetBuffer(writer, lane);
+ *        WriterPutRow(writer, lane, fd, buf);
+ * --------------------------------------------
+ * WriterGetBuffer returns a recycled row buffer of the lane, waiting for the
+ * writer thread when all of them are in flight. WriterPutRow queues the
+ * buffer to be written to fd with Rast_put_d_row(); the caller must not touch
+ * the buffer afterwards. Rows of a lane are written in the order they are queued.
+ */
+DCELL *WriterGetBuffer(RowWriter *W, int lane);
+void WriterPutRow(RowWriter *W, int lane, int fd, DCELL *buf);
+
+/*
+ * Functions: WriterFlush, WriterClose
+ * Usage: WriterFlush(writer);
+ *        WriterClose(writer, fd);
+ * -------------------------
+ * WriterFlush waits until every queued row has been written. It must be
+ * called before Rast_close() or Rast_open_new(), which are not safe while a
+ * writer thread is inside the raster library. WriterClose closes a map
+ * (Rast_close() finishes the compression) and accounts for its duration.
+ */
+void WriterFlush(RowWriter *W);
+void WriterClose(RowWriter *W, int fd);
+
+/*
+ * Function: WriterReport
+ * Usage: WriterReport(writer);
+ * -------------------------
+ * Prints the time spent writing and closing maps, and the time the
+ * computation waited for the writers.
+ */
+void WriterReport(RowWriter *W);
+
+#endif  /* not defined _WRITER_H */
@@ -24,8 +24,18 @@
 #include <stdio.h>
 #include <stdlib.h> 
 #include <math.h>
+#include <stdint.h>
+#include <stddef.h>
 #include <grass/gis.h>
 #include "Queue.h"
+#include "utils.h"
+#include "Events.h"
+#include "Kernel.h"
+#include "Tile.h"
+#include "Heap.h"
+#include "Flood.h"
+#include "Layout.h"
+#include "Paging.h"
 
 #ifndef _HEAD_H
 #define _HEAD_H
@@ -37,27 +47,32 @@
 // Prototype de structure
 typedef struct SoilLayer layer;		   				/* définit le type layer qui a la structure SoilLayer */
 typedef struct Node  node;  							/* définit le type node qui a la structure Node */
+typedef struct Contrib contrib;							/* définit le type contrib qui a la structure Contrib */
+typedef struct OutKernel outkernel;						/* définit le type outkernel qui a la structure OutKernel */
 
 // Définit la structure d'une couche de sol
 struct SoilLayer
 {
-	// Quantité d'eau contenue dans la couche
-	double *swc;
+	// (Quantité d'eau contenue dans la couche : voir SWC)
 	
 	// Quantité d'eau disponible pour les plantes ou le ruissellement dans la couche et dans le bassin versant
-	double paw, *raw, *braw, sraw;
+	// (sraw : eau en excès à la surface du pas de temps courant, seule routée vers l'aval)
+	real paw, *braw, sraw;
+	
+	// Evénements d'eau disponible au ruissellement de subsurface (pas de temps, quantité) de la couche
+	EventList raw;
 
-	// Quantité d'eau précipitée ou evapotranspirée
-	double p, pet, aet;
+	// Quantité d'eau précipitée, evapotranspirée ou en excès à la surface (cumulée sur la période avec les options 2 et 3 : toujours en double précision)
+	double p, pet, aet, pe;
 
-	// Quantité d'eau drainée vers/depuis la couche par ruissellement de surface/subsurface
+	// Quantité d'eau drainée vers/depuis la couche par ruissellement de surface/subsurface (cumulée, toujours en double précision)
 	double qinsf, qinssf, qoutsf, qoutssf;
 	
-	// Paramètres pour le calcul du ruissellement de surface
-	double smax, w1, w2;
+	// Paramètres pour le calcul du ruissellement de surface (ew1 = exp(w1), calculé une fois à l'initialisation)
+	real smax, ew1, w2;
 	
 	// Portion de l'aire de drainage amont de la cellule
-	double portion[8];
+	real portion[8];
 
 	// Pointeur vers les cellules contribuant au ruissellement dans la cellule en amont
 	layer *neighbors[8];
@@ -65,11 +80,16 @@ struct SoilLayer
 	// Nombre de cellules contribuant au ruissellement dans la cellule
 	int nbContribCells[2];
 	
-	// Cellules contribuant au ruissellement dans la cellule 
-	node *contribCells;
+	// Cellules contribuant au ruissellement dans la cellule, pour chaque ruissellement (la cellule elle-même en premier)
+	contrib *contribCells[2];
 	
 	// Pointeurs vers les ordonnées à l'origine de l'hydrographe du bassin versant drainé en amont par la cellule 
-	double *UHTsf, *UHTssf;
+	real *UHTsf, *UHTssf;
+	
+	// Fonctions de réponse sortantes vers les cellules aval et anneaux des apports futurs de subsurface (routing=push)
+	outkernel *outk;
+	int nout, ring_len;
+	real *ring_in, *ring_out;
 	
  	// Status
 	short waterbodies, riparian;
@@ -77,12 +97,77 @@ struct SoilLayer
 
 struct Parm
 {
-	double altitude;
-	double tanslope, depth;
-	double sat, fc, pwp, rum;
-	double ksat, flow_speeds[2], flow_disps[2];
+	real altitude;
+	real tanslope, depth;
+	real sat, fc, pwp, rum;
+	real ksat, flow_speeds[2], flow_disps[2];
+	uint16_t soil;												/* Classe de sol (soil=) */
 }parms;
 
+/* Paramètres d'une classe de sol (soil_table=), dans les unités des cartes : teneurs en eau volumiques */
+struct SoilClass
+{
+	int defined;												/* La classe figure dans la table */
+	double sat, fc, pwp, rum, depth, ksat;
+};
+
+/* Enregistrement compact des paramètres dans le fichier segmenté : seuls les champs de struct Parm lus par
+   la méthode de calcul sont stockés, les uns à la suite des autres (voir PlanParmRecord). Avec soil=,
+   l'enregistrement commence par la classe de sol sur 16 bits et les paramètres du sol sans carte sont
+   lus dans la table des classes (convertis en hauteur d'eau avec la profondeur de la cellule). */
+struct ParmRecord
+{
+	int nfields;												/* Nombre de champs stockés */
+	size_t offset[12];											/* Position de chaque champ stocké dans struct Parm */
+	size_t pos[12];												/* Position de chaque champ stocké dans l'enregistrement */
+	const char *name[12];										/* Nom de chaque champ stocké (rapport de -i) */
+	int soil;													/* L'enregistrement commence par la classe de sol */
+	int ntable;													/* Nombre de champs lus dans la table des classes */
+	size_t table_offset[4];										/* Position de ces champs dans struct Parm */
+	size_t table_class[4];										/* et dans struct SoilClass */
+	int table_convert[4];										/* Le champ est multiplié par la profondeur du sol */
+	int cell_depth;												/* La profondeur est stockée par cellule (carte soil depth=) */
+	size_t size;												/* Taille d'un enregistrement (octets) */
+	unsigned char *cell;										/* Tampon d'un enregistrement */
+	unsigned char *row;											/* Tampon d'une ligne d'enregistrements */
+	int dirty;													/* Le cache des segments contient des écritures (ParmPut) */
+}parm_rec;
+
+/* Plan de mémoire : taille de chaque allocation importante (rapport de -i), et modes de calcul choisis pour
+   tenir dans memory= (voir PlanMemory) */
+#define MEM_ITEMS 16
+#define MEM_EXACT 0												/* Taille connue avant le calcul */
+#define MEM_ESTIMATE 1											/* Estimation : dépend du relief */
+#define MEM_BOUND 2												/* Borne supérieure, hors du total */
+struct MemoryPlan
+{
+	int n;
+	const char *name[MEM_ITEMS];
+	double mb[MEM_ITEMS];
+	int kind[MEM_ITEMS];
+	double init_mb, process_mb;									/* Pics estimés à l'initialisation et pendant le calcul */
+	double contrib_budget_mb;									/* Mémoire laissée aux listes de contributeurs en mémoire */
+	double segment_budget_mb;									/* Mémoire laissée au cache du fichier segmenté */
+	int auto_tiles;												/* Calcul hors mémoire choisi par le plan (sans -o) */
+}mem_plan;
+
+/* Recherche des bassins de drainage par l'algorithme de Dijkstra (search=dijkstra) : les noeuds du front sont
+   recyclés une fois traités, chaque cellule est marquée pour la recherche en cours */
+struct BasinSearch
+{
+	Heap *heap;													/* Front ordonné par temps de trajet */
+	node *nodes;												/* Noeuds du front, indexés comme les éléments du tas */
+	int nnodes, capacity;
+	int *free_nodes, nfree;										/* Noeuds recyclés */
+	uint32_t *mark;												/* 2*gen : cellule du front, 2*gen+1 : cellule traitée */
+	int *slot;													/* Noeud d'une cellule du front */
+	uint32_t gen;												/* Numéro de la recherche en cours */
+	long visits, updates;										/* Cellules traitées, temps de trajet diminués (les deux méthodes) */
+}basin_search;
+
+struct SoilClass *soil_classes = NULL;							/* Table des classes de sol, indexée par la classe */
+int nsoil_classes = 0;											/* Taille de la table (plus grande classe + 1) */
+
 struct Node
 {
 	int row, col;
@@ -94,6 +179,74 @@ struct Node
 	node *neighbors[8];
 };
 
+/* Contributeur d'une cellule pour un ruissellement. Les noeuds du parcours du bassin de drainage sont libérés
+   dès qu'ils ont été traités : seul cet enregistrement compact est conservé. */
+struct Contrib
+{
+	uint32_t cell;												/* Position de la cellule contributrice dans landscape */
+	int32_t cls;												/* Classe de la fonction de réponse dans le réservoir kernels */
+	float portion;												/* Portion de l'aire de drainage de la cellule */
+};
+
+/* Fonction de réponse d'une cellule vers une cellule aval dont elle est un contributeur (routing=push) */
+struct OutKernel
+{
+	layer *target;												/* Cellule aval qui reçoit l'eau */
+	int32_t cls;												/* Classe de la fonction de réponse du contributeur dans le bassin de la cellule aval */
+	int outlet;													/* La cellule aval est la cellule elle-même (ruissellement sortant) */
+};
+
+/* En-tête du fichier d'état de fin de calcul (reprise à chaud). Version 2 : les événements encore actifs de chaque
+   cellule sont sauvegardés par paires (pas de temps, quantité) au lieu de l'historique complet de la version 1 */
+#define STATE_VERSION		2
+#define STATE_MAX_REACH		(1 << 24)
+
+struct StateHeader
+{
+	char magic[8];												/* Signature du fichier : "RWBSTATE" */
+	int version;
+	int nrows, ncols;
+	int method;
+	int hist_len;												/* Nombre de derniers pas de temps dont les événements sont sauvegardés */
+	long steps;													/* Nombre total de pas de temps déjà calculés */
+};
+
+/* Flux calculés pour une cellule au cours d'un pas de temps */
+struct cell_flux
+{
+	double aet, pe;
+	double qinsf, qoutsf, qinssf, qoutssf;
+};
+
+/* Noyau de calcul du bilan hydrique d'une cellule spécialisé pour une combinaison d'options */
+typedef void (*cell_kernel)(layer *c, const struct Parm *pp, int n, double rain, double etp, struct cell_flux *f);
+
+/* Tampons contigus d'une ligne pour le noyau vectorisé du bilan climatique (une entrée par colonne valide).
+   Les états des zones alluviales sont des masques 0/1 en double : la boucle reste homogène et se vectorise. */
+struct climate_row
+{
+	double *rain, *etp;											/* Précipitation et ETP du pas de temps */
+	double *sat, *fc, *rum;										/* Paramètres du sol */
+	double *paw, *swc, *aet;									/* Etat en entrée, mis à jour par le noyau */
+	double *wb, *rip;											/* Masques plans d'eau et zones ripariennes (flag -z) */
+	layer **cell;												/* Cellules correspondantes pour la dispersion des résultats */
+};
+
+/* Tampons contigus d'une ligne pour le calcul vectorisé de l'eau en excès (SCS-CN, méthodes 1 et 3) */
+struct excess_row
+{
+	double *rain;												/* Précipitation du pas de temps */
+	double *swc, *pwp;											/* Teneur en eau du pas précédent et point de flétrissement */
+	double *smax, *ew1, *w2;									/* Constantes de la cellule (ew1 = exp(w1)) */
+	double *pe;													/* Eau en excès calculée */
+};
+
+/* Types de cartes de sortie (même ordre que menu_outputs) */
+enum output_type
+{
+	OUT_DE, OUT_PAW, OUT_SWC, OUT_QINSSF, OUT_QOUTSSF, OUT_QINSF, OUT_QOUTSF, OUT_PE
+};
+
 struct input
 {
     const char *name;
@@ -111,13 +264,14 @@ struct output
 struct Cell_head window;									/* Stocke les informations sur la région et les informations d'en-tête des couches rasters */
 extern struct Cell_head window;
 struct GModule *module;										/* Module GRASS pour les arguments d'analyse */
-struct Flag *flag, *flag2, *flag3, *flag4, *flag5, *flag6;	/* Drapeau GRASS pour spécifier des options supplémentaires */
+struct Flag *flag, *flag2, *flag3, *flag4, *flag5, *flag6, *flag7, *flag8;	/* Drapeau GRASS pour spécifier des options supplémentaires */
 struct History history;     								/* Contient les méta-données (titres, commentaires,...) */
 struct
 {	
 	struct Option *prec, *etp;
 	struct Option *altitude, *slope, *depth;								
 	struct Option *sat, *fc, *pwp, *rum, *ksat;
+	struct Option *soil, *soil_table;
 	struct Option *flow_speeds, *flow_disps;
 	struct Option *smax, *w;
 	struct Option *waterbodies, *riparian;	
@@ -127,8 +281,14 @@ struct
 	struct Option *start;
 	struct Option *method, *algorithm;
 	struct Option *init_abs;
+	struct Option *kernel, *epsilon, *quantum;
+	struct Option *routing;
+	struct Option *search;
+	struct Option *depressions;
+	struct Option *layout;
 	struct Option *outiter;
 	struct Option *mem;
+	struct Option *state_in, *state_out;
 } parm;	
 
 struct menu
@@ -183,6 +343,80 @@ struct menu_ia
     {NULL,      		NULL}
 };
 
+struct menu_kernel
+{	
+    char 	*name;                  /* nom de la méthode */
+    char 	*text;                  /* Affichage du menu - description complète */
+} menu_kernel[] = {
+    {"point",    	"densite de la fonction de reponse a la fin du pas de temps"},
+    {"romberg",   	"integrale sur le pas de temps -{Romberg}-"},
+    {"kronrod",   	"integrale sur le pas de temps -{Gauss-Kronrod 15 points adaptatif}-"},
+    {"tanhsinh",   	"integrale sur le pas de temps -{tanh-sinh}-"},
+    {"cdf",   		"masse exacte sur le pas de temps -{difference de la fonction de repartition inverse gaussienne}-"},
+    {NULL,      	NULL}
+};
+
+struct menu_routing
+{	
+    char 	*name;                  /* nom de la méthode */
+    char 	*text;                  /* Affichage du menu - description complète */
+} menu_routing[] = {
+    {"pull",    	"chaque cellule convolue les evenements de ses contributeurs amont"},
+    {"push",   		"chaque evenement est diffuse une seule fois vers les cellules aval"},
+    {NULL,      	NULL}
+};
+
+struct menu_search
+{	
+    char 	*name;                  /* nom de la méthode */
+    char 	*text;                  /* Affichage du menu - description complète */
+} menu_search[] = {
+    {"bfs",    		"parcours en largeur, le temps de trajet d une cellule deja rencontree est corrige sans etre propage"},
+    {"dijkstra",	"algorithme de Dijkstra, chaque cellule est traitee une fois avec son plus court temps de trajet"},
+    {NULL,      	NULL}
+};
+#define SEARCH_BFS		0
+#define SEARCH_DIJKSTRA	1
+
+struct menu_depressions
+{	
+    char 	*name;                  /* nom de la méthode */
+    char 	*text;                  /* Affichage du menu - description complète */
+} menu_depressions[] = {
+    {"none",    	"altitudes utilisees telles quelles, l eau des cuvettes et des zones plates ne s ecoule pas"},
+    {"fill",		"cuvettes remplies par inondation prioritaire et zones plates drainees -{Barnes et al. (2014)}-"},
+    {NULL,      	NULL}
+};
+#define DEPRESSIONS_NONE	0
+#define DEPRESSIONS_FILL	1
+
+struct menu_layout
+{	
+    char 	*name;                  /* nom du rangement */
+    char 	*text;                  /* Affichage du menu - description complète */
+} menu_layout[] = {
+    {"rowmajor",	"cellules rangees ligne par ligne"},
+    {"morton",		"blocs de 16x16 cellules rangees selon la courbe de Morton (ordre Z)"},
+    {"hilbert",		"blocs de 16x16 cellules rangees selon la courbe de Hilbert"},
+    {NULL,      	NULL}
+};
+
+/* Précision relative de l'intégration des fonctions de réponse sur un pas de temps */
+#define KERNEL_EPS		1.0e-6
+#define KERNEL_DEPTH	10
+
+/* Classe de la fonction de réponse d'un contributeur q */
+#define KCLASS(q)		(&kernels->classes[(q)->cls])
+
+/* Position d'une cellule dans le bloc des cellules (voir layout=), cellule (row, col) et cellule d'un contributeur */
+#define CELL_INDEX(r,c)	CellPos(cell_layout, (r), (c))
+#define LAYER(r,c)		(&landscape[CELL_INDEX((r),(c))])
+#define CONTRIB_LAYER(q)	(&landscape[(q)->cell])
+
+/* Altitude de la cellule de la colonne col de la ligne centrale de la fenêtre glissante, et de sa voisine k */
+#define CENTRE_ALT(col)		(alt_win[1][(col)+1])
+#define NEIGHBOUR_ALT(k,col)	(alt_win[1+dy[k]][(col)+1+dx[k]])
+
 int i, n;
 short k;
 long iter;
@@ -198,21 +432,56 @@ int srows, scols;
 const int num_days[12] = {31,28,31,30,31,30,31,31,30,31,30,31};
 const short dy[8] = {0,-1,-1,-1,0,1,1,1};
 const short dx[8] = {1,1,0,-1,-1,-1,0,1};
-layer **landscape = NULL;
+layer *landscape = NULL;									/* Cellules du paysage, rangées selon cell_layout */
+CellLayout *cell_layout = NULL;								/* Position de chaque cellule dans landscape */
+EventArena *events = NULL;									/* Arène des listes d'événements d'eau en excès du paysage */
 struct input *P = NULL;
 struct input *ETP = NULL;
 struct output *Outputs = NULL;
 DCELL *Prec =NULL, *Etp = NULL;
 CELL **waterbodies = NULL, **riparian = NULL;
 DCELL **smax = NULL, **w1 = NULL, **w2 = NULL;
-void *ptr, *ptr2, *ptr3, *ptr4, *ptr5, *ptr6, *ptr7, *ptr7, *ptr8, *ptr9, *ptr10, *ptr11, *ptr12;
-double p_sat, p_fc, p_rum, p_depth, p_alt, p_pwp, p_slope, p_speed_sf, p_disp_sf, p_speed_ssf, p_disp_ssf, p_ksat;
 int method, method_ia;
+int kernel_mode;											/* Evaluation des fonctions de réponse sur un pas de temps (voir menu_kernel) */
+int routing_mode;											/* Calcul du ruissellement de subsurface (voir menu_routing) */
+int layout_mode;											/* Rangement des cellules en mémoire (voir menu_layout) */
+int search_mode;											/* Recherche des bassins de drainage (voir menu_search) */
+int depression_mode;										/* Conditionnement des altitudes (voir menu_depressions) */
+double basin_time = 0.0;									/* Temps de construction des bassins de drainage (s) */
+double flowdir_time = 0.0;									/* Temps de calcul des directions d'écoulement (s) */
+double kernel_time = 0.0;									/* Temps de la boucle des cellules du bilan hydrique (s) */
+long kernel_cells = 0;										/* Cellules calculées par cette boucle */
+double *alt_win[3] = {NULL, NULL, NULL};					/* Fenêtre glissante des altitudes : lignes row-1, row et row+1 */
+double *alt_dem = NULL;										/* Altitudes conditionnées de toute la grille (depressions=fill) */
+double condition_time = 0.0;								/* Temps du conditionnement des altitudes (s) */
+FloodStats flood_stats;										/* Cellules relevées et zones plates drainées par ce conditionnement */
+struct Parm *alt_parms = NULL;								/* Ligne de paramètres lue dans le fichier segmenté */
+double kernel_eps;											/* Masse des fonctions de réponse pouvant être ignorée hors de leur fenêtre */
+long kernel_visits = 0, kernel_skips = 0;					/* Evaluations des fonctions de réponse effectuées / évitées par les fenêtres */
+long kernel_windows = 0;									/* Nombre de fenêtres calculées */
+int event_reach = 0;										/* Plus grand décalage t_max des fenêtres de subsurface */
+double kernel_lost_sum = 0.0, kernel_lost_max = 0.0;		/* Masse ignorée par les fenêtres (somme et maximum) */
+double kernel_quantum;										/* Pas relatif de la grille de quantification des classes de fonctions de réponse */
+KernelPool *kernels = NULL;									/* Réservoir des classes de fonctions de réponse du paysage */
+TileStore *tiles = NULL;									/* Listes de contributeurs stockées par tuiles sur disque (-o) */
+double tile_mb = 0.0;										/* Mémoire du cache des tuiles de contributeurs (MB) */
 int algorithm;
 int outiter;
 int month, sum_days;
 double mfd_converge, drainage_times[2];
 int num_inputs;
+int swc_len;												/* Pas de temps de teneur en eau gardés par cellule (historique roulant) */
+int swc_cur, swc_prev;										/* Positions du pas courant et du pas précédent dans cet historique */
+#define SWC_SLOT(n) ((((n) % swc_len) + swc_len) % swc_len)
+real *swc_slab = NULL;										/* Historiques de teneur en eau de toutes les cellules, bout à bout */
+#define SWC(c) (swc_slab + (size_t)((c) - landscape) * swc_len)	/* Historique de teneur en eau de la cellule c */
+real *ring_slab = NULL;										/* Anneaux des apports futurs de toutes les cellules (routing=push) */
+outkernel *outk_slab = NULL;								/* Fonctions de réponse sortantes de toutes les cellules (routing=push) */
+long long contrib_records = 0;								/* Contributeurs gardés en mémoire par FindBasin */
+int t_offset = 0;											/* Nombre de pas de temps déjà calculés lors des exécutions précédentes (reprise à chaud) */
+FILE *state_fp = NULL;										/* Fichier d'état lu lors d'une reprise à chaud */
+int state_hist_len = 0;										/* Nombre de pas de temps d'historique contenus dans le fichier d'état */
+int state_version = 0;										/* Version du fichier d'état lu */
 int num_outputs, num_outputs_names;
 int options;
 int keep_nulls = 1;
@@ -221,13 +490,13 @@ double disk_mb, mem_mb, pq_mb;
 int nseg;
 int maxmem;
 int segments_in_memory;
+SegmentGeometry seg_geom;									/* Géométrie courante du fichier segmenté */
+SegmentGeometry seg_square, seg_strip;						/* Géométries en tuiles carrées et en bandes de lignes */
+PageShadow *pager = NULL;									/* Comptage des pages lues et écrites par phase (-t) */
 int total_cells;
 
 SEGMENT parms_seg;
 
-/* Type de données d'entrée (CELL/FCELL/DCELL [entier,décimale,double décimale]) */	
-RASTER_MAP_TYPE alt_data_type, speed_sf_data_type, disp_sf_data_type, speed_ssf_data_type, disp_ssf_data_type, sat_data_type, fc_data_type, rum_data_type, pwp_data_type, slope_data_type, depth_data_type, ksat_data_type; 
-
 
 
 /******************************
@@ -236,6 +505,16 @@ RASTER_MAP_TYPE alt_data_type, speed_sf_data_type, disp_sf_data_type, speed_ssf_
  
 void parseOptions(int argc, char *argv[]);
 void createSEGMENT();
+void RetileSEGMENT(int shape);
+void PlanMemory(void);
+void SwitchToTiles(int band);
+void LoadSoilTable(const char *name);
+void PlanParmRecord(int method);
+void SoilClassRow(const DCELL *v, uint16_t *soil, int n);
+void ParmGet(int row, int col, struct Parm *p);
+void ParmPut(int row, int col, const struct Parm *p);
+void ParmGetRow(int row, struct Parm *p);
+void FreeParmRecord(void);
 static char *build_method_list(void);
 static char *build_outputs_list(void);
 static char *build_algorithm_list(void);
@@ -245,8 +524,18 @@ int is_OnGrid(int rown, int coln);
 static int find_method(const char *method_name);
 static int find_output_name(const char *output_name);
 static int find_ia_method(const char *method_name);
+static int find_kernel_method(const char *kernel_name);
+static int find_routing_method(const char *routing_name);
+static int find_search_method(const char *search_name);
+static int find_depression_method(const char *depression_name);
+static int find_layout_method(const char *layout_name);
 static int find_algorithm_method(const char *algorithm_name);
 double aspect_on_fly(int row, int col);
+void ConditionAltitude(void);
+void OpenAltitudeWindow(void);
+void AdvanceAltitudeWindow(int row);
+void CloseAltitudeWindow(void);
+void FlowDirections(void);
 void D_8(int row, int col);
 void D_Inf(int row, int col);
 void MFD_8(int row, int col);
@@ -255,17 +544,44 @@ void MFD_md(int row, int col);
 void AllocateMemory();
 void ReadInputLayer();
 void Cleanup();
-layer *NewLayer();
+layer *NewLayer(uint32_t n);
 void FreeLandscape();
-int *FindNonZeroTermIndices(double *p, int size);
-double FlowPathUnitResponse(node *p, int time_index, int id);
-double CellOutletResponse(node *p, int time_index, int id);
+double FlowPathUnitResponse(const contrib *q, int time_index);
+double CellOutletResponse(const contrib *q, int time_index);
+double StepResponse(const contrib *q, int time_index);
+void ResponseParameters(double avg, double var, int outlet, double *mu, double *lambda);
+int ResponseClass(int c, int outlet, double mu, double lambda);
+void AppendContributor(layer *p, int c, const node *q, int *capacity);
+const contrib *GetContributors(const layer *c, int comp, int row, int col);
+void FlushContributorTiles(int band);
+void BuildOutgoingKernels(void);
+void ScatterExcess(layer *c, int step, double amount, int first);
+void CollectSubsurface(layer *c, int n, double *qin, double *qout);
 double DIST(short dir);
 int IsEnqueued(Queue *queue, int rown, int coln);
 node *NewNode();
 node *GetNode(Queue *queue, int rown, int coln);
 void FindBasin(layer *a);
+void FreeBasinSearch(void);
+FILE *OpenState(const char *name);
+void LoadState(FILE *fp, layer *p);
+void SaveState(const char *name);
 void Init();
+void SurfaceRouting(layer *c, double *qin, double *qout);
+void SubsurfaceRouting(layer *c, int n, double *qin, double *qout);
+static inline double SoilWaterContent(const layer *c, const struct Parm *pp, double water, const int ZONE);
+static inline double PlantAvailableWater(const layer *c, const struct Parm *pp, double swc, const int ZONE);
+cell_kernel SelectCellKernel(int accumulate);
+void StoreCellOutputs(struct output *out, const int *types, int col, const layer *c, const struct Parm *pp,
+					  const struct cell_flux *f, double etp, int origin);
+int RowNullMask(const DCELL *rain, const DCELL *etp, unsigned char *mask, int *valid);
+struct climate_row *CreateClimateRow(int n);
+void DestroyClimateRow(struct climate_row *w);
+void ClimateRowKernel(struct climate_row *w, int count, int zone);
+struct excess_row *CreateExcessRow(int n);
+void DestroyExcessRow(struct excess_row *w);
+void ExcessRowKernel(struct excess_row *w, int count, int ia);
+void ExcessRowScalar(struct excess_row *w, int count, int ia);
 void Process();
 
  #endif
\ No newline at end of file
@@ -27,6 +27,7 @@
 #include <unistd.h>
 #include <string.h>
 #include <time.h>
+#include <limits.h>
 #include <grass/config.h>
 #include <grass/gis.h>
 //#include <grass/defs/site.h>
@@ -38,6 +39,8 @@
 #include "head.h"
 #include "Queue.h"
 #include "utils.h"
+#include "Writer.h"
+#include "Reader.h"
 
 #define _USE_MATH_DEFINES
 #define EPS 0.01
@@ -64,6 +67,7 @@
 		parseOptions(argc, argv);
 		createSEGMENT();
 		Init();
+		RetileSEGMENT(SEG_STRIP);
 		Process();
 		exit(EXIT_SUCCESS);
 	}
@@ -116,9 +120,10 @@
 	parm.slope->key = "slope[%]";
     parm.slope->description =
         _("Nom de la couche raster dont les valeurs "
-		  "representent la pente en pourcentage.");
+		  "representent la pente en pourcentage "
+		  "(obsolete: la carte n est plus lue).");
 	parm.slope->type = TYPE_STRING;
-	parm.slope->required = YES;
+	parm.slope->required = NO;
 	parm.slope->multiple = NO;
 	parm.slope->guisection = _("Topographic parameters");
 	
@@ -129,7 +134,7 @@
         _("Nom de la couche raster dont les valeurs "
 		  "representent la teneur en eau du sol à saturation en m3.m-3.");
 	parm.sat->type = TYPE_STRING;
-	parm.sat->required = YES;
+	parm.sat->required = NO;
 	parm.sat->multiple = NO;
 	parm.sat->guisection = _("Soil hydraulic parameters");
 	
@@ -139,7 +144,7 @@
         _("Nom de la couche raster dont les valeurs "
 		  "representent la teneur en eau du sol à la capacité au champ en m3.m-3.");
 	parm.fc->type = TYPE_STRING;
-	parm.fc->required = YES;
+	parm.fc->required = NO;
 	parm.fc->multiple = NO;
 	parm.fc->guisection = _("Soil hydraulic parameters");
 	
@@ -149,7 +154,7 @@
         _("Nom de la couche raster dont les valeurs "
 		  "representent la teneur en eau du sol au point de fletrissement permanent en m3.m-3.");
 	parm.pwp->type = TYPE_STRING;
-	parm.pwp->required = YES;
+	parm.pwp->required = NO;
 	parm.pwp->multiple = NO;
 	parm.pwp->guisection = _("Soil hydraulic parameters");
 	
@@ -159,7 +164,7 @@
         _("Nom de la couche raster dont les valeurs "
 		  "representent la quantite maximale d eau disponible pour les plantes en mm.");
 	parm.rum->type = TYPE_STRING;
-	parm.rum->required = YES;
+	parm.rum->required = NO;
 	parm.rum->multiple = NO;
 	parm.rum->guisection = _("Soil hydraulic parameters");
 	
@@ -167,9 +172,10 @@
 	parm.ksat->key = "saturated_hydraulic_conductivity[L.T-1]";
     parm.ksat->description =
         _("Nom de la couche raster dont les valeurs "
-		  "representent la conductivité hydraulique du sol à saturation en m.j-1.");
+		  "representent la conductivité hydraulique du sol à saturation en m.j-1 "
+		  "(obsolete: la carte n est plus lue).");
 	parm.ksat->type = TYPE_STRING;
-	parm.ksat->required = YES;
+	parm.ksat->required = NO;
 	parm.ksat->multiple = NO;
 	parm.ksat->guisection = _("Soil hydraulic parameters");
 	
@@ -179,10 +185,27 @@
         _("Nom de la couche raster dont les valeurs "
 		  "representent la profondeur du sol en m");
 	parm.depth->type = TYPE_STRING;
-	parm.depth->required = YES;
+	parm.depth->required = NO;
 	parm.depth->multiple = NO;
 	parm.depth->guisection = _("Soil hydraulic parameters");
 	
+	parm.soil = G_define_standard_option(G_OPT_R_INPUT);
+	parm.soil->key = "soil";
+    parm.soil->description =
+        _("Nom de la couche raster (CELL) des classes de sol. Les parametres du sol dont la carte "
+		  "n est pas renseignee sont lus dans la table soil_table= ; une carte renseignee remplace la "
+		  "valeur de la classe cellule par cellule.");
+	parm.soil->required = NO;
+	parm.soil->guisection = _("Soil hydraulic parameters");
+	
+	parm.soil_table = G_define_standard_option(G_OPT_F_INPUT);
+	parm.soil_table->key = "soil_table";
+	parm.soil_table->required = NO;
+	parm.soil_table->description = _("Table des parametres des classes de sol : une ligne par classe "
+								   "'classe saturation capacite_au_champ point_de_fletrissement reserve_utile profondeur conductivite' "
+								   "(memes unites que les cartes, lignes commencant par # ignorees)");
+	parm.soil_table->guisection = _("Soil hydraulic parameters");
+	
 	//SURFACE/SUBSURFACE INPUTS	
 	parm.flow_speeds = G_define_standard_option(G_OPT_R_INPUT);
 	parm.flow_speeds->key = "v[L.T-1]";
@@ -285,6 +308,19 @@
     parm.mem->description = _("Memoire maximale a utiliser en MB");
 	parm.mem->guisection = _("Settings");
 	
+	parm.state_in = G_define_standard_option(G_OPT_F_INPUT);
+	parm.state_in->key = "state_in";
+	parm.state_in->required = NO;
+	parm.state_in->description = _("Fichier d etat d une execution precedente a partir duquel le calcul reprend "
+								   "(teneur en eau, reserve utile et historique du ruissellement)");
+	parm.state_in->guisection = _("Settings");
+	
+	parm.state_out = G_define_standard_option(G_OPT_F_OUTPUT);
+	parm.state_out->key = "state_out";
+	parm.state_out->required = NO;
+	parm.state_out->description = _("Fichier dans lequel l etat de fin de calcul est sauvegarde pour une reprise ulterieure");
+	parm.state_out->guisection = _("Settings");
+	
 	parm.method = G_define_option();
 	parm.method->key = "method(s)";
 	parm.method->type = TYPE_STRING;
@@ -304,6 +340,17 @@
 	parm.algorithm->answer = "MFDmd";	
 	parm.algorithm->guisection = _("Settings");
 	
+	parm.depressions = G_define_option();
+	parm.depressions->key = "depressions";
+	parm.depressions->type = TYPE_STRING;
+	parm.depressions->description = _("Conditionnement des altitudes avant le calcul des directions d ecoulement: aucun (none)"
+									  " ou remplissage des cuvettes et drainage des zones plates (fill)");
+	parm.depressions->answer = "none";
+	parm.depressions->required = NO;
+	parm.depressions->multiple = NO;
+	parm.depressions->options = "none,fill";
+	parm.depressions->guisection = _("Settings");
+	
 	parm.init_abs = G_define_option();
 	parm.init_abs->key = "Ia[-]";
 	parm.init_abs->type = TYPE_STRING;
@@ -315,6 +362,72 @@
 	parm.init_abs->options = "traditional, alternative";
 	parm.init_abs->guisection = _("Settings");
 	
+	parm.kernel = G_define_option();
+	parm.kernel->key = "kernel";
+	parm.kernel->type = TYPE_STRING;
+	parm.kernel->description = _("Evaluation des fonctions de reponse du ruissellement sur un pas de temps:"
+								 " densite a la fin du pas de temps ou integrale numerique sur le pas de temps");
+	parm.kernel->answer = "point";
+	parm.kernel->required = NO;
+	parm.kernel->multiple = NO;
+	parm.kernel->options = "point,romberg,kronrod,tanhsinh,cdf";
+	parm.kernel->guisection = _("Settings");
+	
+	parm.epsilon = G_define_option();
+	parm.epsilon->key = "epsilon";
+	parm.epsilon->type = TYPE_DOUBLE;
+	parm.epsilon->description = _("Masse des fonctions de reponse pouvant etre ignoree: la convolution ne parcourt"
+								  " que les pas de temps contenant la masse 1-epsilon de chaque fonction de reponse");
+	parm.epsilon->answer = "0.000001";
+	parm.epsilon->required = NO;
+	parm.epsilon->multiple = NO;
+	parm.epsilon->options = "0.0-0.1";
+	parm.epsilon->guisection = _("Settings");
+	
+	parm.quantum = G_define_option();
+	parm.quantum->key = "quantum";
+	parm.quantum->type = TYPE_DOUBLE;
+	parm.quantum->description = _("Pas relatif de la grille de quantification des parametres des fonctions de reponse:"
+								  " les contributeurs dont les parametres tombent dans la meme case partagent une seule fonction de reponse (0: parametres identiques)");
+	parm.quantum->answer = "0.001";
+	parm.quantum->required = NO;
+	parm.quantum->multiple = NO;
+	parm.quantum->options = "0.0-0.1";
+	parm.quantum->guisection = _("Settings");
+	
+	parm.routing = G_define_option();
+	parm.routing->key = "routing";
+	parm.routing->type = TYPE_STRING;
+	parm.routing->description = _("Calcul du ruissellement de subsurface: chaque cellule collecte l eau de ses contributeurs (pull)"
+								  " ou l eau de chaque cellule est diffusee une seule fois vers l aval (push)");
+	parm.routing->answer = "pull";
+	parm.routing->required = NO;
+	parm.routing->multiple = NO;
+	parm.routing->options = "pull,push";
+	parm.routing->guisection = _("Settings");
+	
+	parm.search = G_define_option();
+	parm.search->key = "search";
+	parm.search->type = TYPE_STRING;
+	parm.search->description = _("Recherche des bassins de drainage: parcours en largeur (bfs) ou algorithme de Dijkstra"
+								 " par temps de trajet croissant (dijkstra)");
+	parm.search->answer = "dijkstra";
+	parm.search->required = NO;
+	parm.search->multiple = NO;
+	parm.search->options = "bfs,dijkstra";
+	parm.search->guisection = _("Settings");
+	
+	parm.layout = G_define_option();
+	parm.layout->key = "layout";
+	parm.layout->type = TYPE_STRING;
+	parm.layout->description = _("Rangement des cellules en memoire: par lignes, ou par blocs le long d une courbe de remplissage"
+								 " pour que les cellules voisines et amont soient proches en memoire");
+	parm.layout->answer = "rowmajor";
+	parm.layout->required = NO;
+	parm.layout->multiple = NO;
+	parm.layout->options = "rowmajor,morton,hilbert";
+	parm.layout->guisection = _("Settings");
+	
 	parm.drainage_times = G_define_option();
     parm.drainage_times->key = "drainage times[T]";
     parm.drainage_times->type = TYPE_DOUBLE;
@@ -382,6 +495,15 @@
 	flag6->key = 'z';
 	flag6->description = _("Calculer le bilan hydrique avec prise en compte de la zone alluviale");	
 	
+	flag7 = G_define_flag();
+	flag7->key = 't';
+	flag7->description = _("Afficher les temps de calcul et d ecriture des cartes de sortie");
+	
+	flag8 = G_define_flag();
+	flag8->key = 'o';
+	flag8->description = _("Stocker les listes de contributeurs dans des fichiers de tuiles (seules ces listes sont hors memoire, "
+						   "l etat des cellules et les evenements restent en memoire): la moitie de la memoire allouee sert de cache aux tuiles");
+	
     /*  Analyse la ligne de commande */
     if (G_parser(argc, argv))
 	{
@@ -407,27 +529,27 @@
 		G_fatal_error(_("Les listes des rasters d entree prec= et etp= doivent avoir la meme longueur."));
 	
 	/* Vérifie les options et calcule le nombre de couches de sortie */
-	if(!flag3 && !flag4 && !flag5)
+	if(!flag3->answer && !flag4->answer && !flag5->answer)
 		G_fatal_error(_("Choisissez au moins une des options suivantes:"
 						" flag -j : Calcul du bilan hydrique journalier\n"
 						" flag -m : Calcul du bilan hydrique mensuel\n"
 						" flag -f : Calcul du bilan hydrique avec un pas de temps specifique\n"));
-	if(flag3 && flag4 && flag5)
+	if(flag3->answer && flag4->answer && flag5->answer)
 		G_fatal_error(_("Impossible de choisir plus de deux options simultanement."));				
 
 	num_outputs_names = 0;
 	int count = 0;
 	sum_days = 0;
 	for (i = 0; parm.outputs->answers[i]; i++)
-		num_outputs = num_outputs_names = i;
-		
-	num_outputs_names =	(num_outputs_names==0) ? 1 : num_outputs_names;
+		;
+	num_outputs_names =	(i==0) ? 1 : i;
+	num_outputs 		= num_outputs_names;
 	
-	if(flag3 && !flag4 && !flag5 || flag4 && !flag3 && !flag5){
+	if(flag3->answer && !flag4->answer && !flag5->answer || flag4->answer && !flag3->answer && !flag5->answer){
 	options = 1;
 	num_outputs *= num_inputs;
 	}
-	if(flag3 && flag4){
+	if(flag3->answer && flag4->answer){
 	options = 2;
 	i = 0;
 	while (num_inputs>sum_days){
@@ -440,9 +562,9 @@
 	else if(sum_days>num_inputs)
 		G_warning(_("Attention !!! La liste des rasters d entree prec= et etp= est superieure a la liste de rasters attendue en sortie..."));
 	}
-	else if (flag3 && flag5 || flag4 && flag5){
+	else if (flag3->answer && flag5->answer || flag4->answer && flag5->answer){
 	options = 3;
-		int outiter = atoi(parm.outiter->answer);					  
+		outiter = atoi(parm.outiter->answer);					  
 		if (sscanf(parm.outiter->answer, "%i", &outiter) != 1 || outiter < 1)
 			G_fatal_error(_("Frequence de calcul du bilan hydrique (outiter=) inappropriee : %i"), outiter);
 
@@ -452,38 +574,60 @@
 			}
 		}			
 	}
-	/* Verifie si le(s) nom de raster(s) de sortie specifié(s) est(sont) compatible(s) avec l'option de calcul */
-	for(i=0; i<num_outputs_names; i++){
-		int indice = find_method(parm.outputs->answers[i]);
-		if( (options==1 && indice>2) || (options==2 && indice>2 && indice<5) || (options==3 && indice>4) )
-			G_fatal_error(_("L option %i ne permet pas de calculer : %s en sortie"), options, menu_outputs[indice].text);
-	}
 	
 	/* Vérifie que les cartes identifiant les surfaces en eau et la zone alluviale sont renseignées
 	pour la prise en compte de la zone alluviale */
-	if(flag6 && !parm.waterbodies->answer && !parm.riparian->answer)
+	if(flag6->answer && !parm.waterbodies->answer && !parm.riparian->answer)
 		G_fatal_error(_("Pour la prise en compte de la zone alluviale (flag: '-z') veuillez remplir les champs waterbodies= et riparian="));
 	
+	/* Paramètres du sol : cartes par cellule, ou classes de sol et leur table */
+	if(parm.soil->answer){
+		if(!parm.soil_table->answer)
+			G_fatal_error(_("La carte des classes de sol soil= demande la table de leurs parametres soil_table="));
+		LoadSoilTable(parm.soil_table->answer);
+	}
+	else if(!parm.sat->answer || !parm.fc->answer || !parm.pwp->answer || !parm.rum->answer || !parm.depth->answer)
+		G_fatal_error(_("Sans carte des classes de sol (soil=), les cartes de teneur en eau a saturation, a la capacite au champ, "
+						"au point de fletrissement, de reserve utile et de profondeur du sol sont requises"));
+	
 	/* Vérifie le montant de la mémoire spécifié */
 	if (sscanf(parm.mem->answer, "%d", &maxmem) != 1 || maxmem <= 0)
 		G_fatal_error(_("Quantite de memoire inappropriee: %d"), maxmem);
 
 	/* Récupère les paramètres renseignés */
 	method 			= find_method(parm.method->answer);
+	
+	/* Verifie si le(s) nom de raster(s) de sortie specifié(s) est(sont) compatible(s) avec la méthode de calcul */
+	for(i=0; parm.outputs->answers[i]; i++){
+		int indice = find_output_name(parm.outputs->answers[i]);
+		if( ((indice==OUT_QINSSF || indice==OUT_QOUTSSF) && method<2) || (indice>=OUT_QINSF && method!=1 && method!=3) )
+			G_fatal_error(_("La methode %s ne permet pas de calculer : %s en sortie"), menu[method].name, menu_outputs[indice].text);
+	}
 	method_ia		= find_ia_method(parm.init_abs->answer);
+	kernel_mode		= find_kernel_method(parm.kernel->answer);
+	routing_mode	= find_routing_method(parm.routing->answer);
+	search_mode		= find_search_method(parm.search->answer);
+	layout_mode		= find_layout_method(parm.layout->answer);
+	kernel_eps		= atof(parm.epsilon->answer);
+	if(kernel_eps < 0.0 || kernel_eps >= 1.0)
+		G_fatal_error(_("Valeur de epsilon inappropriee: %g"), kernel_eps);
+	kernel_quantum	= atof(parm.quantum->answer);
+	if(kernel_quantum < 0.0 || kernel_quantum > 0.1)
+		G_fatal_error(_("Valeur de quantum inappropriee: %g"), kernel_quantum);
 	if(method){
 		algorithm	= find_algorithm_method(parm.algorithm->answer);
 			if(algorithm==2||algorithm==4)
 				mfd_converge = atof(parm.convergence->answer);
+		depression_mode	= find_depression_method(parm.depressions->answer);
 	}
 	
 	for (i = 0; parm.flow_speeds->answers[i]; i++)
 		;
-	if(method>1 && i<1)
+	if(method>0 && i<1)
 		G_fatal_error(_("Le champ flow_speeds= doit etre renseigner pour le calcul du ruissellement"));
-	if(method==4 && i<2)
+	if(method==3 && i<2)
 		G_fatal_error(_("Le champ flow_speeds= doit comporter le nom de 2 cartes rasters de vitesse d ecoulement de l eau: a la surface et en subsurface"));
-	if(method==4 && i==2)	
+	if(method==3 && i==2)	
 		G_verbose_message(_("Le module suppose que les vitesses d ecoulement de l eau sont dans l ordre suivant : vitesse d ecoulement surfacique, vitesse d ecoulement subsurfacique"));
 	
 	for (i = 0; parm.flow_disps->answers[i]; i++)
@@ -497,32 +641,33 @@
 				
 	for(i=0;parm.drainage_times->answers[i]; i++)
 		;
-	double drainage_times[2] ={ ( (flag3 && !flag4 && !flag5) || (flag3 && flag5) ) ? atof(parm.drainage_times->answers[0]) : atof(parm.drainage_times->answers[0]) * 30., ( (flag3 && !flag4 && !flag5) || (flag3 && flag5) ) ? atof(parm.drainage_times->answers[(i>1)?1:0]) : atof(parm.drainage_times->answers[(i>1)?1:0]) * 30. };
+	drainage_times[0] = ( (flag3->answer && !flag4->answer && !flag5->answer) || (flag3->answer && flag5->answer) ) ? atof(parm.drainage_times->answers[0]) : atof(parm.drainage_times->answers[0]) * 30.;
+	drainage_times[1] = ( (flag3->answer && !flag4->answer && !flag5->answer) || (flag3->answer && flag5->answer) ) ? atof(parm.drainage_times->answers[(i>1)?1:0]) : atof(parm.drainage_times->answers[(i>1)?1:0]) * 30.;
 
 	// dimensions et résolution de la fenêtre d'etude
 	RES 	= (double) window.ew_res;
 	nrows 	= Rast_window_rows();
     ncols 	= Rast_window_cols();
 
+	/* Le temps d'un pas (t + 1/v) * DIST ne croît avec t que si DIST >= 1 : en dessous (degrés, résolution
+	   inférieure à l'unité de la carte), un temps traité par Dijkstra pourrait encore diminuer */
+	if(method && search_mode==SEARCH_DIJKSTRA && RES < 1.0){
+		G_warning(_("Resolution inferieure a 1 unite de carte (%g): recherche des bassins de drainage par search=bfs"), RES);
+		search_mode = SEARCH_BFS;
+	}
+
 	Rast_set_d_null_value(&null_val, 1);
-		
-    if ((double) nrows * ncols > 200000000) srows = scols = SEGCOLSIZE / 2;
-	else   srows = scols = SEGCOLSIZE;
 	
-	/* Calcule le nombre total de segments */
-	nseg = ((nrows + srows - 1) / srows) * ((ncols + scols - 1) / scols);
+	/* Reprise à chaud : lit l'en-tête du fichier d'état de l'exécution précédente */
+	if(parm.state_in->answer)
+		state_fp = OpenState(parm.state_in->answer);
+		
+	/* Taille réelle d'un enregistrement du fichier segmenté pour la méthode choisie */
+	PlanParmRecord(method);
+    disk_mb = (double) nrows * ncols * parm_rec.size / 1048576.;
 	
-	/* Calcule l'espace disque et les besoins en mémoire */
-	/* (nrows + ncols) * 8. * 20.0 / 1048576. for Dijkstra search */	
-	pq_mb = ((double)nrows + ncols) * 8. * 20.0 / 1048576.;
-    G_debug(1, "pq MB: %g", pq_mb);
-    maxmem -= pq_mb;
-    if (maxmem < 10) maxmem = 10;
-    disk_mb = (double) nrows * ncols * 24. / 1048576.;
-    segments_in_memory = maxmem / ((double) srows * scols * (24. / 1048576.));
-    if (segments_in_memory < 4) segments_in_memory = 4;
-    if (segments_in_memory > nseg) segments_in_memory = nseg;
-    mem_mb = (double) srows * scols * (24. / 1048576.) * segments_in_memory;
+	/* Répartit memory= entre les structures du calcul et choisit les modes qui y tiennent */
+	PlanMemory();
 
 	// options 1
 
@@ -537,10 +682,14 @@
 	
 	if (flag->answer) {
 	fprintf(stdout, _("Bilan hydrique :%s\n"),
-	(options==1 && flag3)?"journalier":(options==1 && flag4)?"mensuel":(options==2)?"mensuel (avec donnees journalieres)":(options==3 && flag3)?"journalier":"mensuel");
+	(options==1 && flag3->answer)?"journalier":(options==1 && flag4->answer)?"mensuel":(options==2)?"mensuel (avec donnees journalieres)":(options==3 && flag3->answer)?"journalier":"mensuel");
 	fprintf(stdout, "\n");
 	if(options==3)
-		fprintf(stdout, _(" Frequence des calculs :tous les %i%s\n"),outiter,(flag3)?"jours":"mois");	
+		fprintf(stdout, _(" Frequence des calculs :tous les %i%s\n"),outiter,(flag3->answer)?"jours":"mois");	
+	if(state_fp)
+		fprintf(stdout, _("Reprise du calcul a partir du pas de temps %d (fichier d etat <%s>)\n"), t_offset+1, parm.state_in->answer);
+    fprintf(stdout, _("Precision du stockage de l etat des cellules:%s\n"), (sizeof(real)==sizeof(float))?"simple":"double");
+    fprintf(stdout, _("Rangement des cellules en memoire:%s -%s-\n"), menu_layout[layout_mode].name, menu_layout[layout_mode].text);
     fprintf(stdout, _("Methode de calcul:%s -%s-"), menu[method].name, menu[method].text);
     fprintf(stdout, "\n");
 		if(method){
@@ -549,12 +698,17 @@
 			fprintf(stdout, _("%s"), menu_algorithm[algorithm].text);
 			if(algorithm==2||algorithm==4)
 				fprintf(stdout, _("Exposant de partitionnement du ruissellement:%.1f"), mfd_converge);
+			fprintf(stdout, _("Conditionnement des altitudes:%s -%s-\n"), menu_depressions[depression_mode].name, menu_depressions[depression_mode].text);
 			if(method==1||method==3)
-				fprintf(stdout, _("Temps de drainage du bassin versant par ruissellement de surface:%.1f h"), drainage_times[1]);			
+				fprintf(stdout, _("Temps de drainage du bassin versant par ruissellement de surface:%.1f h\n"), drainage_times[0]);			
 			if(method>1)
-				fprintf(stdout, _("Temps de drainage du bassin versant par ruissellement de subsurface:%.1f h"), drainage_times[2]);			
+				fprintf(stdout, _("Temps de drainage du bassin versant par ruissellement de subsurface:%.1f h\n"), drainage_times[1]);			
 			if(method==1||method==3)
 				fprintf(stdout, _("Technique de calcul de l abstraction initiale:%s -%s-"), menu_ia[method_ia].name,menu_ia[method_ia].text);
+			fprintf(stdout, _("Fonctions de reponse:%s -%s- (epsilon=%g, quantum=%g)\n"), menu_kernel[kernel_mode].name, menu_kernel[kernel_mode].text, kernel_eps, kernel_quantum);
+			if(method>1)
+				fprintf(stdout, _("Ruissellement de subsurface:%s -%s-\n"), menu_routing[routing_mode].name, menu_routing[routing_mode].text);
+			fprintf(stdout, _("Recherche des bassins de drainage:%s -%s-\n"), menu_search[search_mode].name, menu_search[search_mode].text);
 			fprintf(stdout, "\n");			
 		}
     fprintf(stdout, _("Dimensions de la carte :\nNombre de lignes:%.1f\nNombre de colonnes:%.1f\nResolution des pixels:%.1fmx%.1fm"),nrows,ncols,RES,RES);
@@ -563,8 +717,44 @@
 	fprintf(stdout, "\n");
     fprintf(stdout, _("Vous aurez besoin d'au moins %.2f MB de memoire"), mem_mb);
     fprintf(stdout, "\n");
+	fprintf(stdout, _("Plan de memoire (memory=%d MB):\n"), maxmem);
+	for (i = 0; i < mem_plan.n; i++)
+		fprintf(stdout, "  %-40s %10.2f MB%s\n", mem_plan.name[i], mem_plan.mb[i],
+				(mem_plan.kind[i]==MEM_ESTIMATE) ? _(" (estimation)") : (mem_plan.kind[i]==MEM_BOUND) ? _(" (au plus, hors total)") : "");
+	fprintf(stdout, _("Pic a l initialisation: %.2f MB, pendant le calcul: %.2f MB\n"), mem_plan.init_mb, mem_plan.process_mb);
+	fprintf(stdout, _("Historique de teneur en eau: %d pas de temps sur %d\n"), swc_len, num_inputs);
+	if(method>0 && tile_mb > 0.0)
+		fprintf(stdout, _("Listes de contributeurs: hors memoire (%s)\n"), flag8->answer ? "-o" : "choisi par le plan de memoire");
+	else if(method>0)
+		fprintf(stdout, _("Listes de contributeurs: en memoire, hors memoire au-dela de %.2f MB\n"), mem_plan.contrib_budget_mb);
     fprintf(stdout, _("%d des %d segments sont gardes en memoire"), segments_in_memory, nseg);
     fprintf(stdout, "\n");
+	fprintf(stdout, _("Segments des parcours ligne par ligne: bandes de %dx%d cellules, %d sur %d en memoire (%.2f MB)"),
+			seg_strip.srows, seg_strip.scols, seg_strip.in_memory, seg_strip.nseg, seg_strip.mem_mb);
+    fprintf(stdout, "\n");
+	if(method>0){
+		fprintf(stdout, _("Segments de la recherche des bassins: tuiles de %dx%d cellules, %d sur %d en memoire (%.2f MB)"),
+				seg_square.srows, seg_square.scols, seg_square.in_memory, seg_square.nseg, seg_square.mem_mb);
+		fprintf(stdout, "\n");
+		fprintf(stdout, _("Fichier segmente ecrit en %s%s"), (seg_geom.shape==SEG_STRIP) ? "bandes, recopie en tuiles avant la recherche des bassins" : "tuiles",
+				(seg_square.ncolseg>1) ? ", recopie en bandes avant le calcul" : "");
+		fprintf(stdout, "\n");
+	}
+	fprintf(stdout, _("Parametres stockes par cellule (%d octets au lieu de %d):"), (int)parm_rec.size, (int)sizeof(struct Parm));
+	if(parm_rec.soil)
+		fprintf(stdout, " soil(16 bits)");
+	for (i = 0; i < parm_rec.nfields; i++)
+		fprintf(stdout, " %s", parm_rec.name[i]);
+    fprintf(stdout, "\n");
+	if(parm_rec.soil){
+		fprintf(stdout, _("%d parametres du sol lus dans la table des classes de sol <%s> (%d classes, %.1f kB)"),
+				parm_rec.ntable, parm.soil_table->answer, nsoil_classes, (nsoil_classes + 1) * sizeof(struct SoilClass) / 1024.);
+		fprintf(stdout, "\n");
+	}
+	if (tile_mb > 0.0) {
+		fprintf(stdout, _("Listes de contributeurs stockees par tuiles de %dx%d cellules, cache de %.0f MB"), TILE_SIZE, TILE_SIZE, tile_mb);
+		fprintf(stdout, "\n");
+	}
     
     exit(EXIT_SUCCESS);
     }
@@ -574,528 +764,602 @@
 
 }
 
-	/* ******************************************** */
-	/* Crée et écrit un format de fichier segmenté  */
-	/* ******************************************** */
-
-	void createSEGMENT(){
-
-    G_verbose_message(_("Cree un fichier temporaire..."));
+	/* ******************************************************************* */
+	/* Lit la table des paramètres des classes de sol (soil_table=) :      */
+	/* une ligne "classe sat fc pwp rum depth ksat" par classe de sol       */
+	/* ******************************************************************* */
 	
-    if (Segment_open(&parms_seg, G_tempfile(), nrows, ncols, srows, scols, sizeof(struct Parm), segments_in_memory) != 1)
-		G_fatal_error(_("Ne peux pas creer le fichier temporaire"));
-
-
-	/* DECLARE */
-	int skip_nulls;
-	int sat_fd, fc_fd, rum_fd, depth_fd;
-	int sat_dsize, fc_dsize, rum_dsize, depth_dsize;
-	double p_sat, p_fc, p_rum, p_depth;
-	void *sat_cell, *fc_cell, *rum_cell, *depth_cell;
-
-	// method>0	
-	int alt_fd, pwp_fd, slope_fd;
-	int alt_dsize,  pwp_dsize, slope_dsize;
-	double  p_pwp, p_slope;
-	float p_alt;
-	void *alt_cell, *pwp_cell, *slope_cell;
-	// method==1||method==3
-	int speed_sf_fd, disp_sf_fd;
-	int speed_sf_dsize, disp_sf_dsize;
-	double p_speed_sf, p_disp_sf;
-	void *speed_sf_cell, *disp_sf_cell;
-	//method>1
-	int speed_ssf_fd, disp_ssf_fd, ksat_fd;
-	int speed_ssf_dsize, disp_ssf_dsize, ksat_dsize;
-	double p_speed_ssf, p_disp_ssf, p_ksat;
-	void *speed_ssf_cell, *disp_ssf_cell, *ksat_cell;	// pointeurs vers un bloc de mémoire				
-
+	void LoadSoilTable(const char *name){
 	
-	/* INITIALISE */
+	FILE *fp;
+	char line[1024];
+	int id, nline = 0;
+	struct SoilClass s;
+	
+		if((fp = fopen(name, "r")) == NULL)
+			G_fatal_error(_("Impossible d ouvrir la table des classes de sol <%s>"), name);
+			
+		while(fgets(line, sizeof(line), fp)){
+			nline++;
+			if(line[strspn(line, " \t")] == '#' || line[strspn(line, " \t\r\n")] == '\0')
+				continue;
+			if(sscanf(line, "%d %lf %lf %lf %lf %lf %lf", &id, &s.sat, &s.fc, &s.pwp, &s.rum, &s.depth, &s.ksat) != 7)
+				G_fatal_error(_("Ligne %d de la table des classes de sol <%s> illisible"), nline, name);
+			/* La dernière valeur sur 16 bits est réservée aux cellules sans classe */
+			if(id < 0 || id >= UINT16_MAX)
+				G_fatal_error(_("Classe de sol %d hors de l intervalle [0, %d]"), id, UINT16_MAX - 1);
+			if(id >= nsoil_classes){
+				soil_classes = (struct SoilClass *)G_realloc(soil_classes, (id + 1) * sizeof(struct SoilClass));
+				memset(soil_classes + nsoil_classes, 0, (id + 1 - nsoil_classes) * sizeof(struct SoilClass));
+				nsoil_classes = id + 1;
+			}
+			s.defined 			= 1;
+			soil_classes[id] 	= s;
+		}
+		fclose(fp);
+		
+		/* Classe des cellules nulles de la carte soil= : tous les paramètres sont nuls */
+		soil_classes = (struct SoilClass *)G_realloc(soil_classes, (nsoil_classes + 1) * sizeof(struct SoilClass));
+		Rast_set_d_null_value(&s.sat, 1);
+		s.fc = s.pwp = s.rum = s.depth = s.ksat = s.sat;
+		s.defined 						= 1;
+		soil_classes[nsoil_classes] 	= s;
+	}
+	
+	/* ********************************************************************* */
+	/* Choisit les champs de struct Parm stockés dans le fichier segmenté :   */
+	/* seuls ceux que la méthode de calcul lit après createSEGMENT le sont.   */
+	/* (tanslope, depth et ksat ne servent qu'à convertir les teneurs en eau) */
+	/* ********************************************************************* */
 	
-	// Fichiers descripteurs des couches raster : (1)
-	sat_fd 		= openLayer(parm.sat->answer);
-	fc_fd 		= openLayer(parm.fc->answer);
-	rum_fd 		= openLayer(parm.rum->answer);
-	depth_fd 	= openLayer(parm.depth->answer);	
-	// Types de données : (2)
-	sat_data_type 	= Rast_get_map_type(sat_fd);
-	fc_data_type 	= Rast_get_map_type(fc_fd);
-	rum_data_type 	= Rast_get_map_type(rum_fd);
-	depth_data_type = Rast_get_map_type(depth_fd);	
-	// Taille des données : (3)
-	sat_dsize 		= Rast_cell_size(sat_data_type);
-	fc_dsize 		= Rast_cell_size(fc_data_type);
-	rum_dsize 		= Rast_cell_size(rum_data_type);
-	depth_dsize 	= Rast_cell_size(depth_data_type);	
-	// Alloue de la mémoire et initialise l'adresse des pointeurs : (4)	
-	sat_cell 		= Rast_allocate_buf(sat_data_type);
-	fc_cell 		= Rast_allocate_buf(fc_data_type);
-	rum_cell 		= Rast_allocate_buf(rum_data_type);
-	depth_cell 		= Rast_allocate_buf(depth_data_type);	
-	
-	p_sat = 0.0; p_fc = 0.0; p_rum = 0.0; p_depth = 0.0;
+	static void AddParmField(size_t offset, const char *name){
+		parm_rec.offset[parm_rec.nfields] 	= offset;
+		parm_rec.name[parm_rec.nfields++] 	= name;
+	}
 	
+	/* Paramètre du sol : stocké par cellule s'il a une carte, lu dans la table des classes sinon */
+	static void AddSoilField(size_t offset, const char *name, const char *map, size_t class_offset, int convert){
+		if(!parm_rec.soil || map){
+			AddParmField(offset, name);
+			return;
+		}
+		parm_rec.table_offset[parm_rec.ntable] 	= offset;
+		parm_rec.table_class[parm_rec.ntable] 	= class_offset;
+		parm_rec.table_convert[parm_rec.ntable++] = convert;
+		parm_rec.cell_depth |= convert && parm.depth->answer;
+	}
 	
-	if(method>0){
+	void PlanParmRecord(int method){
+	
+	int f;
+	
+		parm_rec.nfields 	= parm_rec.ntable = parm_rec.cell_depth = 0;
+		parm_rec.soil 		= (parm.soil->answer != NULL);
 		
-		// (1)
-		alt_fd 			= openLayer(parm.altitude->answer);
-		pwp_fd 			= openLayer(parm.pwp->answer);
-		slope_fd 		= openLayer(parm.slope->answer);
-		// (2)
-		alt_data_type 	= Rast_get_map_type(alt_fd);
-		pwp_data_type 	= Rast_get_map_type(pwp_fd);
-		slope_data_type = Rast_get_map_type(slope_fd);
-		// (3)
-		alt_dsize 		= Rast_cell_size(alt_data_type);
-		pwp_dsize 		= Rast_cell_size(pwp_data_type);
-		slope_dsize 	= Rast_cell_size(slope_data_type);
-		// (4)		
-		alt_cell		= Rast_allocate_buf(alt_data_type);	
-		pwp_cell 		= Rast_allocate_buf(pwp_data_type);
-		slope_cell 		= Rast_allocate_buf(slope_data_type);
-
-		p_alt =  0.0; p_pwp = 0.0; p_slope = 0.0;
-	}	
+		/* Bilan climatique : teneurs en eau à saturation, à la capacité au champ et réserve utile */
+		AddSoilField(offsetof(struct Parm, sat), "sat", parm.sat->answer, offsetof(struct SoilClass, sat), 1);
+		AddSoilField(offsetof(struct Parm, fc), "fc", parm.fc->answer, offsetof(struct SoilClass, fc), 1);
+		AddSoilField(offsetof(struct Parm, rum), "rum", parm.rum->answer, offsetof(struct SoilClass, rum), 0);
+		
+		/* Directions d'écoulement */
+		if(method>0)
+			AddParmField(offsetof(struct Parm, altitude), "altitude");
+			
+		/* Ruissellement de surface : point de flétrissement et fonction de réponse */
 		if(method==1||method==3){
+			AddSoilField(offsetof(struct Parm, pwp), "pwp", parm.pwp->answer, offsetof(struct SoilClass, pwp), 1);
+			AddParmField(offsetof(struct Parm, flow_speeds[0]), "speed_sf");
+			AddParmField(offsetof(struct Parm, flow_disps[0]), "disp_sf");
+		}
+		
+		/* Ruissellement de subsurface : fonction de réponse */
+		if(method>1){
+			AddParmField(offsetof(struct Parm, flow_speeds[1]), "speed_ssf");
+			AddParmField(offsetof(struct Parm, flow_disps[1]), "disp_ssf");
+		}
+		
+		/* Profondeur de la cellule pour convertir les teneurs en eau de la table quand la carte soil depth= la remplace */
+		if(parm_rec.cell_depth)
+			AddParmField(offsetof(struct Parm, depth), "depth");
+		
+		parm_rec.size = parm_rec.soil ? sizeof(uint16_t) : 0;
+		for (f = 0; f < parm_rec.nfields; f++){
+			parm_rec.pos[f] = parm_rec.size;
+			parm_rec.size  += sizeof(real);
+		}
+	}
 
-		// (1)			
-			speed_sf_fd = openLayer(parm.flow_speeds->answers[1]);
-			disp_sf_fd 	= openLayer(parm.flow_disps->answers[1]);
-		// (2)			
-			speed_sf_data_type 	= Rast_get_map_type(speed_sf_fd);
-			disp_sf_data_type 	= Rast_get_map_type(disp_sf_fd);
-		// (3)			
-			speed_sf_dsize 	= Rast_get_map_type(speed_sf_data_type);
-			disp_sf_dsize 	= Rast_get_map_type(disp_sf_data_type);
-		// (4)			
-			speed_sf_cell 	= Rast_allocate_buf(speed_sf_data_type);
-			disp_sf_cell 	= Rast_allocate_buf(disp_sf_data_type);
-			
-			p_speed_sf = 0.0; p_disp_sf = 0.0;
-		}
-			if(method>1){
-
-		// (1)				
-				speed_ssf_fd = openLayer(parm.flow_speeds->answers[2]);
-				disp_ssf_fd = openLayer(parm.flow_disps->answers[2]);	
-				ksat_fd 	= openLayer(parm.ksat->answer);
-		// (2)
-				speed_ssf_data_type = Rast_get_map_type(speed_ssf_fd);
-				disp_ssf_data_type 	= Rast_get_map_type(disp_ssf_fd);	
-				ksat_data_type 		= Rast_get_map_type(ksat_fd);
-		// (3)				
-				speed_ssf_dsize = Rast_cell_size(speed_ssf_data_type);
-				disp_ssf_dsize 	= Rast_cell_size(disp_ssf_data_type);
-				ksat_dsize		= Rast_cell_size(ksat_data_type);
-		// (4)				
-				speed_ssf_cell 	= Rast_allocate_buf(speed_ssf_data_type);
-				disp_ssf_cell 	= Rast_allocate_buf(disp_ssf_data_type);	
-				ksat_cell 		= Rast_allocate_buf(ksat_data_type);
-				
-				p_speed_ssf = 0.0; p_disp_ssf = 0.0; p_ksat = 0.0;
+	/* ********************************************************************* */
+	/* Plan de mémoire : estime chaque allocation importante du calcul et    */
+	/* répartit memory= entre elles. Les listes de contributeurs gardent au  */
+	/* plus la moitié de ce qui reste, au-delà elles passent hors mémoire    */
+	/* (-o) ; le cache du fichier segmenté reçoit le reste.                  */
+	/* ********************************************************************* */
+
+	/* Nombre moyen de contributeurs d'une cellule par ligne ou colonne de la plus petite dimension de la carte :
+	   l'aire amont moyenne est la longueur moyenne du chemin jusqu'à l'exutoire, de l'ordre de la distance au bord */
+	#define CONTRIB_PATH 0.25
+
+	/* Taille d'un bloc alloué par malloc, en-tête compris */
+	static double MallocChunk(double bytes){
+		double c = ceil((bytes + 8.0) / 16.0) * 16.0;
+		return (c < 32.0) ? 32.0 : c;
+	}
+
+	static void AddMemoryItem(const char *name, double bytes, int kind){
+		mem_plan.name[mem_plan.n] 	= name;
+		mem_plan.mb[mem_plan.n] 	= bytes / 1048576.;
+		mem_plan.kind[mem_plan.n++] = kind;
+	}
+
+	void PlanMemory(void){
+
+	double block, cells, base, inputs, reading, flood, search, push, lists, avail, seg_mb;
+	int side, ncomp, m;
+
+		block 	= layout_mode ? (double)(1 << LAYOUT_SHIFT) : 1.0;
+		cells 	= ceil(nrows / block) * ceil(ncols / block) * block * block;
+		ncomp 	= (method==3) ? 2 : 1;
+
+		/* Historique roulant de la teneur en eau : le pas précédent et le début de la période des sorties */
+		swc_len = (options==1) ? 2 : (options==2) ? 32 : outiter + 1;
+		if(swc_len > num_inputs)
+			swc_len = num_inputs;
+
+		mem_plan.n = 0;
+		AddMemoryItem("cellules du paysage", cells * sizeof(layer), MEM_EXACT);
+		AddMemoryItem("historique de teneur en eau", cells * swc_len * sizeof(real), MEM_EXACT);
+		AddMemoryItem("tables de rangement", ((double)nrows + ncols + (1 << (2*LAYOUT_SHIFT))) * sizeof(uint32_t), MEM_EXACT);
+		AddMemoryItem("tampons de lignes", (double)num_outputs_names * maxRowJobs * ncols * sizeof(DCELL)
+						+ (double)ncols * (13 * sizeof(double) + 2 * sizeof(struct Parm) + parm_rec.size + sizeof(int) + 1), MEM_EXACT);
+		base = 0.0;
+		for (m = 0; m < mem_plan.n; m++)
+			base += mem_plan.mb[m];
+
+		/* Seules les listes de contributeurs passent hors mémoire : les cellules, leurs historiques
+		   et les événements d'eau en excès restent en mémoire quels que soient -o et memory= */
+		if(method>0 && base > maxmem)
+			G_warning(_("Les cellules du paysage demandent %.0f MB, plus que les %d MB de memory= : seules les listes de contributeurs peuvent passer hors memoire"), base, maxmem);
+
+		/* Cartes lues en entier à l'initialisation puis libérées */
+		inputs = (flag6->answer ? 2.0 * cells * sizeof(CELL) : 0.0) + ((method==1||method==3) ? 3.0 * cells * sizeof(DCELL) : 0.0);
+		if(inputs > 0.0)
+			AddMemoryItem("cartes lues a l initialisation", inputs, MEM_EXACT);
+		inputs /= 1048576.;
+		
+		/* Tampons des fils de lecture des cartes des paramètres (createSEGMENT), libérés avant l'initialisation */
+		reading = (parm_rec.nfields + 2.0) * maxReadRows * ncols * sizeof(DCELL);
+		AddMemoryItem("lecture des cartes des parametres", reading, MEM_EXACT);
+		reading /= 1048576.;
+
+		/* depressions=fill : altitudes de la grille, puis états, files et distances du conditionnement (libérés avant la recherche des bassins) */
+		flood = 0.0;
+		if(method>0 && depression_mode==DEPRESSIONS_FILL){
+			flood = (double)nrows * ncols * (sizeof(double) + 1 + sizeof(uint32_t) + 2 * sizeof(int));
+			AddMemoryItem("conditionnement des altitudes", flood, MEM_ESTIMATE);
+		}
+		flood /= 1048576.;
+
+		search = push = lists = 0.0;
+		if(method>0){
+			/* File et noeuds du front de la recherche d'un bassin, et marques des cellules avec search=dijkstra */
+			if(search_mode==SEARCH_DIJKSTRA)
+				search = cells * (sizeof(uint32_t) + sizeof(int)) + 2.0 * ((double)nrows + ncols) * (sizeof(node) + sizeof(int) + sizeof(HeapEntry) + sizeof(int));
+			else
+				search = maxElements * sizeof(void *) + 2.0 * ((double)nrows + ncols) * sizeof(node);
+			AddMemoryItem("recherche des bassins", search, MEM_ESTIMATE);
+			search /= 1048576.;
+
+			lists = cells * ncomp * MallocChunk((1.0 + CONTRIB_PATH * MIN(nrows, ncols)) * sizeof(contrib)) / 1048576.;
+
+			/* routing=push : fonctions de réponse sortantes et anneaux des apports futurs */
+			if(method>1 && routing_mode==1){
+				push = cells * (1.0 + CONTRIB_PATH * MIN(nrows, ncols)) * sizeof(outkernel);
+				AddMemoryItem("fonctions de reponse sortantes", push, MEM_ESTIMATE);
+				push /= 1048576.;
+				AddMemoryItem("anneaux des apports de subsurface", cells * 2.0 * num_inputs * sizeof(real), MEM_BOUND);
 			}
-	// Fixe les valeurs nulles
-	Rast_set_d_null_value(&dnullval, 1);
-	//Esquive les valeurs nulles ??
-	skip_nulls = Rast_is_d_null_value(&null_val);
-
-	total_cells = nrows * ncols;
-
-	    for (row = 0; row < nrows; row++) {
-		
-	    G_percent(row, nrows, 2);
-		
-			Rast_get_row(sat_fd, sat_cell, row, sat_data_type);
-		//if( Rast_get_row(sat_fd, sat_cell, row, sat_data_type) < 0 )
-			//G_fatal_error(_("Impossible de lire la carte raster <%s> ligne %d"), parm.sat->answer, row);
-			Rast_get_row(fc_fd, fc_cell, row, fc_data_type);
-		//if( Rast_get_row(fc_fd, fc_cell, row, fc_data_type) < 0 )
-			//G_fatal_error(_("Impossible de lire la carte raster <%s> ligne %d"), parm.fc->answer, row);
-			Rast_get_row(rum_fd, rum_cell, row, rum_data_type);
-		//if( Rast_get_row(rum_fd, rum_cell, row, rum_data_type) < 0 )
-			//G_fatal_error(_("Impossible de lire la carte raster <%s> ligne %d"), parm.rum->answer, row);
-			Rast_get_row(depth_fd, depth_cell, row, depth_data_type);
-		//if( Rast_get_row(depth_fd, depth_cell, row, depth_data_type) < 0 )
-			//G_fatal_error(_("Impossible de lire la carte raster <%s> ligne %d"), parm.depth->answer, row);
-	    	
+			if(method>1)
+				AddMemoryItem("evenements d eau en exces", cells * num_inputs * (double)sizeof(EventBlock) / EVENT_BLOCK, MEM_BOUND);
+		}
+
+		/* Ce qui reste pour les contributeurs et le cache du fichier segmenté */
+		avail = maxmem - base - search - push;
+		if(avail < 10.0)
+			avail = 10.0;
+		pq_mb = search;
+
+		tile_mb = 0.0;
+		mem_plan.auto_tiles = 0;
+		mem_plan.contrib_budget_mb = 0.0;
 		if(method>0){
-			Rast_get_row(alt_fd, alt_cell, row, alt_data_type);
-			//if( Rast_get_row(alt_fd, alt_cell, row, alt_data_type) < 0 )
-				//G_fatal_error(_("Impossible de lire la carte raster <%s> ligne %d"), parm.altitude->answer, row);
-				Rast_get_row(pwp_fd, pwp_cell, row, pwp_data_type);
-			//if( Rast_get_row(pwp_fd, pwp_cell, row, pwp_data_type) < 0 )
-				//G_fatal_error(_("Impossible de lire la carte raster <%s> ligne %d"), parm.pwp->answer, row);
-				Rast_get_row(slope_fd, slope_cell, row, slope_data_type);
-			//if( Rast_get_row(slope_fd, slope_cell, row, slope_data_type) < 0 )
-				//G_fatal_error(_("Impossible de lire la carte raster <%s> ligne %d"), parm.slope->answer, row);
+			AddMemoryItem("listes de contributeurs", lists * 1048576., MEM_ESTIMATE);
+			if(flag8->answer){
+				/* Calcul hors mémoire : la moitié de la mémoire restante est réservée au cache des tuiles de contributeurs */
+				tile_mb = avail / 2;
+				AddMemoryItem("cache des tuiles de contributeurs", tile_mb * 1048576., MEM_EXACT);
+				seg_mb 	= avail - tile_mb;
+				lists 	= lists * MIN(TILE_SIZE, nrows) / nrows + tile_mb;
+			}
+			else {
+				/* Les listes gardent au plus la moitié de la mémoire restante : au-delà, Init() passe hors mémoire
+				   en cours de recherche des bassins, le nombre réel de contributeurs dépendant du relief */
+				mem_plan.contrib_budget_mb = avail / 2;
+				lists 	= MIN(lists, avail / 2);
+				seg_mb 	= avail - lists;
+			}
 		}
+		else seg_mb = avail;
+		if(seg_mb < 10.0)
+			seg_mb = 10.0;
+		mem_plan.segment_budget_mb = seg_mb;
+
+		/* Géométrie des segments selon l'accès de chaque phase : les bassins de drainage sont
+		   parcourus en tuiles carrées, tout le reste ligne par ligne en bandes pleine largeur.
+		   Le fichier est écrit en bandes sans bassins, ou si une rangée de tuiles carrées ne
+		   tient pas en mémoire ; il est recopié dans l'autre géométrie entre les phases. */
+		side 		= ((double) nrows * ncols > 200000000) ? SEGCOLSIZE / 2 : SEGCOLSIZE;
+		seg_square 	= PlanSegmentGeometry(nrows, ncols, side, parm_rec.size, seg_mb, SEG_SQUARE);
+		seg_strip 	= PlanSegmentGeometry(nrows, ncols, side, parm_rec.size, seg_mb, SEG_STRIP);
+		seg_geom 	= (method==0 || seg_square.in_memory < seg_square.ncolseg) ? seg_strip : seg_square;
+		srows 				= seg_geom.srows;
+		scols 				= seg_geom.scols;
+		nseg 				= seg_geom.nseg;
+		segments_in_memory 	= seg_geom.in_memory;
+		/* Les deux géométries sont allouées le temps d'une copie */
+		seg_mb = (method==0) ? seg_strip.mem_mb : seg_square.mem_mb + seg_strip.mem_mb;
+		AddMemoryItem("cache du fichier segmente", seg_mb * 1048576., MEM_EXACT);
+
+		/* Pics : les tampons de lecture sont libérés avant l'initialisation, ses cartes avant le conditionnement des altitudes */
+		mem_plan.init_mb 	= base + seg_mb + MAX(MAX(inputs, reading), flood);
+		mem_plan.process_mb = base + seg_mb + search + push + lists;
+		mem_mb = MAX(mem_plan.init_mb, mem_plan.process_mb);
+
+		if(mem_mb > maxmem)
+			G_warning(_("Le calcul demande environ %.0f MB de memoire, plus que les %d MB de memory="), mem_mb, maxmem);
+	}
+
+	/* ******************************************************************* */
+	/* Lit / écrit les paramètres d'une cellule ou d'une ligne du fichier  */
+	/* segmenté. Les champs non stockés de struct Parm ne sont pas modifiés */
+	/* ******************************************************************* */
+	
+	static inline void UnpackParm(const unsigned char *rec, struct Parm *p){
+	
+	const struct SoilClass *s;
+	double depth;
+	int f;
+	
+		for (f = 0; f < parm_rec.nfields; f++)
+			memcpy((char *)p + parm_rec.offset[f], rec + parm_rec.pos[f], sizeof(real));
 		
-		if(method==1||method==3){
-			Rast_get_row(speed_sf_fd, speed_sf_cell, row, speed_sf_data_type);
-			//if( Rast_get_row(speed_sf_fd, speed_sf_cell, row, speed_sf_data_type) < 0 )
-				//G_fatal_error(_("Impossible de lire la carte raster <%s> ligne %d"), parm.flow_speeds->answers[0], row);
-			Rast_get_row(disp_sf_fd, disp_sf_cell, row, disp_sf_data_type);
-			//if( Rast_get_row(disp_sf_fd, disp_sf_cell, row, disp_sf_data_type) < 0 )
-				//G_fatal_error(_("Impossible de lire la carte raster <%s> ligne %d"), parm.flow_disps->answers[0], row);
+		if(parm_rec.soil){
+			memcpy(&p->soil, rec, sizeof(uint16_t));
+			s 		= &soil_classes[p->soil];
+			depth 	= parm_rec.cell_depth ? p->depth : s->depth;
+			for (f = 0; f < parm_rec.ntable; f++)
+				*(real *)((char *)p + parm_rec.table_offset[f]) = *(const double *)((const char *)s + parm_rec.table_class[f])
+																  * (parm_rec.table_convert[f] ? depth : 1.0);
 		}
-		if(method>1){
-			Rast_get_row(speed_ssf_fd, speed_ssf_cell, row, speed_ssf_data_type);
-			//if( Rast_get_row(speed_ssf_fd, speed_ssf_cell, row, speed_ssf_data_type) < 0 )
-				//G_fatal_error(_("Impossible de lire la carte raster <%s> ligne %d"), parm.flow_speeds->answers[1], row);
-				Rast_get_row(disp_ssf_fd, disp_ssf_cell, row, disp_ssf_data_type);
-			//if( Rast_get_row(disp_ssf_fd, disp_ssf_cell, row, disp_ssf_data_type) < 0 )
-				//G_fatal_error(_("Impossible de lire la carte raster <%s> ligne %d"), parm.flow_disps->answers[1], row);
-				Rast_get_row(ksat_fd, ksat_cell, row, ksat_data_type);
-			//if( Rast_get_row(ksat_fd, ksat_cell, row, ksat_data_type) < 0 )
-				//G_fatal_error(_("Impossible de lire la carte raster <%s> ligne %d"), parm.ksat->answer, row);
+	}
+	
+	void ParmGet(int row, int col, struct Parm *p){
+		if(pager)
+			PageCell(pager, row, col, 0);
+		Segment_get(&parms_seg, parm_rec.cell, row, col);
+		UnpackParm(parm_rec.cell, p);
+	}
+	
+	void ParmPut(int row, int col, const struct Parm *p){
+	
+	int f;
+	
+		if(parm_rec.soil)
+			memcpy(parm_rec.cell, &p->soil, sizeof(uint16_t));
+		for (f = 0; f < parm_rec.nfields; f++)
+			memcpy(parm_rec.cell + parm_rec.pos[f], (const char *)p + parm_rec.offset[f], sizeof(real));
+		if(pager)
+			PageCell(pager, row, col, 1);
+		Segment_put(&parms_seg, parm_rec.cell, row, col);
+		parm_rec.dirty = 1;
+	}
+	
+	void ParmGetRow(int row, struct Parm *p){
+	
+	int c;
+	
+		if(!parm_rec.row)
+			parm_rec.row = (unsigned char *)G_malloc(ncols * parm_rec.size);
+		/* Segment_get_row() lit le fichier sans passer par le cache : les écritures de ParmPut y sont d'abord reportées */
+		if(parm_rec.dirty){
+			Segment_flush(&parms_seg);
+			parm_rec.dirty = 0;
 		}
-		
-	    // INPUT NULL VALUES: ???
+		if(pager)
+			PageRow(pager, 0);
+		Segment_get_row(&parms_seg, parm_rec.row, row);
+		for (c = 0; c < ncols; c++)
+			UnpackParm(parm_rec.row + (size_t)c * parm_rec.size, &p[c]);
+	}
+	
+	void FreeParmRecord(void){
+		G_free(parm_rec.cell);
+		G_free(parm_rec.row);
+		parm_rec.cell = parm_rec.row = NULL;
+		G_free(soil_classes);
+		soil_classes = NULL;
+	}
+	
+	/* ******************************************************************** */
+	/* Paramètres lus par createSEGMENT : chacun vient d'une carte, ou de   */
+	/* la table des classes de sol quand soil= remplace sa carte. Seuls les */
+	/* champs stockés et la profondeur qui les convertit sont lus.          */
+	/* ******************************************************************** */
+	
+	/* Lecture des cartes par un fil par carte, ou dans le fil principal pour comparer les performances */
+	#ifdef WB_SERIAL_INGEST
+	#define INGEST_THREADS 0
+	#else
+	#define INGEST_THREADS 1
+	#endif
+	#define INGEST_PARMS 10
+	
+	static struct IngestParm
+	{
+		size_t offset;											/* Champ de struct Parm */
+		const char *key;										/* Option de la carte (messages) */
+		char *map;												/* Carte du paramètre, NULL sans carte */
+		long table;												/* Champ de struct SoilClass, -1 hors sol */
+		double scale;											/* Conversion d'unités */
+		int single;												/* Arrondi en simple précision (altitude) */
+		int convert;											/* Teneur en eau : multipliée par la profondeur */
+		int stored;												/* Champ de l'enregistrement, -1 s'il n'est pas stocké */
+		int used;												/* Le paramètre est lu */
+		int lane;												/* Voie du lecteur, -1 sans carte */
+		double *v;												/* Valeurs de la ligne */
+	}ingest[INGEST_PARMS];
+	static int ningest;
+	
+	static void AddIngestParm(size_t offset, const char *key, char *map, long table, double scale, int single, int convert){
+	
+	struct IngestParm *p = &ingest[ningest++];
+	int f;
+	
+		p->offset 	= offset;
+		p->key 		= key;
+		p->map 		= map;
+		p->table 	= table;
+		p->scale 	= scale;
+		p->single 	= single;
+		p->convert 	= convert;
+		p->stored 	= -1;
+		for (f = 0; f < parm_rec.nfields; f++)
+			if(parm_rec.offset[f] == offset)
+				p->stored = f;
+		p->used 	= (p->stored >= 0);
+		p->lane 	= -1;
+		p->v 		= NULL;
+	}
+	
+	/* ******************************************************************** */
+	/* Classes de sol d'une ligne de la carte soil= (lue en DCELL). Les      */
+	/* cellules nulles reçoivent la classe nulle.                            */
+	/* ******************************************************************** */
+	
+	void SoilClassRow(const DCELL *v, uint16_t *soil, int n){
+	
+	CELL id;
+	int c;
+	
+		for (c = 0; c < n; c++){
+			if(Rast_is_d_null_value(&v[c])){
+				soil[c] = (uint16_t)nsoil_classes;
+				continue;
+			}
+			id = (CELL)v[c];
+			if(id < 0 || id >= nsoil_classes || !soil_classes[id].defined)
+				G_fatal_error(_("La classe de sol %d de la carte <%s> est absente de la table <%s>"), id, parm.soil->answer, parm.soil_table->answer);
+			soil[c] = (uint16_t)id;
+		}
+	}
+	
+	/* ******************************************************************** */
+	/* Crée et écrit le fichier segmenté. Chaque carte est décodée en DCELL */
+	/* par un fil de lecture (Reader.c), les cellules nulles valant la      */
+	/* valeur nulle DCELL ; les conversions sont faites sur toute la ligne, */
+	/* puis ses enregistrements sont assemblés et écrits d'un bloc.         */
+	/* ******************************************************************** */
 
-		ptr2 = sat_cell;
-		ptr3 = fc_cell;
-		ptr4 = rum_cell;
-	    ptr7 = depth_cell;
+	void createSEGMENT(){
 
+	struct IngestParm *p, *depth;
+	RowReader *reader;
+	DCELL *rows[INGEST_PARMS + 1];
+	uint16_t *soil = NULL;
+	unsigned char *rec;
+	int fds[INGEST_PARMS + 1];
+	int nlanes = 0, soil_lane = -1;
+	int k, c;
+	size_t size = parm_rec.size;
+	double t0, t_start, pack_time = 0.0, write_time = 0.0;
+	real x;
+	
+		G_verbose_message(_("Cree un fichier temporaire..."));
+		
+		if (Segment_open(&parms_seg, G_tempfile(), nrows, ncols, srows, scols, parm_rec.size, segments_in_memory) != 1)
+			G_fatal_error(_("Ne peux pas creer le fichier temporaire"));
+		parm_rec.cell = (unsigned char *)G_malloc(parm_rec.size);
+		if(!parm_rec.row)
+			parm_rec.row = (unsigned char *)G_malloc(ncols * parm_rec.size);
+		if(flag7->answer)
+			pager = CreatePageShadow(seg_geom, parm_rec.size);
+		
+		/* Paramètres et conversions d'unités (la pente et ksat ne sont pas stockés) */
+		ningest = 0;
+		AddIngestParm(offsetof(struct Parm, sat), parm.sat->key, parm.sat->answer, offsetof(struct SoilClass, sat), 1.0, 0, 1);
+		AddIngestParm(offsetof(struct Parm, fc), parm.fc->key, parm.fc->answer, offsetof(struct SoilClass, fc), 1.0, 0, 1);
+		AddIngestParm(offsetof(struct Parm, rum), parm.rum->key, parm.rum->answer, offsetof(struct SoilClass, rum), 1.0, 0, 0);
+		AddIngestParm(offsetof(struct Parm, depth), parm.depth->key, parm.depth->answer, offsetof(struct SoilClass, depth), 1.0, 0, 0);
+		depth = &ingest[ningest - 1];
 		if(method>0){
-			ptr  = alt_cell;		
-			ptr5 = pwp_cell;
-			ptr6 = slope_cell;
+			AddIngestParm(offsetof(struct Parm, altitude), parm.altitude->key, parm.altitude->answer, -1, 1.0, 1, 0);
+			AddIngestParm(offsetof(struct Parm, pwp), parm.pwp->key, parm.pwp->answer, offsetof(struct SoilClass, pwp), 1.0, 0, 1);
 		}
 		if(method==1||method==3){
-			ptr8 = speed_sf_cell;
-			ptr9 = disp_sf_cell;
+			AddIngestParm(offsetof(struct Parm, flow_speeds[0]), parm.flow_speeds->key, parm.flow_speeds->answers[0], -1, SECOND_TO_HOUR, 0, 0);
+			AddIngestParm(offsetof(struct Parm, flow_disps[0]), parm.flow_disps->key, parm.flow_disps->answers[0], -1, SECOND_TO_HOUR, 0, 0);
 		}
 		if(method>1){
-			ptr10= speed_ssf_cell;
-			ptr11= disp_ssf_cell;
-			ptr12= ksat_cell;
-		}
-	        for (col = 0; col < ncols; col++){
-  
-	            if (Rast_is_null_value(ptr2, sat_data_type)){
-	                p_sat = null_val;
-	                if (skip_nulls && !Rast_is_null_value(ptr2, sat_data_type)) total_cells--;
-	            }
-	            else{
-						switch (sat_data_type){
-					  
-						case CELL_TYPE:
-	                        p_sat = *(CELL *)ptr2;
-	                        break;
-						case FCELL_TYPE:
-	                        p_sat = *(FCELL *)ptr2;
-	                        break;
-						case DCELL_TYPE:
-	                        p_sat = *(DCELL *)ptr2;
-	                        break;
-	                    }
-	                }
-	                parms.sat = p_sat;
-					
-				if (Rast_is_null_value(ptr3, fc_data_type)){
-	                p_fc = null_val;
-	                if (skip_nulls && !Rast_is_null_value(ptr3, fc_data_type)) total_cells--;
-	            }
-	            else{
-				    	switch (fc_data_type){
-						
-						case CELL_TYPE:
-	                        p_fc = *(CELL *)ptr3;
-	                        break;
-	                    case FCELL_TYPE:
-	                        p_fc = *(FCELL *)ptr3;
-	                        break;
-	                    case DCELL_TYPE:
-	                        p_fc = *(DCELL *)ptr3;
-	                        break;
-	                    }
-	                }
-	                parms.fc = p_fc;
-					
-				if (Rast_is_null_value(ptr4, rum_data_type)){
-	                p_rum = null_val;
-	                if (skip_nulls && !Rast_is_null_value(ptr4, rum_data_type)) total_cells--;
+			/* La carte de subsurface est la seule donnée pour method=subsurface_account, la seconde pour full_account */
+			AddIngestParm(offsetof(struct Parm, flow_speeds[1]), parm.flow_speeds->key, parm.flow_speeds->answers[method==3], -1, DAY_TO_HOUR, 0, 0);
+			AddIngestParm(offsetof(struct Parm, flow_disps[1]), parm.flow_disps->key, parm.flow_disps->answers[method==3], -1, DAY_TO_HOUR, 0, 0);
+		}
+		
+		/* La profondeur est lue si elle convertit une teneur en eau stockée */
+		for (k = 0; k < ningest; k++)
+			if(ingest[k].convert && ingest[k].stored >= 0)
+				depth->used = 1;
+		
+		/* Une voie du lecteur par carte lue ; sans carte, le paramètre est lu dans la table des classes */
+		for (k = 0; k < ningest; k++){
+			p = &ingest[k];
+			if(!p->used)
+				continue;
+			if(p->map){
+				p->lane 		= nlanes;
+				fds[nlanes++] 	= openLayer(p->map);
+			}
+			else if(p->table >= 0 && parm_rec.soil)
+				p->v = (double *)G_malloc(ncols * sizeof(double));
+			else
+				G_fatal_error(_("La carte %s= est requise par la methode de calcul choisie"), p->key);
+		}
+		if(parm_rec.soil){
+			soil_lane 		= nlanes;
+			fds[nlanes++] 	= openLayer(parm.soil->answer);
+			soil 			= (uint16_t *)G_malloc(ncols * sizeof(uint16_t));
+		}
+		
+		reader 	= CreateRowReader(fds, nlanes, nrows, ncols, INGEST_THREADS);
+		t_start = TimeNow();
+		
+	    for (row = 0; row < nrows; row++){
+			
+			G_percent(row, nrows, 2);
+			
+			ReaderGetRows(reader, rows);
+			t0 = TimeNow();
+			
+			if(soil)
+				SoilClassRow(rows[soil_lane], soil, ncols);
+			
+			/* Valeurs de la ligne dans les unités du module, arrondies comme les champs de struct Parm
+			   (les valeurs nulles restent nulles) */
+			for (k = 0; k < ningest; k++){
+				p = &ingest[k];
+				if(!p->used)
+					continue;
+				if(p->lane >= 0){
+					p->v = rows[p->lane];
+					if(p->scale != 1.0)
+						for (c = 0; c < ncols; c++)
+							p->v[c] *= p->scale;
+					if(p->single)
+						for (c = 0; c < ncols; c++)
+							p->v[c] = (float)p->v[c];
 				}
-				else{
-				    	switch (rum_data_type){
-						
-						case CELL_TYPE:
-	                        p_rum = *(CELL *)ptr4;
-	                        break;
-	                    case FCELL_TYPE:
-	                        p_rum = *(FCELL *)ptr4;
-	                        break;
-	                    case DCELL_TYPE:
-	                        p_rum = *(DCELL *)ptr4;
-	                        break;
-	                    }
-	                }
-	                parms.rum = p_rum;				
-
-				if (Rast_is_null_value(ptr7, depth_data_type)){
-	                p_depth = null_val;
-	                if (skip_nulls && !Rast_is_null_value(ptr7, depth_data_type)) total_cells--;
+				else
+					for (c = 0; c < ncols; c++)
+						p->v[c] = *(const double *)((const char *)&soil_classes[soil[c]] + p->table);
+				for (c = 0; c < ncols; c++)
+					p->v[c] = (real)p->v[c];
+			}
+			
+			//Convertit les teneurs en eau en hauteur d'eau mm (m3.m-3 -> mm).
+			for (k = 0; k < ningest; k++){
+				p = &ingest[k];
+				if(p->convert && p->stored >= 0)
+					for (c = 0; c < ncols; c++)
+						p->v[c] *= depth->v[c];
+			}
+			
+			//Assemble les enregistrements de la ligne : classe de sol puis champs stockés
+			if(soil)
+				for (c = 0; c < ncols; c++)
+					memcpy(parm_rec.row + (size_t)c * size, &soil[c], sizeof(uint16_t));
+			for (k = 0; k < ningest; k++){
+				p = &ingest[k];
+				if(p->stored < 0)
+					continue;
+				rec = parm_rec.row + parm_rec.pos[p->stored];
+				for (c = 0; c < ncols; c++){
+					x = (real)p->v[c];
+					memcpy(rec + (size_t)c * size, &x, sizeof(real));
 				}
-				else{
-				    	switch (depth_data_type){
-						
-						case CELL_TYPE:
-	                        p_depth = *(CELL *)ptr7;
-	                        break;
-	                    case FCELL_TYPE:
-	                        p_depth = *(FCELL *)ptr7;
-	                        break;
-	                    case DCELL_TYPE:
-	                        p_depth = *(DCELL *)ptr7;
-	                        break;
-	                    }
-	                }
-	                parms.depth = p_depth;					
+			}
+			ReaderReleaseRows(reader);
+			pack_time += TimeNow() - t0;
+			
+			t0 = TimeNow();
+			if(pager)
+				PageRow(pager, 1);
+			Segment_put_row(&parms_seg, parm_rec.row, row);
+			write_time += TimeNow() - t0;
+		}
+		G_percent(1, 1, 1);
+		
+		if(flag7->answer){
+			ReaderReport(reader, TimeNow() - t_start);
+			G_message(_("Conversion et assemblage des enregistrements: %.2fs, ecriture du fichier segmente: %.2fs"), pack_time, write_time);
+		}
+		DestroyRowReader(reader);
+		for (k = 0; k < ningest; k++)
+			if(ingest[k].used && ingest[k].lane < 0)
+				G_free(ingest[k].v);
+		G_free(soil);
+	}
 	
-	if(method>0){
-					
-	            if (Rast_is_null_value(ptr, alt_data_type)){
-	                p_alt = null_val;
-	                if (skip_nulls && !Rast_is_null_value(ptr, alt_data_type)) total_cells--;
-	            }
-	            else{
-						switch (alt_data_type){
-					  
-						case CELL_TYPE:
-	                        p_alt = *(CELL *)ptr;
-	                        break;
-						case FCELL_TYPE:
-							p_alt = *(FCELL *)ptr;
-							break;
-						case DCELL_TYPE:
-	                        p_alt = *(DCELL *)ptr;
-	                        break;
-	                    }
-					}
-	                parms.altitude = p_alt;					
-
-				if (Rast_is_null_value(ptr5, pwp_data_type)){
-	                p_pwp = null_val;
-	                if (skip_nulls && !Rast_is_null_value(ptr5, pwp_data_type)) total_cells--;
-				}
-				else{
-				    	switch (pwp_data_type){
-						
-						case CELL_TYPE:
-	                        p_pwp = *(CELL *)ptr5;
-	                        break;
-	                    case FCELL_TYPE:
-	                        p_pwp = *(FCELL *)ptr5;
-	                        break;
-	                    case DCELL_TYPE:
-	                        p_pwp = *(DCELL *)ptr5;
-	                        break;
-	                    }
-	                }
-	                parms.pwp = p_pwp;
-
-				if (Rast_is_null_value(ptr6, slope_data_type)){
-	                p_slope = null_val;
-	                if (skip_nulls && !Rast_is_null_value(ptr6, slope_data_type)) total_cells--;
-				}
-				else{
-				    	switch (slope_data_type){
-						
-						case CELL_TYPE:
-	                        p_slope = *(CELL *)ptr6;
-	                        break;
-	                    case FCELL_TYPE:
-	                        p_slope = *(FCELL *)ptr6;
-	                        break;
-	                    case DCELL_TYPE:
-	                        p_slope = *(DCELL *)ptr6;
-	                        break;
-	                    }
-	                }
-	                parms.tanslope = tan(p_slope);
-
-	}
-	
-	if(method==1||method==3){
-	
-				if (Rast_is_null_value(ptr8, speed_sf_data_type)){
-	                p_speed_sf = null_val;
-	                if (skip_nulls && !Rast_is_null_value(ptr8, speed_sf_data_type)) total_cells--;
-				}
-				else{
-				    	switch (speed_sf_data_type){
-						
-						case CELL_TYPE:
-	                        p_speed_sf = *(CELL *)ptr8;
-							p_speed_sf*= SECOND_TO_HOUR;
-	                        break;
-	                    case FCELL_TYPE:
-	                        p_speed_sf = *(FCELL *)ptr8;
-							p_speed_sf*= SECOND_TO_HOUR;							
-	                        break;
-	                    case DCELL_TYPE:
-	                        p_speed_sf = *(DCELL *)ptr8;
-							p_speed_sf*= SECOND_TO_HOUR;							
-	                        break;
-	                    }
-	                }
-	                parms.flow_speeds[1] = p_speed_sf;
-					
-				if (Rast_is_null_value(ptr9, disp_sf_data_type)){
-	                p_disp_sf = null_val;
-	                if (skip_nulls && !Rast_is_null_value(ptr9, disp_sf_data_type)) total_cells--;
-				}
-				else{
-				    	switch (disp_sf_data_type){
-						
-						case CELL_TYPE:
-	                        p_disp_sf = *(CELL *)ptr9;
-							p_disp_sf*= SECOND_TO_HOUR;							
-	                        break;
-	                    case FCELL_TYPE:
-	                        p_disp_sf = *(FCELL *)ptr9;
-							p_disp_sf*= SECOND_TO_HOUR;							
-	                        break;
-	                    case DCELL_TYPE:
-	                        p_disp_sf = *(DCELL *)ptr9;
-							p_disp_sf*= SECOND_TO_HOUR;							
-	                        break;
-	                    }
-	                }
-	                parms.flow_disps[1] = p_disp_sf;
-	}
-	
-	if(method>1){
-	
-				if (Rast_is_null_value(ptr10, speed_ssf_data_type)){
-	                p_speed_ssf = null_val;
-	                if (skip_nulls && !Rast_is_null_value(ptr10, speed_ssf_data_type)) total_cells--;
-				}
-				else{
-				    	switch (speed_ssf_data_type){
-						
-						case CELL_TYPE:
-	                        p_speed_ssf = *(CELL *)ptr10;
-							p_speed_ssf*= DAY_TO_HOUR;
-	                        break;
-	                    case FCELL_TYPE:
-	                        p_speed_ssf = *(FCELL *)ptr10;
-							p_speed_ssf*= DAY_TO_HOUR;							
-	                        break;
-	                    case DCELL_TYPE:
-	                        p_speed_ssf = *(DCELL *)ptr10;
-							p_speed_ssf*= DAY_TO_HOUR;							
-	                        break;
-	                    }
-	                }
-	                parms.flow_speeds[2] = p_speed_ssf;
-					
-				if (Rast_is_null_value(ptr11, disp_ssf_data_type)){
-	                p_disp_ssf = null_val;
-	                if (skip_nulls && !Rast_is_null_value(ptr11, disp_ssf_data_type)) total_cells--;
-				}
-				else{
-				    	switch (disp_ssf_data_type){
-						
-						case CELL_TYPE:
-	                        p_disp_ssf = *(CELL *)ptr11;
-							p_disp_ssf*= DAY_TO_HOUR;							
-	                        break;
-	                    case FCELL_TYPE:
-	                        p_disp_ssf = *(FCELL *)ptr11;
-							p_disp_ssf*= DAY_TO_HOUR;							
-	                        break;
-	                    case DCELL_TYPE:
-	                        p_disp_ssf = *(DCELL *)ptr11;
-							p_disp_ssf*= DAY_TO_HOUR;							
-	                        break;
-	                    }
-	                }
-	                parms.flow_disps[2] = p_disp_ssf;					
-					
-				if (Rast_is_null_value(ptr12, ksat_data_type)){
-	                p_ksat = null_val;
-	                if (skip_nulls && !Rast_is_null_value(ptr12, ksat_data_type)) total_cells--;
-				}
-				else{
-				    	switch (ksat_data_type){
-						
-						case CELL_TYPE:
-	                        p_ksat = *(CELL *)ptr12;
-	                        break;
-	                    case FCELL_TYPE:
-	                        p_ksat = *(FCELL *)ptr12;
-	                        break;
-	                    case DCELL_TYPE:
-	                        p_ksat = *(DCELL *)ptr12;
-	                        break;
-	                    }
-	                }
-	                parms.ksat = p_ksat;
-	}
-	
-					//Convertit les teneurs en eau en hauteur d'eau mm (m3.m-3 -> mm).
-					parms.sat*= parms.depth;
-					parms.fc *= parms.depth;
-					
-					if(method>0)
-						parms.pwp*= parms.depth;
-					
-					//parms.flow_speeds[1] = (5./3.)*p_speed_sf;					
-					//parms.flow_disps[1] = (p_speed_sf * p_rh) / (2. * p_slope);	
+	/* ********************************************************************* */
+	/* Recopie le fichier segmenté dans la géométrie demandée (SEG_SQUARE ou */
+	/* SEG_STRIP) avant une phase qui le parcourt autrement. Le nouveau      */
+	/* fichier est rempli ligne par ligne puis remplace l'ancien.            */
+	/* ********************************************************************* */
 	
-					//parms.flow_speeds[2] = ( (sin(p_slope) * RAD_TO_DEG) * p_ksat ) / (p_sat-p_fc);					
-					//parms.flow_disps[2] = ( (sin(p_slope) * RAD_TO_DEG) * p_ksat * p_depth * RES ) / ( (p_sat-p_fc) * (sin(p_slope) * RAD_TO_DEG) * RES );
-					
-					//Assigne les valeurs 
-	                Segment_put(&parms_seg, &parms, row, col);
-					
-					//Incrémente les pointeurs
-	                ptr2 = G_incr_void_ptr(ptr2, sat_dsize);
-					ptr3 = G_incr_void_ptr(ptr3, fc_dsize);
-					ptr4 = G_incr_void_ptr(ptr4, rum_dsize);
-					ptr7 = G_incr_void_ptr(ptr7, depth_dsize);
-					
-					if(method>0){
-						ptr  = G_incr_void_ptr(ptr,  alt_dsize);					
-						ptr5 = G_incr_void_ptr(ptr5, pwp_dsize);
-						ptr6 = G_incr_void_ptr(ptr6, slope_dsize);
-					}
-					if(method==1||method==3){
-						ptr8 = G_incr_void_ptr(ptr8, speed_sf_dsize);
-						ptr9 = G_incr_void_ptr(ptr9, disp_sf_dsize);
-					}
-					if(method>1){
-						ptr10= G_incr_void_ptr(ptr10, speed_ssf_dsize);
-						ptr11= G_incr_void_ptr(ptr11, disp_ssf_dsize);					
-						ptr12= G_incr_void_ptr(ptr12, ksat_dsize);
-					}
-	            }
-	        }
+	void RetileSEGMENT(int shape){
 	
-		G_free(sat_cell);
-		G_free(fc_cell);
-		G_free(rum_cell);
-		G_free(depth_cell);
+	SEGMENT seg;
+	SegmentGeometry g = (shape==SEG_SQUARE) ? seg_square : seg_strip;
+	int r;
+	
+		if(g.srows==seg_geom.srows && g.scols==seg_geom.scols)
+			return;
+		/* Une seule rangée de tuiles ne gagne rien à être recopiée en bandes */
+		if(shape==SEG_STRIP && seg_geom.ncolseg==1)
+			return;
 		
-		if(method>0){	
-			G_free(alt_cell);		
-			G_free(pwp_cell);
-			G_free(slope_cell);
-		}
-		if(method==1||method==3){
-			G_free(speed_sf_cell);
-			G_free(disp_sf_cell);
-		}
-		if(method>1){
-			G_free(speed_ssf_cell);
-			G_free(disp_ssf_cell);		
-			G_free(ksat_cell);
+		G_verbose_message(_("Recopie le fichier segmente en %s de %dx%d cellules..."), (shape==SEG_SQUARE) ? "tuiles" : "bandes", g.srows, g.scols);
+		
+		if (Segment_open(&seg, G_tempfile(), nrows, ncols, g.srows, g.scols, parm_rec.size, g.in_memory) != 1)
+			G_fatal_error(_("Ne peux pas creer le fichier temporaire"));
+		if(!parm_rec.row)
+			parm_rec.row = (unsigned char *)G_malloc(ncols * parm_rec.size);
+		
+		Segment_flush(&parms_seg);
+		parm_rec.dirty = 0;
+		for (r = 0; r < nrows; r++){
+			Segment_get_row(&parms_seg, parm_rec.row, r);
+			Segment_put_row(&seg, parm_rec.row, r);
 		}
-		G_percent(1, 1, 1);
+		Segment_close(&parms_seg);
+		parms_seg = seg;
+		
+		if(pager)
+			PageShadowRetile(pager, g);
+		seg_geom 			= g;
+		srows 				= g.srows;
+		scols 				= g.scols;
+		nseg 				= g.nseg;
+		segments_in_memory 	= g.in_memory;
 	}
 
 	/* *********************************************************** */
@@ -1172,7 +1436,7 @@
 	static int indice;
 	char *buf;
 		indice = find_output_name(output_name);
-		if(asprintf(&buf, "%s%d%s",menu_outputs[indice].name, n+1, menu[method].suffix)<0)
+		if(asprintf(&buf, "%s%d%s",menu_outputs[indice].name, t_offset+n+1, menu[method].suffix)<0)
 			fprintf(stderr, "Allocation de memoire lors de la creation du nom de raster de sortie a echoue\n");
 		return buf;
 	}
@@ -1246,6 +1510,86 @@
 			return -1;
 		}	
 
+	/* ******************************************************************************** */
+	/* Détecte la méthode d'évaluation des fonctions de réponse sur un pas de temps    */
+	/* ******************************************************************************** */
+	
+	static int find_kernel_method(const char *kernel_name){
+		int indice;
+
+			for (indice = 0; menu_kernel[indice].name; indice++)
+				if (strcmp(menu_kernel[indice].name, kernel_name) == 0)
+					return indice;
+		
+			G_fatal_error(_("Methode <%s> inconnue"), kernel_name);
+		
+			return -1;
+		}	
+
+	/* ************************************************************** */
+	/* Détecte la méthode de calcul du ruissellement de subsurface    */
+	/* ************************************************************** */
+	
+	static int find_routing_method(const char *routing_name){
+		int indice;
+
+			for (indice = 0; menu_routing[indice].name; indice++)
+				if (strcmp(menu_routing[indice].name, routing_name) == 0)
+					return indice;
+		
+			G_fatal_error(_("Methode <%s> inconnue"), routing_name);
+		
+			return -1;
+		}	
+
+	/* ************************************************************** */
+	/* Détecte la méthode de recherche des bassins de drainage        */
+	/* ************************************************************** */
+	
+	static int find_search_method(const char *search_name){
+		int indice;
+
+			for (indice = 0; menu_search[indice].name; indice++)
+				if (strcmp(menu_search[indice].name, search_name) == 0)
+					return indice;
+		
+			G_fatal_error(_("Methode <%s> inconnue"), search_name);
+		
+			return -1;
+		}	
+
+	/* ************************************************************** */
+	/* Détecte la méthode de conditionnement des altitudes            */
+	/* ************************************************************** */
+	
+	static int find_depression_method(const char *depression_name){
+		int indice;
+
+			for (indice = 0; menu_depressions[indice].name; indice++)
+				if (strcmp(menu_depressions[indice].name, depression_name) == 0)
+					return indice;
+		
+			G_fatal_error(_("Methode <%s> inconnue"), depression_name);
+		
+			return -1;
+		}	
+
+	/* ************************************************ */
+	/* Détecte le rangement des cellules en mémoire     */
+	/* ************************************************ */
+	
+	static int find_layout_method(const char *layout_name){
+		int indice;
+
+			for (indice = 0; menu_layout[indice].name; indice++)
+				if (strcmp(menu_layout[indice].name, layout_name) == 0)
+					return indice;
+		
+			G_fatal_error(_("Rangement <%s> inconnu"), layout_name);
+		
+			return -1;
+		}	
+
 	/* ******************************************************************************************** */
 	/* Détecte l'algorithme qui calcule la zone amont contribuant au ruissellement dans une cellule */
 	/* ******************************************************************************************** */
@@ -1268,9 +1612,101 @@
 		return (rown >= 0 && rown < nrows && coln >=0 && coln < ncols);
 	}
 
-	/* ********************************************* */
-	/* Calcule l'exposition de la cellule en radians */ 
-	/* ********************************************* */
+	/* ************************************************************************* */
+	/* Conditionnement des altitudes (depressions=fill) : toute la grille est    */
+	/* lue en mémoire, ses cuvettes sont remplies et ses zones plates drainées   */
+	/* (Flood.c). Chaque cellule a ensuite une voisine plus basse ou est un      */
+	/* exutoire : le graphe des directions d'écoulement est sans cycle. La       */
+	/* fenêtre glissante lit alors ces altitudes au lieu du fichier segmenté.    */
+	/* ************************************************************************* */
+	
+	void ConditionAltitude(void){
+	
+	struct Parm *p;
+	double start = TimeNow();
+	int r, c;
+	
+		G_verbose_message(_("Remplissage des cuvettes et drainage des zones plates..."));
+		alt_dem = (double *)G_malloc((size_t)nrows * ncols * sizeof(double));
+		p 		= (struct Parm *)G_malloc(ncols * sizeof(struct Parm));
+		for(r = 0; r < nrows; r++){
+			ParmGetRow(r, p);
+			for(c = 0; c < ncols; c++)
+				alt_dem[(size_t)r * ncols + c] = p[c].altitude;
+		}
+		G_free(p);
+		
+		memset(&flood_stats, 0, sizeof(flood_stats));
+		FillDepressions(alt_dem, nrows, ncols, &flood_stats);
+		ResolveFlats(alt_dem, nrows, ncols, &flood_stats);
+		if(flood_stats.unresolved)
+			G_warning(_("%ld cellules de zones plates restent sans ecoulement"), flood_stats.unresolved);
+		condition_time = TimeNow() - start;
+	}
+	
+	/* ************************************************************************* */
+	/* Fenêtre glissante de trois lignes d'altitude : chaque altitude est lue    */
+	/* une seule fois dans le fichier segmenté, avec sa ligne, puis sert aux     */
+	/* calculs d'exposition et de direction d'écoulement des 9 cellules dont     */
+	/* elle est voisine. Chaque ligne a une colonne de bordure de chaque côté.   */
+	/* ************************************************************************* */
+	
+	static void LoadAltitudeRow(double *buf, int r){
+	
+	int c;
+	
+		buf[0] = buf[ncols+1] = UNDEF;
+		if(r < 0 || r >= nrows){
+			for(c = 1; c <= ncols; c++)
+				buf[c] = UNDEF;
+			return;
+		}
+		if(alt_dem){
+			memcpy(buf + 1, alt_dem + (size_t)r * ncols, ncols * sizeof(double));
+			return;
+		}
+		ParmGetRow(r, alt_parms);
+		for(c = 0; c < ncols; c++)
+			buf[c+1] = alt_parms[c].altitude;
+	}
+	
+	void OpenAltitudeWindow(void){
+	
+		for(k = 0; k < 3; k++)
+			alt_win[k] = (double *)G_malloc((ncols + 2) * sizeof(double));
+		alt_parms = (struct Parm *)G_malloc(ncols * sizeof(struct Parm));
+	}
+	
+	/* Place la ligne row au centre de la fenêtre (les lignes sont parcourues dans l'ordre) */
+	void AdvanceAltitudeWindow(int row){
+	
+	double *tmp;
+	
+		if(row == 0){
+			LoadAltitudeRow(alt_win[0], -1);
+			LoadAltitudeRow(alt_win[1], 0);
+		}else{
+			tmp 		= alt_win[0];
+			alt_win[0] 	= alt_win[1];
+			alt_win[1] 	= alt_win[2];
+			alt_win[2] 	= tmp;
+		}
+		LoadAltitudeRow(alt_win[2], row + 1);
+	}
+	
+	void CloseAltitudeWindow(void){
+	
+		for(k = 0; k < 3; k++){
+			G_free(alt_win[k]);
+			alt_win[k] = NULL;
+		}
+		G_free(alt_parms);
+		alt_parms = NULL;
+	}
+	
+	/* ********************************************* */
+	/* Calcule l'exposition de la cellule en radians */ 
+	/* ********************************************* */
 	
 	double aspect_on_fly(int row, int col){
 
@@ -1285,8 +1721,7 @@
 		if( !is_OnGrid(rown, coln) )
            return UNDEF;
 		   
-		Segment_get(&parms_seg, &parms, rown, coln);
-		z[k] = parms.altitude;
+		z[k] = NEIGHBOUR_ALT(k, col);
 	}
        dzdx	= ((z[1] + z[0]+z[0] + z[7])-(z[3] + z[4]+z[4] + z[5])) / 8.*RES;
        dzdy 	= ((z[3] + z[2]+z[2] + z[1])-(z[5] + z[6]+z[6] + z[7])) / 8.*RES;
@@ -1324,9 +1759,7 @@
 				  
 	void D_8(int row, int col){
 	
-	Segment_get(&parms_seg, &parms, row, col);
-
-	double z 		= parms.altitude, dz;
+	double z 		= CENTRE_ALT(col), dz;
 	double dzMax	= 0.0;
 	short direction = -1;
 
@@ -1334,8 +1767,7 @@
 		for(k=0; k<8; k++){
 			rown   = row + dy[k];
 			coln   = col + dx[k];			
-			Segment_get(&parms_seg, &parms, rown, coln);
-			if( is_OnGrid(rown, coln) && (dz = ((z - parms.altitude)/DIST(k)) > 0.0) ){
+			if( is_OnGrid(rown, coln) && (dz = (z - NEIGHBOUR_ALT(k, col))/DIST(k)) > 0.0 ){
 				if( dz > dzMax){
 					dzMax 		= dz;
 					direction 	= k;
@@ -1343,8 +1775,8 @@
 			}
 		}
 	if(direction>=0){
-		landscape[row+dy[direction]][col+dx[direction]].portion[(direction+4)%8]  = 1.;
-		landscape[row+dy[direction]][col+dx[direction]].neighbors[(direction+4)%8]= &landscape[row][col];		
+		LAYER(row+dy[direction],col+dx[direction])->portion[(direction+4)%8]  = 1.;
+		LAYER(row+dy[direction],col+dx[direction])->neighbors[(direction+4)%8]= LAYER(row,col);		
 	}
 	return;
 	}
@@ -1375,11 +1807,11 @@
 			rowkk  = row + dy[kk];
 			colkk  = col + dx[kk];
 
-			landscape[rowk][colk].portion[(k+4)%8] 	= 1. - portion;
-			landscape[rowkk][colkk].portion[(kk+4)%8] 	= portion;
+			LAYER(rowk,colk)->portion[(k+4)%8] 	= 1. - portion;
+			LAYER(rowkk,colkk)->portion[(kk+4)%8] 	= portion;
 			
-			landscape[rowk][colk].neighbors[(k+4)%8] 	= &landscape[row][col];
-			landscape[rowkk][colkk].neighbors[(kk+4)%8]	= &landscape[row][col];
+			LAYER(rowk,colk)->neighbors[(k+4)%8] 	= LAYER(row,col);
+			LAYER(rowkk,colkk)->neighbors[(kk+4)%8]	= LAYER(row,col);
 		}
 		else
 			D_8(row, col);
@@ -1393,10 +1825,8 @@
 
 	void MFD_8(int row, int col){
 	
-	Segment_get(&parms_seg, &parms, row, col);
-
 	double tanBeta[8];
-	double dz, z = parms.altitude;
+	double dz, z = CENTRE_ALT(col);
 	double dzSum = 0.0;
 	
 	/* définit la longueur de contour effective */
@@ -1409,8 +1839,7 @@
 			rown  = row + dy[k];
 			coln  = col + dx[k];
 
-			Segment_get(&parms_seg, &parms, rown, coln);
-				if( is_OnGrid(rown, coln) && (dz = (z - parms.altitude)/DIST(k)) > 0.0 )
+				if( is_OnGrid(rown, coln) && (dz = (z - NEIGHBOUR_ALT(k, col))/DIST(k)) > 0.0 )
 			{
 			    tanBeta[k] = pow(dz, mfd_converge) * l[k];
 				dzSum     += tanBeta[k];
@@ -1422,8 +1851,8 @@
 				for(k=0; k<8; k++)
 			{
 				if(tanBeta[k]){
-					landscape[row+dy[k]][col+dx[k]].portion[(k+4)%8]   = tanBeta[k] / dzSum;
-					landscape[row+dy[k]][col+dx[k]].neighbors[(k+4)%8] = &landscape[row][col];
+					LAYER(row+dy[k],col+dx[k])->portion[(k+4)%8]   = tanBeta[k] / dzSum;
+					LAYER(row+dy[k],col+dx[k])->neighbors[(k+4)%8] = LAYER(row,col);
 				}
 			}
 		}
@@ -1437,10 +1866,8 @@
 	
 	void MFD_md(int row, int col){
 	
-	Segment_get(&parms_seg, &parms, row, col);
-
 	double tanBeta[8];
-	double z = parms.altitude, dz;
+	double z = CENTRE_ALT(col), dz;
 	double dzMax, dzSum;
     dzMax = dzSum = 0.;
 	
@@ -1453,8 +1880,7 @@
 			rown   = row + dy[k];
 			coln   = col + dx[k];
 			
-			Segment_get(&parms_seg, &parms, rown, coln);
-				if( is_OnGrid(rown, coln) && (dz = (z - parms.altitude)/DIST(k)) > 0.0 )
+				if( is_OnGrid(rown, coln) && (dz = (z - NEIGHBOUR_ALT(k, col))/DIST(k)) > 0.0 )
 			{
 				if(dz > dzMax)
 					dzMax = dz; 
@@ -1469,8 +1895,7 @@
 			rown  = row + dy[k];
 			coln  = col + dx[k];
 
-			Segment_get(&parms_seg, &parms, rown, coln);
-				if( is_OnGrid(rown, coln) && (dz = (z - parms.altitude)/DIST(k)) > 0.0 )
+				if( is_OnGrid(rown, coln) && (dz = (z - NEIGHBOUR_ALT(k, col))/DIST(k)) > 0.0 )
 			{
 			    tanBeta[k] = pow(dz, dzMax) * l[k];
 				dzSum     += tanBeta[k];
@@ -1481,8 +1906,8 @@
 				for(k=0; k<8; k++)
 			{
 				if(tanBeta[k]){
-					landscape[row+dy[k]][col+dx[k]].portion[(k+4)%8]  = tanBeta[k] / dzSum;
-					landscape[row+dy[k]][col+dx[k]].neighbors[(k+4)%8]= &landscape[row][col];
+					LAYER(row+dy[k],col+dx[k])->portion[(k+4)%8]  = tanBeta[k] / dzSum;
+					LAYER(row+dy[k],col+dx[k])->neighbors[(k+4)%8]= LAYER(row,col);
 				}
 			}
 		}
@@ -1496,9 +1921,7 @@
 	
 	void MFD_Inf(int row, int col){
 
-	Segment_get(&parms_seg, &parms, row, col);
-
-	double 	dzSum, dz1, dz2, e[8], e0 = parms.altitude;
+	double 	dzSum, dz1, dz2, e[8], e0 = CENTRE_ALT(col);
 	double 	d, s, s_facet[8], d_facet[8];
 	double 	cellarea = RES * RES;
 	double 	valley[8], portion[8];
@@ -1513,10 +1936,8 @@
 		rown          = row + dy[k];
 		coln          = col + dx[k];
 		s_facet[k]    = d_facet[k] = -999.0; // initialise la pente et la direction des facettes à -999.
-		if( (Dir_inGrid[k] = is_OnGrid(rown, coln)) ){
-			Segment_get(&parms_seg, &parms, rown, coln);
-            e[k]  = parms.altitude;
-		}
+		if( (Dir_inGrid[k] = is_OnGrid(rown, coln)) )
+            e[k]  = NEIGHBOUR_ALT(k, col);
 	}
       for(k=0; k<8; k++)
     {
@@ -1634,8 +2055,8 @@
 		}
 		for(k=0; k<8; k++)
 		{
-			landscape[row+dy[k]][col+dx[k]].portion[(k+4)%8]	= portion[k];
-			landscape[row+dy[k]][col+dx[k]].neighbors[(k+4)%8]	= &landscape[row][col];
+			LAYER(row+dy[k],col+dx[k])->portion[(k+4)%8]	= portion[k];
+			LAYER(row+dy[k],col+dx[k])->neighbors[(k+4)%8]	= LAYER(row,col);
 		}
     }
 	return;
@@ -1645,41 +2066,56 @@
 	/* Alloue une nouvelle couche de sol avec des valeurs d'initialisation par défaut */
 	/* ****************************************************************************** */
 	
-	layer *NewLayer(){
-		layer *newlayer = (layer *)G_malloc(ncols*sizeof(layer));
+	layer *NewLayer(uint32_t n){
+		uint32_t j;
+		layer *newlayer = (layer *)G_malloc(n*sizeof(layer));
 		if(!newlayer){	
 			fprintf(stderr, "Allocation de memoire pour la couche de sol a echoue\n");
 			exit(1);
 		}		
-		for(col=0;col<ncols;col++){
-			/* Alloue un bloc de mémoire pour stocker les valeurs de teneur en eau */
-				newlayer[col].swc	= (double *)G_malloc(num_inputs*sizeof(double));
+		/* Les dernières valeurs de teneur en eau (historique roulant) de toutes les cellules sont dans un seul bloc,
+		   swc_len valeurs par cellule dans l'ordre des cellules (voir SWC) */
+		swc_slab = (real *)G_calloc((size_t)n * swc_len, sizeof(real));
+		for(j=0;j<n;j++){
 			/* Initialise le pointeur vers l'eau disponible au drainage	et les cellules
 			amont contribuant au ruissellement dans la cellule	à leur valeur par défaut
 			(i.e. NULL) */
-				newlayer[col].raw				= NULL;
-				newlayer[col].braw				= NULL;				
-				newlayer[col].contribCells		= NULL;
-				newlayer[col].UHTsf				= NULL;
-				newlayer[col].UHTssf			= NULL;				
+				newlayer[j].raw.head			= NULL;
+				newlayer[j].raw.tail			= NULL;
+				newlayer[j].raw.first			= NULL;
+				newlayer[j].raw.count			= 0;
+				newlayer[j].outk				= NULL;
+				newlayer[j].nout				= 0;
+				newlayer[j].ring_len			= 0;
+				newlayer[j].ring_in			= NULL;
+				newlayer[j].ring_out			= NULL;
+				newlayer[j].braw				= NULL;				
+				newlayer[j].UHTsf				= NULL;
+				newlayer[j].UHTssf			= NULL;				
 			/* Initialise à zéro le nombre de cellules drainant vers la cellule */			
-				for(k=0;k<2;k++)				
-					newlayer[col].nbContribCells[k]= 0;
+				for(k=0;k<2;k++){
+					newlayer[j].nbContribCells[k]	= 0;
+					newlayer[j].contribCells[k]	= NULL;
+				}
 			/* Initialise chaque pointeur de cellules et la portion d'aire qu'elles drainent 
 			à leur valeur par défaut (i.e. NULL et zéro respectivement) */
 				for(k=0;k<8;k++){
-					newlayer[col].neighbors[k] 	= NULL;
-					newlayer[col].portion[k]	= 0.0;
+					newlayer[j].neighbors[k] 	= NULL;
+					newlayer[j].portion[k]	= 0.0;
 				}
+			/* Initialise les flux et les cumuls à zéro */
+				newlayer[j].paw = newlayer[j].sraw = 0.0;
+				newlayer[j].p = newlayer[j].pet = newlayer[j].aet = newlayer[j].pe = 0.0;
+				newlayer[j].qinsf = newlayer[j].qinssf = newlayer[j].qoutsf = newlayer[j].qoutssf = 0.0;
 			/* Initialise les paramètres servant au calcul du ruissellement de surface
 			à zéro par défaut */
-				newlayer[col].smax 				= 0.0;
-				newlayer[col].w1 				= 0.0;
-				newlayer[col].w2 				= 0.0;
+				newlayer[j].smax 				= 0.0;
+				newlayer[j].ew1 				= 1.0;
+				newlayer[j].w2 				= 0.0;
 			/* Initialise la catégorie à laquelle appartient la cellule:
 			"surface en eau" et "zone humides" */
-				newlayer[col].waterbodies 		= 0;
-				newlayer[col].riparian 			= 0;
+				newlayer[j].waterbodies 		= 0;
+				newlayer[j].riparian 			= 0;
 		}
 		
 		return newlayer;
@@ -1692,31 +2128,43 @@
 
 	void FreeLandscape(){
 	
-	layer *ptr;	
+	layer *ptr = landscape;	
+	uint32_t j;
 	
-		for(row=0;row<nrows;row++){
-		
-			ptr = landscape[row];
-		 
-				for(col=0;col<ncols;col++)
-			{
-				if(ptr[col].swc)
-					G_free(ptr[col].swc);
-				if(ptr[col].raw)
-					G_free(ptr[col].raw);
-				if(ptr[col].braw)
-					G_free(ptr[col].braw);
-				if(ptr[col].contribCells)
-					G_free(ptr[col].contribCells);					
-				if(ptr[col].UHTsf)
-					free_dvector(ptr[col].UHTsf, 1, num_inputs);			
-				if(ptr[col].UHTssf)
-					free_dvector(ptr[col].UHTssf, 1, num_inputs);		
-			}
-			
+		/* Les cellules de remplissage des derniers blocs ont été initialisées comme les autres */
+		for(j=0;j<cell_layout->ncells;j++)
+		{
+			if(ptr[j].braw)
+				G_free(ptr[j].braw);
+			for(k=0;k<2;k++)
+				if(ptr[j].contribCells[k])
+					G_free(ptr[j].contribCells[k]);
+			if(ptr[j].UHTsf)
+				free_rvector(ptr[j].UHTsf, 1, num_inputs);			
+			if(ptr[j].UHTssf)
+				free_rvector(ptr[j].UHTssf, 1, num_inputs);		
 		}
 		G_free(landscape);
+		G_free(swc_slab);
+		G_free(ring_slab);
+		G_free(outk_slab);
+		swc_slab = ring_slab = NULL;
+		outk_slab = NULL;
+		DestroyCellLayout(cell_layout);
+		cell_layout = NULL;
 		
+		if(events){
+			DestroyEventArena(events);
+			events = NULL;
+		}
+		if(kernels){
+			DestroyKernelPool(kernels);
+			kernels = NULL;
+		}
+		if(tiles){
+			DestroyTileStore(tiles);
+			tiles = NULL;
+		}
 		return;
 		
 	}
@@ -1742,10 +2190,11 @@
 			if(Outputs==NULL)
 				G_fatal_error(_("Impossible d allouer de la memoire pour les rasters de sortie"));
 		
-		/* allocation de la carte d'étude */		
-		landscape = (layer **) G_malloc(nrows * sizeof(layer *));
+		/* allocation de la carte d'étude : un seul bloc de cellules rangées selon layout= */		
+		cell_layout = CreateCellLayout(layout_mode, nrows, ncols);
+		landscape 	= NewLayer(cell_layout->ncells);
 		
-			if(flag6){
+			if(flag6->answer){
 				waterbodies = (CELL **) G_malloc(nrows * sizeof(CELL *));
 				riparian   	= (CELL **) G_malloc(nrows * sizeof(CELL *));
 			}
@@ -1758,9 +2207,7 @@
 		for	(row = 0; row < nrows; row++){
 			G_percent(0, nrows, 5);
 			
-			landscape[row] = NewLayer();
-			
-				if(flag6){
+				if(flag6->answer){
 				waterbodies[row]= (CELL *) G_malloc(ncols * sizeof(CELL));
 				riparian[row]   = (CELL *) G_malloc(ncols * sizeof(CELL));		
 				}
@@ -1854,7 +2301,7 @@
 	void Cleanup(){
 		for(row = 0; row < nrows; row++)
 		{
-			if(flag6){
+			if(flag6->answer){
 				G_free(waterbodies[row]);
 				G_free(riparian[row]);
 			}
@@ -1864,7 +2311,7 @@
 				G_free(w2[row]);
 			}
 		}
-		if(flag6){
+		if(flag6->answer){
 			G_free(waterbodies);
 			G_free(riparian);
 		}
@@ -1876,52 +2323,278 @@
 		return;
 	}
 
-	/* ************************************************ */
-	/* Retourne un vecteur d'indice des termes non nuls */
-	/* ************************************************ */
-	
-	int *FindNonZeroTermIndices(double *p, int size){
-	int *ptr=NULL;
-	static int count = 0;	
-		for(i=0;i<size;i++){	
-			if(p[i]>0.0){
-			count++;
-			ptr = (int *)G_realloc(ptr, count*sizeof(int));
-			ptr[count-1] = i;
-			}
-		}
-	return ptr;
-	}
-
 	/* ******************************************************** */
 	/* Fonction de réponse à l'échelle d'un chemin d'écoulement */ 
 	/* ******************************************************** */
 
-	double FlowPathUnitResponse(node *p, int time_index, int id){
+	double FlowPathUnitResponse(const contrib *q, int time_index){
 	
-		double avg_travel_time 		= p->avg_travel_time[id];
-		double var_of_flow_time 	= p->var_of_flow_time[id];
-		double sqrt_sigma 			= sqrt(var_of_flow_time);
-		double U_t;
-
-		U_t = ( 1.0 / (sqrt_sigma * sqrt( 2.0 * M_PI * pow(time_index,3.0)/pow(avg_travel_time,3.0) ) ) ) * exp( - pow(time_index - avg_travel_time, 2.0)/(2.0 * var_of_flow_time * time_index/avg_travel_time) );
-		return U_t;
+	const KernelClass *kc = KCLASS(q);
+	
+		return invgauss_pdf((double)time_index, kc->mu, kc->lambda);
 	}
 	
 	/* ********************************************* */
 	/* Fonction de réponse à l'échelle d'une cellule */ 
 	/* ********************************************* */
 
-	double CellOutletResponse(node *p, int time_index, int id){
-
-		double c 	= p->avg_travel_time[id];
-		double d 	= p->var_of_flow_time[id];
-		double l 	= RES;
-		double u_t;
-
-		u_t = ( l / (2.0 * sqrt( M_PI * d * pow(time_index,3.0) ) ) ) * exp( - pow(c * time_index - l, 2.0)/(4.0 * d * time_index) );
-		return u_t;
-	}	
+	double CellOutletResponse(const contrib *q, int time_index){
+	
+	const KernelClass *kc = KCLASS(q);
+	
+		return invgauss_pdf((double)time_index, kc->mu, kc->lambda);
+	}
+	
+	/* ****************************************************************** */
+	/* Fonction de réponse d'un chemin d'écoulement ou d'une cellule pour */
+	/* le pas de temps time_index, lue dans la table de sa classe         */
+	/* ****************************************************************** */
+	
+	double StepResponse(const contrib *q, int time_index){
+	
+	const KernelClass *kc = KCLASS(q);
+	
+		if(time_index < kc->t_min || time_index > kc->t_max)
+			return 0.0;
+		return (double)kc->table[time_index - kc->t_min];
+	}
+	
+	/* ********************************************************************** */
+	/* Paramètres de la loi inverse gaussienne d'une fonction de réponse :    */
+	/* moyenne mu et paramètre de forme lambda, à partir du temps de trajet   */
+	/* moyen et de sa variance, ou de la célérité et de la dispersion dans la */
+	/* cellule pour la réponse à son exutoire                                 */
+	/* ********************************************************************** */
+	
+	void ResponseParameters(double avg, double var, int outlet, double *mu, double *lambda){
+	
+		if(outlet){
+			/* Premier temps de passage à la distance RES d'une onde de célérité c et de dispersion d */
+			*mu 	= RES / avg;
+			*lambda = RES * RES / (2.0 * var);
+		}else{
+			*mu 	= avg;
+			*lambda = pow(*mu, 3.0) / var;
+		}
+	}
+	
+	/* ************************************************************************ */
+	/* Plus petit pas de temps t de [1, len] tel que F(t) > level (len+1 sinon) */
+	/* ************************************************************************ */
+	
+	static int FirstStepAbove(double mu, double lambda, double level, int len){
+	
+	int lo = 1, hi = len + 1, mid;
+	
+		while(lo < hi){
+			mid = (lo + hi) / 2;
+			if(invgauss_cdf((double)mid, mu, lambda) > level)
+				hi = mid;
+			else lo = mid + 1;
+		}
+		return lo;
+	}
+	
+	/* ****************************************************************** */
+	/* Valeur de la fonction de réponse d'une classe sur ]t-1, t] selon   */
+	/* kernel= : densité à la fin du pas de temps, intégrale numérique de */
+	/* la densité ou masse exacte F(t) - F(t-1)                           */
+	/* ****************************************************************** */
+	
+	struct response_ctx
+	{
+		double mu, lambda;
+	};
+	
+	static void ResponseIntegrand(const double *x, double *fx, int n, void *ctx){
+	
+	const struct response_ctx *r = (const struct response_ctx *)ctx;
+	int j;
+	
+		for(j = 0; j < n; j++) fx[j] = invgauss_pdf(x[j], r->mu, r->lambda);
+	}
+	
+	static double ClassStepValue(const KernelClass *kc, int t){
+	
+	struct response_ctx r;
+	quad_work w;
+	double a = (double)(t - 1), b = (double)t;
+	
+		r.mu 		= kc->mu;
+		r.lambda 	= kc->lambda;
+		
+		switch(kernel_mode){
+			case 1:
+				return qromb_r(ResponseIntegrand, &r, a, b, KERNEL_EPS, &w);
+			case 2:
+				quad_init(&w);
+				return qgk_adapt(ResponseIntegrand, &r, a, b, KERNEL_EPS, KERNEL_DEPTH, &w);
+			case 3:
+				return qtanhsinh(ResponseIntegrand, &r, a, b, KERNEL_EPS, &w);
+			case 4:
+				return invgauss_cdf(b, kc->mu, kc->lambda) - invgauss_cdf(a, kc->mu, kc->lambda);
+			default:
+				return invgauss_pdf(b, kc->mu, kc->lambda);
+		}
+	}
+	
+	/* ******************************************************************************* */
+	/* Classe de la fonction de réponse (mu, lambda) du ruissellement c. Une nouvelle  */
+	/* classe reçoit sa fenêtre [t_min, t_max] de décalages (en pas de temps), hors de */
+	/* laquelle la fonction ne porte que la masse epsilon : epsilon/2 avant t_min et   */
+	/* epsilon/2 après t_max, puis la table de ses valeurs sur la fenêtre. Les         */
+	/* contributeurs d'une même classe partagent cette table.                          */
+	/* ******************************************************************************* */
+	
+	int ResponseClass(int c, int outlet, double mu, double lambda){
+	
+	KernelClass *kc;
+	int t, len, created, cls;
+	
+		len = (c == id) ? 1 : t_offset + num_inputs;
+		cls = KernelClassFind(kernels, c, outlet, mu, lambda, &created);
+		kc 	= &kernels->classes[cls];
+		if(created){
+			kc->t_min = FirstStepAbove(kc->mu, kc->lambda, 0.5 * kernel_eps, len);
+			kc->t_max = MIN(FirstStepAbove(kc->mu, kc->lambda, 1.0 - 0.5 * kernel_eps, len), len);
+			
+			/* Masse ignorée sur l'horizon de calcul */
+			if(kc->t_min > len)
+				kc->lost = invgauss_cdf((double)len, kc->mu, kc->lambda);
+			else kc->lost = invgauss_cdf((double)(kc->t_min - 1), kc->mu, kc->lambda)
+						  + invgauss_cdf((double)len, kc->mu, kc->lambda) - invgauss_cdf((double)kc->t_max, kc->mu, kc->lambda);
+			
+			if(kc->t_max >= kc->t_min){
+				kc->table = (real *)G_malloc((kc->t_max - kc->t_min + 1) * sizeof(real));
+				for(t = kc->t_min; t <= kc->t_max; t++)
+					kc->table[t - kc->t_min] = (real)ClassStepValue(kc, t);
+			}
+			if(c != id)
+				event_reach = MAX(event_reach, kc->t_max);
+		}
+		kernel_lost_sum += kc->lost;
+		kernel_lost_max = MAX(kernel_lost_max, kc->lost);
+		kernel_windows++;
+		
+		return cls;
+	}
+	
+	/* ******************************************************************************* */
+	/* Ajoute le noeud q aux contributeurs du ruissellement c de la cellule p. Le      */
+	/* premier contributeur est la cellule elle-même : sa réponse à l'exutoire dépend  */
+	/* de la célérité et de la dispersion de l'écoulement dans la cellule (parms doit  */
+	/* contenir les paramètres de p), et non d'un temps de trajet.                     */
+	/* ******************************************************************************* */
+	
+	void AppendContributor(layer *p, int c, const node *q, int *capacity){
+	
+	contrib *r;
+	double mu, lambda;
+	int outlet = (p->nbContribCells[c] == 0);
+	
+		if(p->nbContribCells[c] == *capacity){
+			*capacity 			= *capacity ? 2 * *capacity : 16;
+			p->contribCells[c] 	= (contrib *)G_realloc(p->contribCells[c], *capacity * sizeof(contrib));
+		}
+		if(outlet)
+			ResponseParameters(parms.flow_speeds[c], parms.flow_disps[c], 1, &mu, &lambda);
+		else ResponseParameters(q->avg_travel_time[c], q->var_of_flow_time[c], 0, &mu, &lambda);
+		
+		r 			= &p->contribCells[c][p->nbContribCells[c]++];
+		r->cell 	= CELL_INDEX(q->row, q->col);
+		r->cls 		= ResponseClass(c, outlet, mu, lambda);
+		r->portion 	= (float)q->portion[c];
+	}
+	
+	/* ******************************************************************************* */
+	/* Contributeurs du ruissellement comp de la cellule c (ligne row, colonne col) :  */
+	/* en mémoire, ou lus dans la tuile de la cellule avec l'option -o. Le pointeur    */
+	/* reste valide jusqu'à la lecture d'une autre tuile.                              */
+	/* ******************************************************************************* */
+	
+	const contrib *GetContributors(const layer *c, int comp, int row, int col){
+	
+	const uint32_t *start;
+	
+		if(!tiles || c->nbContribCells[comp] == 0)
+			return c->contribCells[comp];
+		
+		start = (const uint32_t *)TileStoreGet(tiles, TileOf(tiles, row, col));
+		return (const contrib *)(start + 2*(TILE_CELLS+1))
+			 + start[comp*(TILE_CELLS+1) + (row % TILE_SIZE)*TILE_SIZE + col % TILE_SIZE];
+	}
+	
+	/* ******************************************************************************* */
+	/* Passe hors mémoire pendant la recherche des bassins : les bandes déjà traitées  */
+	/* sont écrites dans les tuiles, la bande band le sera par l'appelant.             */
+	/* ******************************************************************************* */
+	
+	void SwitchToTiles(int band){
+	
+	int b;
+	
+		G_important_message(_("Les listes de contributeurs depassent %.0f MB : passage en calcul hors memoire (-o)"), mem_plan.contrib_budget_mb);
+		tile_mb 			= mem_plan.contrib_budget_mb;
+		mem_plan.auto_tiles = 1;
+		tiles 				= CreateTileStore(nrows, ncols, (size_t)(tile_mb * 1048576.));
+		for(b = 0; b < band; b++)
+			FlushContributorTiles(b);
+	}
+	
+	/* ******************************************************************************* */
+	/* Écrit les tuiles d'une bande de TILE_SIZE lignes dont tous les bassins ont été  */
+	/* identifiés, puis libère les listes de contributeurs de ses cellules. Une tuile  */
+	/* contient, pour chaque ruissellement, l'indice du premier contributeur de        */
+	/* chaque cellule (TILE_CELLS+1 entiers), puis les contributeurs eux-mêmes.        */
+	/* ******************************************************************************* */
+	
+	void FlushContributorTiles(int band){
+	
+	layer *c;
+	uint32_t *start;
+	contrib *recs;
+	size_t bytes, total;
+	int tc, r, cl, comp, local;
+	
+		for(tc = 0; tc < tiles->ntcols; tc++){
+			/* Taille de la tuile */
+			total = 0;
+			for(r = band*TILE_SIZE; r < MIN((band+1)*TILE_SIZE, nrows); r++)
+				for(cl = tc*TILE_SIZE; cl < MIN((tc+1)*TILE_SIZE, ncols); cl++)
+					total += LAYER(r,cl)->nbContribCells[0] + LAYER(r,cl)->nbContribCells[1];
+			bytes 	= 2*(TILE_CELLS+1)*sizeof(uint32_t) + total*sizeof(contrib);
+			start 	= (uint32_t *)G_calloc(bytes, 1);
+			recs 	= (contrib *)(start + 2*(TILE_CELLS+1));
+			
+			/* Copie les contributeurs des cellules dans l'ordre de la tuile */
+			total = 0;
+			for(comp = 0; comp < 2; comp++){
+				for(local = 0; local < TILE_CELLS; local++){
+					start[comp*(TILE_CELLS+1) + local] = (uint32_t)total;
+					r 	= band*TILE_SIZE + local / TILE_SIZE;
+					cl 	= tc*TILE_SIZE + local % TILE_SIZE;
+					if(r >= nrows || cl >= ncols)
+						continue;
+					c = LAYER(r,cl);
+					if(c->nbContribCells[comp])
+						memcpy(recs + total, c->contribCells[comp], c->nbContribCells[comp]*sizeof(contrib));
+					total += c->nbContribCells[comp];
+				}
+				start[comp*(TILE_CELLS+1) + TILE_CELLS] = (uint32_t)total;
+			}
+			
+			TileStorePut(tiles, band*tiles->ntcols + tc, start, bytes);
+			G_free(start);
+			
+			for(r = band*TILE_SIZE; r < MIN((band+1)*TILE_SIZE, nrows); r++)
+				for(cl = tc*TILE_SIZE; cl < MIN((tc+1)*TILE_SIZE, ncols); cl++)
+					for(comp = 0; comp < 2; comp++)
+						if(LAYER(r,cl)->contribCells[comp]){
+							G_free(LAYER(r,cl)->contribCells[comp]);
+							LAYER(r,cl)->contribCells[comp] = NULL;
+						}
+		}
+	}
 	
 	/* ********************************************** */
 	/* Vérifie si un objet est dans la file d'attente */
@@ -1993,15 +2666,18 @@
     return TargetNode;
 	}
 
-	/* **************************************************************************** */
-	/* Identifie les cellules appartenant au bassin de drainage d'une cellule donné */
-	/* **************************************************************************** */
+	/* ******************************************************************** */
+	/* Recherche du bassin de drainage de la cellule p (ligne row, colonne  */
+	/* col) par un parcours en largeur (search=bfs). Le temps de trajet     */
+	/* d'une cellule encore dans la file est corrigé si un chemin plus      */
+	/* court est trouvé, sans être propagé aux cellules déjà atteintes      */
+	/* depuis elle ; une cellule déjà traitée peut être atteinte à nouveau. */
+	/* ******************************************************************** */
 	
-	void FindBasin(layer *p){
+	static void BasinBFS(layer *p, double *UpslopeArea, int *capacity){
 	
-	static int t, kept_processes;
+	static int kept_processes;
 	static double Travel_Time[2];
-	static double UpslopeArea[2];
 
 	/* Crée une file d'attente qui va contenir temporairement des pointeurs vers les cellules du réseau */
     Queue *queue = CreateQueue();
@@ -2010,6 +2686,10 @@
 	node *root 	= NewNode();
 	root->row 	= row;
 	root->col 	= col;
+	
+	/* La cellule elle-même est le premier contributeur (exutoire) de chaque ruissellement calculé */
+	root->is_visited[id] 	= (method==1||method==3);
+	root->is_visited[id+1] 	= (method>1);
 
 	/* On met le noeud dans la file d'attente */
 	EnQueue(queue, root);
@@ -2023,13 +2703,14 @@
 			/* Récupère le premier élément de la file d'attente */
 			CurrentNode = Front(queue); 
 			DeQueue(queue);
+			basin_search.visits++;
 	
 			/* Récupère les données sur la cellule */
-			Segment_get(&parms_seg, &parms, CurrentNode->row, CurrentNode->col);
+			ParmGet(CurrentNode->row, CurrentNode->col, &parms);
 
 			for(k=0;k<8;k++)
 			{
-				if( landscape[CurrentNode->row][CurrentNode->col].neighbors[k]==NULL)
+				if( LAYER(CurrentNode->row,CurrentNode->col)->neighbors[k]==NULL)
 				continue;
 				
 				/* Calcule les coordonnées (row, col) de la cellule voisine k */
@@ -2077,13 +2758,14 @@
 						/* Calcul de la variance du temps de trajet moyen */
 						CurrentNode->neighbors[k]->var_of_flow_time[id]  = (CurrentNode->var_of_flow_time[id]  + 2.0*parms.flow_disps[id]/pow((5./3. * parms.flow_speeds[id]),3.0)) * DIST(k);
 						/* Récupèration de la portion d'aire drainant vers la cellule */
-						CurrentNode->neighbors[k]->portion[id] = landscape[CurrentNode->row][CurrentNode->col].portion[k];
+						CurrentNode->neighbors[k]->portion[id] = LAYER(CurrentNode->row,CurrentNode->col)->portion[k];
 						/* Ajoute à la file d'attente */
 						EnQueue(queue,CurrentNode->neighbors[k]);					
 						}else{
 						/* Connecte à un noeud existant */
 						CurrentNode->neighbors[k] = GetNode(queue, rown, coln);	
 							if( Travel_Time[id] < CurrentNode->neighbors[k]->travel_time[id] ){
+								basin_search.updates++;
 								/* Recalcul du temps de trajet */							
 								CurrentNode->neighbors[k]->travel_time[id] 	= Travel_Time[id];							
 								/* Recalcul du temps de trajet moyen */
@@ -2091,7 +2773,7 @@
 								/* Recalcul de la variance du temps de trajet moyent */
 								CurrentNode->neighbors[k]->var_of_flow_time[id]  = (CurrentNode->var_of_flow_time[id] + 2.0*parms.flow_disps[id]/pow((5./3. * parms.flow_speeds[id]),3.0)) * DIST(k);
 								/* Récupération de la portion d'aire drainant vers la cellule */
-								CurrentNode->neighbors[k]->portion[id] = landscape[CurrentNode->row][CurrentNode->col].portion[k];
+								CurrentNode->neighbors[k]->portion[id] = LAYER(CurrentNode->row,CurrentNode->col)->portion[k];
 							}
 						}
 					break;
@@ -2110,15 +2792,16 @@
 						/* Calcul le temps de trajet moyen */
 						CurrentNode->neighbors[k]->avg_travel_time[id+1]   	= (CurrentNode->avg_travel_time[id+1]  + (1.0 /parms.flow_speeds[id+1])) * DIST(k);
 						/* Calcul de la variance du temps de trajet moyen */
-						CurrentNode->neighbors[k]->var_of_flow_time[id+1]  	= (CurrentNode->var_of_flow_time[id+1]  + 2.0*parms.flow_disps[id+1]/pow(parms.flow_speeds[id],3.0)) * DIST(k);
+						CurrentNode->neighbors[k]->var_of_flow_time[id+1]  	= (CurrentNode->var_of_flow_time[id+1]  + 2.0*parms.flow_disps[id+1]/pow(parms.flow_speeds[id+1],3.0)) * DIST(k);
 						/* Récupèration de la portion d'aire drainant vers la cellule */
-						CurrentNode->neighbors[k]->portion[id+1] = landscape[CurrentNode->row][CurrentNode->col].portion[k];
+						CurrentNode->neighbors[k]->portion[id+1] = LAYER(CurrentNode->row,CurrentNode->col)->portion[k];
 						/* Ajoute à la file d'attente */
 						EnQueue(queue,CurrentNode->neighbors[k]);					
 						}else{
 							/* Connecte à un noeud existant */
 							CurrentNode->neighbors[k] = GetNode(queue, rown, coln);				
 							if( Travel_Time[id+1] < CurrentNode->neighbors[k]->travel_time[id+1] ){
+								basin_search.updates++;
 								/* Recalcul le temps de trajet */							
 								CurrentNode->neighbors[k]->travel_time[id+1] 	= Travel_Time[id+1];							
 								/* Recalcul du temps de trajet moyen */
@@ -2126,7 +2809,7 @@
 								/* Recalcul de la variance du temps de trajet moyen */
 								CurrentNode->neighbors[k]->var_of_flow_time[id+1]  = (CurrentNode->var_of_flow_time[id+1]  + 2.0*parms.flow_disps[id+1]/pow(parms.flow_speeds[id+1],3.0)) * DIST(k);
 								/* Récupèration de la portion d'aire drainant vers la cellule */
-								CurrentNode->neighbors[k]->portion[id+1] = landscape[CurrentNode->row][CurrentNode->col].portion[k];	
+								CurrentNode->neighbors[k]->portion[id+1] = LAYER(CurrentNode->row,CurrentNode->col)->portion[k];	
 							}
 						}
 					break;
@@ -2151,14 +2834,15 @@
 						CurrentNode->neighbors[k]->var_of_flow_time[id]   = (CurrentNode->var_of_flow_time[id] + 2.0*parms.flow_disps[id]/pow(parms.flow_speeds[id],3.0)) * DIST(k);
 						CurrentNode->neighbors[k]->var_of_flow_time[id+1] = (CurrentNode->var_of_flow_time[id+1] + 2.0*parms.flow_disps[id+1]/pow(parms.flow_speeds[id+1],3.0)) * DIST(k);
 						/* Récupèration de la portion d'aire drainant vers la cellule */
-						CurrentNode->neighbors[k]->portion[id] 			  = landscape[CurrentNode->row][CurrentNode->col].portion[k];
-						CurrentNode->neighbors[k]->portion[id+1] 		  = landscape[CurrentNode->row][CurrentNode->col].portion[k];
+						CurrentNode->neighbors[k]->portion[id] 			  = LAYER(CurrentNode->row,CurrentNode->col)->portion[k];
+						CurrentNode->neighbors[k]->portion[id+1] 		  = LAYER(CurrentNode->row,CurrentNode->col)->portion[k];
 						/* Ajoute à la file d'attente */
 						EnQueue(queue,CurrentNode->neighbors[k]);					
 						}else{
 							/* Connecte à un noeud existant */
 							CurrentNode->neighbors[k] = GetNode(queue, rown, coln);				
 							if( Travel_Time[id] < CurrentNode->neighbors[k]->travel_time[id] ){
+								basin_search.updates++;
 								/* Recalcul le temps de trajet */							
 								CurrentNode->neighbors[k]->travel_time[id] 	= Travel_Time[id];							
 								/* Recalcul du temps de trajet moyen */
@@ -2166,9 +2850,10 @@
 								/* Recalcul de la variance du temps de trajet moyent */
 								CurrentNode->neighbors[k]->var_of_flow_time[id]  = (CurrentNode->var_of_flow_time[id] + 2.0*parms.flow_disps[id]/pow((5./3. * parms.flow_speeds[id]),3.0)) * DIST(k);
 								/* Récupèration de la portion d'aire drainant vers la cellule */
-								CurrentNode->neighbors[k]->portion[id] 			 = landscape[CurrentNode->row][CurrentNode->col].portion[k];
+								CurrentNode->neighbors[k]->portion[id] 			 = LAYER(CurrentNode->row,CurrentNode->col)->portion[k];
 							}
 							if( Travel_Time[id+1] < CurrentNode->neighbors[k]->travel_time[id+1]  ){
+								basin_search.updates++;
 								/* Recalcul le temps de trajet */							
 								CurrentNode->neighbors[k]->travel_time[id+1] 	 = Travel_Time[id+1];							
 								/* Recalcul du temps de trajet moyen */
@@ -2176,49 +2861,421 @@
 								/* Recalcul de la variance du temps de trajet moyen */
 								CurrentNode->neighbors[k]->var_of_flow_time[id+1]= (CurrentNode->var_of_flow_time[id+1] + 2.0*parms.flow_disps[id+1]/pow(parms.flow_speeds[id+1],3.0)) * DIST(k);
 								/* Récupèration de la portion d'aire drainant vers la cellule */
-								CurrentNode->neighbors[k]->portion[id+1] 		 = landscape[CurrentNode->row][CurrentNode->col].portion[k];
+								CurrentNode->neighbors[k]->portion[id+1] 		 = LAYER(CurrentNode->row,CurrentNode->col)->portion[k];
 							}							
 						}
 					break;
 				}
 			}
-		/* Comptabilise la cellule et mets à jour l'aire de drainage */
+		/* Comptabilise la cellule, mets à jour l'aire de drainage et ajoute son enregistrement aux contributeurs
+		   (les paramètres de la cellule sont encore dans parms) */
 		if(CurrentNode->is_visited[id]){
-			p->nbContribCells[id]++;
 			UpslopeArea[id] += CurrentNode->portion[id];
+			AppendContributor(p, id, CurrentNode, &capacity[id]);
 		}
 		if(CurrentNode->is_visited[id+1]){				
-			p->nbContribCells[id+1]++;
-			UpslopeArea[id] += CurrentNode->portion[id+1];
+			UpslopeArea[id+1] += CurrentNode->portion[id+1];
+			AppendContributor(p, id+1, CurrentNode, &capacity[id+1]);
+		}
+		
+		/* Le noeud n'est plus référencé que par ses prédécesseurs déjà traités : il est libéré */
+		G_free(CurrentNode);
 		}
-		/* Réajuste (augmente) la taille du bloc de mémoire contenant les noeuds */
-		p->contribCells = (node *)G_realloc(p->contribCells, MAX(p->nbContribCells[id],p->nbContribCells[id+1])*sizeof(node));
 		
-		/* Ajoute le noeud dans le bloc de mémoire */
-		memmove(p->contribCells + (MAX(p->nbContribCells[id],p->nbContribCells[id+1])-1), CurrentNode, sizeof(node));
+	/* Détruit la file d'attente */
+	DestroyQueue(queue);
+	}
+	
+	/* ******************************************************************** */
+	/* Noeud du front de la recherche de Dijkstra pour la cellule (r, c)    */
+	/* ******************************************************************** */
+	
+	static int SearchNode(int r, int c){
+	
+	struct BasinSearch *S = &basin_search;
+	size_t cell = CELL_INDEX(r, c);
+	int n;
+	
+		if(S->nfree > 0)
+			n = S->free_nodes[--S->nfree];
+		else {
+			if(S->nnodes == S->capacity){
+				S->capacity *= 2;
+				S->nodes 		= (node *)G_realloc(S->nodes, S->capacity * sizeof(node));
+				S->free_nodes 	= (int *)G_realloc(S->free_nodes, S->capacity * sizeof(int));
+			}
+			n = S->nnodes++;
 		}
-	/* Calcule la fonction de réponse UHT du bassin de drainage */
+		S->nodes[n].row = r;
+		S->nodes[n].col = c;
+		S->mark[cell] 	= 2 * S->gen;
+		S->slot[cell] 	= n;
+		return n;
+	}
+	
+	void FreeBasinSearch(void){
+	
+	struct BasinSearch *S = &basin_search;
+	
+		DestroyHeap(S->heap);
+		G_free(S->nodes);
+		G_free(S->free_nodes);
+		G_free(S->mark);
+		G_free(S->slot);
+		S->heap 		= NULL;
+		S->nodes 		= NULL;
+		S->free_nodes 	= NULL;
+		S->mark 		= NULL;
+		S->slot 		= NULL;
+	}
+	
+	/* ******************************************************************** */
+	/* Recherche du bassin de drainage du ruissellement comp de la cellule  */
+	/* p (ligne row, colonne col) par l'algorithme de Dijkstra : les        */
+	/* cellules amont sont traitées par temps de trajet croissant, chacune  */
+	/* une seule fois avec son plus court temps de trajet jusqu'à p, et ses */
+	/* temps moyen et variance sont ceux de ce chemin. Avec method=full, la */
+	/* recherche ne dépasse pas le temps de drainage (drainage_times=).     */
+	/* Le temps d'un pas (t + 1/v) * DIST n'est croissant en t que si la    */
+	/* résolution est d'au moins 1 unité de carte : parseOptions se replie  */
+	/* sur search=bfs en dessous, un temps traité est donc définitif.       */
+	/* ******************************************************************** */
+	
+	static void BasinDijkstra(layer *p, int comp, double *UpslopeArea, int *capacity){
+	
+	struct BasinSearch *S = &basin_search;
+	double limit = (method==3) ? drainage_times[comp] : HUGE_VAL;
+	double t, tu, avg, var, speed, celerity, disp;
+	size_t cell;
+	int ui, vi, r, c, ur, uc, dir;
+	node *u, *v;
+	
+		if(!S->heap){
+			S->capacity 	= 2 * (nrows + ncols);
+			S->nodes 		= (node *)G_malloc(S->capacity * sizeof(node));
+			S->free_nodes 	= (int *)G_malloc(S->capacity * sizeof(int));
+			S->nnodes 		= S->nfree = 0;
+			S->heap 		= CreateHeap(S->capacity);
+			S->mark 		= (uint32_t *)G_calloc(cell_layout->ncells, sizeof(uint32_t));
+			S->slot 		= (int *)G_malloc(cell_layout->ncells * sizeof(int));
+			S->gen 			= 0;
+		}
+		/* Nouvelle recherche : les marques des précédentes deviennent caduques */
+		if(++S->gen >= 0x7fffffff){
+			memset(S->mark, 0, cell_layout->ncells * sizeof(uint32_t));
+			S->gen = 1;
+		}
+		
+		/* La cellule elle-même est le premier contributeur (exutoire) */
+		ui = SearchNode(row, col);
+		u  = &S->nodes[ui];
+		u->travel_time[comp] = u->avg_travel_time[comp] = u->var_of_flow_time[comp] = u->portion[comp] = 0.0;
+		HeapPush(S->heap, ui, 0.0);
+		
+		while(!HeapIsEmpty(S->heap))
+		{
+			ui 	= HeapPop(S->heap, &tu);
+			u 	= &S->nodes[ui];
+			ur 	= u->row;
+			uc 	= u->col;
+			S->mark[CELL_INDEX(ur, uc)] = 2 * S->gen + 1;
+			S->visits++;
+			
+			/* Son temps de trajet est définitif : la cellule est ajoutée aux contributeurs */
+			ParmGet(ur, uc, &parms);
+			UpslopeArea[comp] += u->portion[comp];
+			AppendContributor(p, comp, u, &capacity[comp]);
+			
+			/* Célérité de l'onde : 5/3 de la vitesse en surface */
+			speed 		= parms.flow_speeds[comp];
+			celerity 	= (comp==id) ? 5./3. * speed : speed;
+			disp 		= parms.flow_disps[comp];
+			avg 		= u->avg_travel_time[comp];
+			var 		= u->var_of_flow_time[comp];
+			
+			for(dir=0;dir<8;dir++)
+			{
+				if(LAYER(ur,uc)->neighbors[dir]==NULL)
+					continue;
+				r 		= ur + dy[dir];
+				c 		= uc + dx[dir];
+				cell 	= CELL_INDEX(r, c);
+				if(S->mark[cell] == 2 * S->gen + 1)
+					continue;
+				
+				t = (tu + (1.0 / speed)) * DIST(dir);
+				if(t > limit)
+					continue;
+				if(S->mark[cell] == 2 * S->gen){
+					/* Déjà dans le front : garde le chemin le plus court */
+					vi = S->slot[cell];
+					if(t >= HeapKey(S->heap, vi))
+						continue;
+					HeapDecreaseKey(S->heap, vi, t);
+					S->updates++;
+				}
+				else {
+					vi = SearchNode(r, c);
+					HeapPush(S->heap, vi, t);
+				}
+				v = &S->nodes[vi];
+				v->travel_time[comp] 		= t;
+				v->avg_travel_time[comp] 	= (avg + (1.0 / celerity)) * DIST(dir);
+				v->var_of_flow_time[comp] 	= (var + 2.0 * disp / pow(celerity, 3.0)) * DIST(dir);
+				v->portion[comp] 			= LAYER(ur,uc)->portion[dir];
+			}
+			/* Le noeud traité est recyclé */
+			S->free_nodes[S->nfree++] = ui;
+		}
+	}
+	
+	/* **************************************************************************** */
+	/* Identifie les cellules appartenant au bassin de drainage d'une cellule donné */
+	/* **************************************************************************** */
+	
+	void FindBasin(layer *p){
+	
+	static int t;
+	double UpslopeArea[2] = {0.0, 0.0};
+	int capacity[2] = {0, 0};
+	contrib *q;
+	
+	if(search_mode==SEARCH_DIJKSTRA){
+		if(method==1||method==3)
+			BasinDijkstra(p, id, UpslopeArea, capacity);
+		if(method>1)
+			BasinDijkstra(p, id+1, UpslopeArea, capacity);
+	}
+	else
+		BasinBFS(p, UpslopeArea, capacity);
+	
+	/* Réajuste la taille des blocs de mémoire contenant les contributeurs */
+	for(k=id;k<=id+1;k++)
+		if(p->contribCells[k] && capacity[k] > p->nbContribCells[k])
+			p->contribCells[k] = (contrib *)G_realloc(p->contribCells[k], p->nbContribCells[k]*sizeof(contrib));
+	contrib_records += p->nbContribCells[id] + p->nbContribCells[id+1];
+	
+	/* Calcule la fonction de réponse UHT du bassin de drainage (si elle est allouée) */
+	if(p->UHTsf || p->UHTssf){
 	 for(t=1;t<=num_inputs;t++)
 	{
-		 for(iter=0;iter<MAX(p->nbContribCells[id],p->nbContribCells[id+1]);iter++)
+		 for(iter=1;iter<MAX(p->nbContribCells[id],p->nbContribCells[id+1]);iter++)
 		{
-			if(iter<p->nbContribCells[id])
-				p->UHTsf[t] += p->contribCells[iter].portion[id]*FlowPathUnitResponse(&p->contribCells[iter],id,t);
-			if(iter<p->nbContribCells[id+1])
-				p->UHTssf[t] += p->contribCells[iter].portion[id+1]*FlowPathUnitResponse(&p->contribCells[iter],id+1,t);
+			if(p->UHTsf && iter<p->nbContribCells[id]){
+				q = &p->contribCells[id][iter];
+				p->UHTsf[t] += q->portion*FlowPathUnitResponse(q,t);
+			}
+			if(p->UHTssf && iter<p->nbContribCells[id+1]){
+				q = &p->contribCells[id+1][iter];
+				p->UHTssf[t] += q->portion*FlowPathUnitResponse(q,t);
+			}
 		}
-		if(p->nbContribCells[id])	
+		if(p->UHTsf && UpslopeArea[id]>0.0)	
 			p->UHTsf[t] /= UpslopeArea[id];
-		if(p->nbContribCells[id+1])	
+		if(p->UHTssf && UpslopeArea[id+1]>0.0)	
 			p->UHTssf[t] /= UpslopeArea[id+1];
 	}	
-		
-	/* Détruit la file d'attente */
-	DestroyQueue(queue);
+	}
 
 	return;
 	}
 	
+	/* ************************************************************************ */
+	/* Ouvre le fichier d'état d'une exécution précédente et vérifie l'en-tête  */
+	/* ************************************************************************ */
+	
+	FILE *OpenState(const char *name){
+	
+	FILE *fp;
+	struct StateHeader header;
+	
+		fp = fopen(name, "rb");
+		if(fp==NULL)
+			G_fatal_error(_("Impossible d ouvrir le fichier d etat <%s>"), name);
+		
+		if(fread(&header, sizeof(struct StateHeader), 1, fp)!=1 || strncmp(header.magic, "RWBSTATE", 8)!=0)
+			G_fatal_error(_("<%s> n est pas un fichier d etat valide"), name);
+		if(header.nrows!=nrows || header.ncols!=ncols)
+			G_fatal_error(_("Les dimensions du fichier d etat <%s> (%dx%d) ne correspondent pas a la region courante (%dx%d)"),
+						  name, header.nrows, header.ncols, nrows, ncols);
+		if(header.method!=method)
+			G_fatal_error(_("Le fichier d etat <%s> a ete cree avec la methode <%s>"), name, menu[header.method].name);
+		if(header.hist_len>header.steps)
+			G_fatal_error(_("Historique du ruissellement incoherent dans le fichier d etat <%s>"), name);
+		
+		if(header.version!=1 && header.version!=STATE_VERSION)
+			G_fatal_error(_("Version %d du fichier d etat <%s> inconnue"), header.version, name);
+		
+		t_offset = (int)header.steps;
+		state_hist_len = header.hist_len;
+		state_version = header.version;
+		
+		G_verbose_message(_("Reprise a chaud a partir du pas de temps %d"), t_offset+1);
+		
+		return fp;
+	}
+	
+	/* ************************************************************** */
+	/* Lit l'état sauvegardé d'une cellule dans le fichier d'état     */
+	/* ************************************************************** */
+	
+	void LoadState(FILE *fp, layer *p){
+	
+	double state[10], hist;
+	int32_t nev, step;
+	int t;
+	
+		if(fread(state, sizeof(double), 10, fp)!=10)
+			G_fatal_error(_("Fin prematuree du fichier d etat <%s>"), parm.state_in->answer);
+		
+		SWC(p)[0]	= state[0];
+		p->paw		= state[1];
+		p->sraw		= 0.0;
+		p->pe		= state[2];
+		p->p		= state[3];
+		p->pet		= state[4];
+		p->aet		= state[5];
+		p->qinsf	= state[6];
+		p->qinssf	= state[7];
+		p->qoutsf	= state[8];
+		p->qoutssf	= state[9];
+		
+		if(method<=1)
+			return;
+		
+		/* Version 1 : historique complet des derniers pas de temps de l'eau disponible au ruissellement,
+		   version 2 : événements encore actifs (pas de temps, quantité), toujours en double précision */
+		if(state_version==1){
+			for(t = t_offset - state_hist_len; t < t_offset; t++){
+				if(fread(&hist, sizeof(double), 1, fp)!=1)
+					G_fatal_error(_("Fin prematuree du fichier d etat <%s>"), parm.state_in->answer);
+				if(hist > 0.0)
+					EventAppend(events, &p->raw, t, hist);
+			}
+			return;
+		}
+		if(fread(&nev, sizeof(int32_t), 1, fp)!=1)
+			G_fatal_error(_("Fin prematuree du fichier d etat <%s>"), parm.state_in->answer);
+		for(t = 0; t < nev; t++){
+			if(fread(&step, sizeof(int32_t), 1, fp)!=1 || fread(&hist, sizeof(double), 1, fp)!=1)
+				G_fatal_error(_("Fin prematuree du fichier d etat <%s>"), parm.state_in->answer);
+			EventAppend(events, &p->raw, step, hist);
+		}
+		return;
+	}
+	
+	/* ************************************************************************ */
+	/* Nombre de pas de temps pendant lesquels l'eau en excès d'un pas atteint  */
+	/* encore une cellule aval : plus grande fin de fenêtre des fonctions de    */
+	/* réponse de subsurface, sans la limite de l'horizon de calcul. Sans       */
+	/* fenêtre (epsilon=0), tous les événements restent utiles.                */
+	/* ************************************************************************ */
+	
+	static int EventReach(void){
+	
+	const KernelClass *kc;
+	int i, reach = 0;
+	
+		if(kernel_eps <= 0.0 || !kernels)
+			return INT_MAX;
+		for(i = 0; i < kernels->nclasses; i++){
+			kc = &kernels->classes[i];
+			if(kc->comp != id+1)
+				continue;
+			reach = MAX(reach, FirstStepAbove(kc->mu, kc->lambda, 1.0 - 0.5 * kernel_eps, STATE_MAX_REACH));
+		}
+		return reach;
+	}
+	
+	/* ****************************************************************** */
+	/* Sauvegarde l'état de fin de calcul pour une reprise ultérieure     */
+	/* ****************************************************************** */
+	
+	void SaveState(const char *name){
+	
+	FILE *fp;
+	struct StateHeader header;
+	double state[10], hist;
+	layer *p;
+	const EventBlock *b;
+	long steps, first, saved = 0;
+	int32_t nev, step;
+	int j, reach;
+	
+		G_verbose_message(_("Sauvegarde de l etat de fin de calcul dans <%s>..."), name);
+	
+		fp = fopen(name, "wb");
+		if(fp==NULL)
+			G_fatal_error(_("Impossible de creer le fichier d etat <%s>"), name);
+		
+		/* Seuls les événements que les fonctions de réponse atteignent encore après le dernier pas sont gardés */
+		steps 	= (long)t_offset + num_inputs;
+		reach 	= (method>1) ? EventReach() : 0;
+		first 	= (reach >= steps) ? 0 : steps - reach;
+		
+		memset(&header, 0, sizeof(struct StateHeader));
+		memcpy(header.magic, "RWBSTATE", 8);
+		header.version 	= STATE_VERSION;
+		header.nrows 	= nrows;
+		header.ncols 	= ncols;
+		header.method 	= method;
+		header.steps 	= steps;
+		header.hist_len = (int)(steps - first);
+		
+		if(fwrite(&header, sizeof(struct StateHeader), 1, fp)!=1)
+			G_fatal_error(_("Erreur d ecriture du fichier d etat <%s>"), name);
+
+		for (row = 0; row < nrows; row++)
+		{
+			G_percent(row, nrows, 2);
+			for (col = 0; col < ncols; col++)
+			{
+				p = LAYER(row,col);
+				
+				state[0] = SWC(p)[SWC_SLOT(num_inputs-1)];
+				state[1] = p->paw;
+				state[2] = p->pe;
+				state[3] = p->p;
+				state[4] = p->pet;
+				state[5] = p->aet;
+				state[6] = p->qinsf;
+				state[7] = p->qinssf;
+				state[8] = p->qoutsf;
+				state[9] = p->qoutssf;
+				
+				if(fwrite(state, sizeof(double), 10, fp)!=10)
+					G_fatal_error(_("Erreur d ecriture du fichier d etat <%s>"), name);
+				if(method<=1)
+					continue;
+				
+				/* Evénements encore actifs : leur nombre puis (pas de temps, quantité). La liste est parcourue depuis
+				   son début, le curseur du routage (EventForget) a pu dépasser des événements utiles à la reprise */
+				nev = 0;
+				for(b = p->raw.head; b; b = b->next)
+					for(j = 0; j < b->n; j++)
+						nev += (b->ev[j].step >= first);
+				if(fwrite(&nev, sizeof(int32_t), 1, fp)!=1)
+					G_fatal_error(_("Erreur d ecriture du fichier d etat <%s>"), name);
+				for(b = p->raw.head; b; b = b->next)
+					for(j = 0; j < b->n; j++){
+						if(b->ev[j].step < first)
+							continue;
+						step = b->ev[j].step;
+						hist = (double)b->ev[j].amount;
+						if(fwrite(&step, sizeof(int32_t), 1, fp)!=1 || fwrite(&hist, sizeof(double), 1, fp)!=1)
+							G_fatal_error(_("Erreur d ecriture du fichier d etat <%s>"), name);
+					}
+				saved += nev;
+			}
+		}
+		G_percent(1, 1, 1);
+		
+		fclose(fp);
+		if(method>1)
+			G_verbose_message(_("%ld evenements des %d derniers pas de temps sauvegardes"), saved, header.hist_len);
+		return;
+	}
+	
 	/* ********************************************** */
 	/* Initialise la carte avec les options de calcul */
 	/* ********************************************** */
@@ -2230,11 +3287,24 @@
 		******************/
 		AllocateMemory();
 		ReadInputLayer();
+		
+		/* Les listes d'événements d'eau en excès sont prises dans une arène commune */
+		if(method>1)
+			events = CreateEventArena();
+		
+		/* Les contributeurs de même fonction de réponse partagent une classe du réservoir */
+		if(method>0)
+			kernels = CreateKernelPool(kernel_quantum);
+		
+		/* Calcul hors mémoire : les listes de contributeurs sont écrites par tuiles à mesure que les bassins sont identifiés */
+		if(method>0 && tile_mb > 0.0)
+			tiles = CreateTileStore(nrows, ncols, (size_t)(tile_mb * 1048576.));
 
-		layer **ptr = landscape;
 
 						
 		G_verbose_message(_("Initialisation de la carte en cours..."));
+		if(pager)
+			pager->phase = PAGE_INIT;
 
 		for (row = 0; row < nrows; row++)
 		{
@@ -2242,69 +3312,714 @@
 
 			for (col = 0; col < ncols; col++)
 			{
-				Segment_get(&parms_seg, &parms, row, col);
+				ParmGet(row, col, &parms);
 				
 				/* Conditions initiales */
-				ptr[row][col].swc[0]= parms.sat; /* Initialise la teneur en eau à la saturation */
-				ptr[row][col].paw	= parms.rum; /* et la réserve utile à la réserve utile maximale */
+				SWC(LAYER(row,col))[0]= parms.sat; /* Initialise la teneur en eau à la saturation */
+				LAYER(row,col)->paw	= parms.rum; /* et la réserve utile à la réserve utile maximale */
 
 				/* Identifie la couche comme une "zone humide" ou une "surface en eau" */
-				if(flag6){
-					ptr[row][col].waterbodies	= (short)waterbodies[row][col];
-					ptr[row][col].riparian 		= (short)riparian[row][col];
+				if(flag6->answer){
+					LAYER(row,col)->waterbodies	= (short)waterbodies[row][col];
+					LAYER(row,col)->riparian 		= (short)riparian[row][col];
 				}
-				/* Connecte la cellules à ses voisines à travers l'algorithme de calcul de l'aire de drainage amont */
 				if(method>0){
-					switch(algorithm){
-						case 0:
-							D_8(row, col);
-						break;
-						case 1:
-							D_Inf(row, col);
-						break;
-						case 2:
-							MFD_8(row, col);
-						break;
-						case 3:
-							MFD_md(row, col);
-						break;
-						case 4:
-							MFD_Inf(row, col);
-						break;					
-					}
 					if(method==1||method==3){
-						ptr[row][col].smax 	= smax[row][col];
-						ptr[row][col].w1 	= w1[row][col];
-						ptr[row][col].w2 	= w2[row][col];
-						ptr[row][col].UHTsf = NULL;//dvector(1,num_inputs);
+						LAYER(row,col)->smax 	= smax[row][col];
+						LAYER(row,col)->ew1 	= exp(w1[row][col]);
+						LAYER(row,col)->w2 	= w2[row][col];
+						LAYER(row,col)->UHTsf = NULL;//rvector(1,num_inputs);
 					}
 					if(method>1){
-						ptr[row][col].raw 	 = (double *)G_calloc(num_inputs, sizeof(double));
-						ptr[row][col].braw 	 = NULL;//(double *)G_calloc(num_inputs*sizeof(double));						
-						ptr[row][col].UHTssf = NULL;//dvector(1,num_inputs);
+						LAYER(row,col)->braw 	 = NULL;//(double *)G_calloc(num_inputs*sizeof(double));						
+						LAYER(row,col)->UHTssf = NULL;//rvector(1,num_inputs);
 					}		
 				}
+				/* Reprise à chaud : remplace les conditions initiales par l'état de fin de l'exécution précédente */
+				if(state_fp)
+					LoadState(state_fp, LAYER(row,col));
 			}
 		}
 	G_percent(1, 1, 1);
 	Cleanup();
 	
+		if(state_fp){
+			fclose(state_fp);
+			state_fp = NULL;
+		}
+	
 		if(method>0){
+		/* Connecte les cellules à leurs voisines à travers l'algorithme de calcul de l'aire de drainage amont */
+		if(pager)
+			pager->phase = PAGE_FLOWDIR;
+		if(depression_mode==DEPRESSIONS_FILL)
+			ConditionAltitude();
+		FlowDirections();
+		G_free(alt_dem);
+		alt_dem = NULL;
+		
+		/* La recherche des bassins remonte les versants dans toutes les directions : tuiles carrées */
+		RetileSEGMENT(SEG_SQUARE);
+		if(pager)
+			pager->phase = PAGE_BASIN;
+		
+		double start = TimeNow();
 		G_verbose_message(_("Preparation de la carte pour le calcul du ruissellement..."));
 				for (row = 0; row < nrows; row++)
 			{	
 				G_percent(row, nrows, 2);
 					for (col = 0; col < ncols; col++)
 				{
-					Segment_get(&parms_seg, &parms, row, col);				
-					FindBasin(&ptr[row][col]);
+					ParmGet(row, col, &parms);
+					FindBasin(LAYER(row,col));
 				}
+				/* Les contributeurs dépassent la mémoire prévue : passe hors mémoire à la fin de la bande */
+				if(!tiles && mem_plan.contrib_budget_mb > 0.0 && (row+1) % TILE_SIZE == 0
+					&& contrib_records * (double)sizeof(contrib) > mem_plan.contrib_budget_mb * 1048576.)
+					SwitchToTiles(row / TILE_SIZE);
+				if(tiles && ((row+1) % TILE_SIZE == 0 || row == nrows-1))
+					FlushContributorTiles(row / TILE_SIZE);
 			}
 			G_percent(1, 1, 1);
+			FreeBasinSearch();
+			
+			if(method>1 && routing_mode==1)
+				BuildOutgoingKernels();
+			basin_time = TimeNow() - start;
 		}
 	
 	}	
 	
+	/* ************************************************************************* */
+	/* Connecte chaque cellule à ses voisines aval selon algorithm=. La grille   */
+	/* est parcourue ligne par ligne dans la fenêtre glissante des altitudes.    */
+	/* ************************************************************************* */
+	
+	void FlowDirections(void){
+	
+	double start = TimeNow();
+	
+		G_verbose_message(_("Calcul des directions d ecoulement..."));
+		OpenAltitudeWindow();
+		for (row = 0; row < nrows; row++)
+		{
+			G_percent(row, nrows, 2);
+			AdvanceAltitudeWindow(row);
+			
+			switch(algorithm){
+				case 0:
+					for (col = 0; col < ncols; col++) D_8(row, col);
+				break;
+				case 1:
+					for (col = 0; col < ncols; col++) D_Inf(row, col);
+				break;
+				case 2:
+					for (col = 0; col < ncols; col++) MFD_8(row, col);
+				break;
+				case 3:
+					for (col = 0; col < ncols; col++) MFD_md(row, col);
+				break;
+				case 4:
+					for (col = 0; col < ncols; col++) MFD_Inf(row, col);
+				break;					
+			}
+		}
+		G_percent(1, 1, 1);
+		CloseAltitudeWindow();
+		flowdir_time = TimeNow() - start;
+	}
+	
+	/* ************************************************************************* */
+	/* Inverse les bassins de drainage : chaque contributeur d'une cellule aval  */
+	/* reçoit une fonction de réponse sortante vers celle-ci (routing=push).     */
+	/* Alloue aussi l'anneau des apports futurs de chaque cellule, assez long    */
+	/* pour couvrir la plus longue fenêtre de ses fonctions de réponse entrantes */
+	/* ************************************************************************* */
+	
+	void BuildOutgoingKernels(void){
+	
+	layer *c, *s;
+	const contrib *q;
+	const EventBlock *b;
+	outkernel *o;
+	real *r;
+	size_t total;
+	int j, len;
+	
+		G_verbose_message(_("Inversion des bassins de drainage..."));
+		
+		/* Compte les fonctions de réponse sortantes de chaque cellule */
+		for (row = 0; row < nrows; row++)
+			for (col = 0; col < ncols; col++){
+				c = LAYER(row,col);
+				q = GetContributors(c, id+1, row, col);
+				for(iter = 0; iter < c->nbContribCells[id+1]; iter++)
+					CONTRIB_LAYER(&q[iter])->nout++;
+			}
+		
+		/* Les fonctions de réponse sortantes de toutes les cellules sont découpées dans un seul bloc */
+		total = 0;
+		for (row = 0; row < nrows; row++)
+			for (col = 0; col < ncols; col++)
+				total += LAYER(row,col)->nout;
+		outk_slab 	= (outkernel *)G_malloc(MAX(total, 1) * sizeof(outkernel));
+		o 			= outk_slab;
+		for (row = 0; row < nrows; row++)
+			for (col = 0; col < ncols; col++){
+				c 		= LAYER(row,col);
+				c->outk = c->nout ? o : NULL;
+				o 	   += c->nout;
+				c->nout = 0;
+			}
+		
+		/* Longueur de l'anneau de chaque cellule : la plus longue fenêtre de ses fonctions de réponse entrantes */
+		total = 0;
+		for (row = 0; row < nrows; row++)
+			for (col = 0; col < ncols; col++){
+				c 	= LAYER(row,col);
+				len = 1;
+				q 	= GetContributors(c, id+1, row, col);
+				for(iter = 0; iter < c->nbContribCells[id+1]; iter++, q++){
+					s 	= CONTRIB_LAYER(q);
+					s->outk[s->nout].target = c;
+					s->outk[s->nout].cls 	= q->cls;
+					s->outk[s->nout].outlet = (iter==0);
+					s->nout++;
+					len = MAX(len, KCLASS(q)->t_max + 1);
+				}
+				c->ring_len = len;
+				total 	   += 2 * len;
+			}
+		
+		/* Les anneaux des apports futurs sont découpés dans un seul bloc, dans l'ordre des lignes */
+		ring_slab 	= (real *)G_calloc(total, sizeof(real));
+		r 			= ring_slab;
+		for (row = 0; row < nrows; row++)
+			for (col = 0; col < ncols; col++){
+				c 			= LAYER(row,col);
+				c->ring_in 	= r;
+				c->ring_out = r + c->ring_len;
+				r 		   += 2 * c->ring_len;
+			}
+		
+		/* Reprise à chaud : diffuse vers les pas de temps à venir l'eau en excès des exécutions précédentes */
+		if(t_offset > 0)
+			for (row = 0; row < nrows; row++)
+				for (col = 0; col < ncols; col++){
+					c = LAYER(row,col);
+					for(b = c->raw.head; b; b = b->next)
+						for(j = 0; j < b->n; j++)
+							ScatterExcess(c, b->ev[j].step, b->ev[j].amount, t_offset);
+				}
+	}
+	
+	/* ********************************************************************** */
+	/* Diffuse l'eau en excès d'une cellule à la fin du pas de temps step     */
+	/* dans les anneaux des cellules aval, pour les pas de temps >= first     */
+	/* ********************************************************************** */
+	
+	void ScatterExcess(layer *c, int step, double amount, int first){
+	
+	outkernel *o;
+	const KernelClass *kc;
+	real *ring;
+	int j, lag, lo;
+	
+		for(j = 0; j < c->nout; j++){
+			o 		= &c->outk[j];
+			kc 		= &kernels->classes[o->cls];
+			ring 	= o->outlet ? o->target->ring_out : o->target->ring_in;
+			lo 		= MAX(kc->t_min, first - step);
+			for(lag = lo; lag <= kc->t_max; lag++)
+				ring[(step + lag) % o->target->ring_len] += (real)(amount * kc->table[lag - kc->t_min]);
+			kernel_visits += MAX(kc->t_max - lo + 1, 0);
+		}
+	}
+	
+	/* ********************************************************************** */
+	/* Récupère le ruissellement de subsurface entrant et sortant d'une       */
+	/* cellule accumulé dans son anneau pour le pas de temps courant          */
+	/* ********************************************************************** */
+	
+	void CollectSubsurface(layer *c, int n, double *qin, double *qout){
+	
+	int slot;
+	
+		*qin = *qout = 0.0;
+		if(c->ring_len == 0)
+			return;
+		slot 				= (t_offset + n) % c->ring_len;
+		*qin 				= (double)c->ring_in[slot];
+		*qout 				= (double)c->ring_out[slot];
+		c->ring_in[slot] 	= 0.0;
+		c->ring_out[slot] 	= 0.0;
+	}
+	
+	/* ****************************************************************** */
+	/* Calcule le ruissellement de surface entrant et sortant d'une cellule */
+	/* ****************************************************************** */
+	
+	void SurfaceRouting(layer *c, double *qin, double *qout){
+	
+	layer *tmp;
+	const contrib *list = GetContributors(c, id, row, col), *q;
+	
+		*qin = *qout = 0.0;
+		
+		/* L'eau en excès à la surface (sraw) est celle du pas de temps courant, même quand la sortie PE
+		   la cumule sur la période (options 2 et 3) : chaque pas de temps n'est routé qu'une fois */
+		for(iter=0;iter<c->nbContribCells[id];iter++){
+			q = &list[iter];
+			/* La fonction de réponse n'a pas de masse sur le premier pas de temps */
+			if(KCLASS(q)->t_min > 1){
+				kernel_skips++;
+				continue;
+			}
+			tmp = CONTRIB_LAYER(q);
+			if(tmp->sraw<=0.0)
+				continue;
+			kernel_visits++;
+			if(iter==0)
+				*qout += tmp->sraw * StepResponse(q, 1);
+			else *qin += tmp->sraw * StepResponse(q, 1);
+		}
+		return;
+	}
+	
+	/* ********************************************************************** */
+	/* Calcule le ruissellement de subsurface entrant et sortant d'une cellule */
+	/* ********************************************************************** */
+	
+	void SubsurfaceRouting(layer *c, int n, double *qin, double *qout){
+	
+	layer *tmp;
+	const contrib *list = GetContributors(c, id+1, row, col), *q;
+	const EventBlock *b;
+	const ExcessEvent *e;
+	int j, lo, hi, visited;
+	int T = t_offset + n;
+	
+		*qin = *qout = 0.0;
+		
+		/* Convolue les événements d'eau disponible au ruissellement de chaque cellule amont. L'eau en excès à la fin
+		   du pas de temps m s'écoule à partir du pas suivant avec le décalage T-m : seuls les événements dont le décalage
+		   est dans la fenêtre [t_min, t_max] du contributeur sont parcourus. */
+		for(iter=0;iter<c->nbContribCells[id+1];iter++){
+			q 	= &list[iter];
+			tmp = CONTRIB_LAYER(q);
+			if(tmp->raw.count == 0)
+				continue;
+			lo 	= T - KCLASS(q)->t_max;
+			hi 	= T - KCLASS(q)->t_min;
+			visited = 0;
+			/* Aucune fenêtre ne remonte avant T - event_reach, qui ne diminue pas d'un pas au suivant */
+			EventForget(&tmp->raw, T - event_reach);
+			for(b = EventSeek(&tmp->raw, lo); b; b = b->next){
+				for(j = 0, e = b->ev; j < b->n && e->step <= hi; j++, e++){
+					if(e->step < lo)
+						continue;
+					visited++;
+					if(iter==0)
+						*qout +=  e->amount * StepResponse(q, T - e->step);
+					else *qin +=  e->amount * StepResponse(q, T - e->step);
+				}
+				if(j < b->n)
+					break;
+			}
+			kernel_visits += visited;
+			kernel_skips  += tmp->raw.count - visited;
+		}
+		return;
+	}
+	
+	/* ************************************************************************************ */
+	/* Noyau de calcul du bilan hydrique d'une cellule.                                     */
+	/* METHOD, ROUTING (routing=push), ACCUM (cumul sur la période) et ZONE (zone          */
+	/* alluviale, flag -z) sont des constantes à chaque instanciation (voir                 */
+	/* DEFINE_CELL_KERNEL) : le compilateur élimine les branches inutiles et chaque         */
+	/* combinaison d'options produit un noyau sans test.                                    */
+	/* L'eau en excès f->pe est calculée pour toute la ligne par l'appelant.                */
+	/* ************************************************************************************ */
+	
+	static inline void CellKernel(layer *c, const struct Parm *pp, int n, double rain, double etp, struct cell_flux *f,
+								  const int METHOD, const int ROUTING, const int ACCUM, const int ZONE){
+	
+	double aet, water;
+	
+		f->aet = f->qinsf = f->qoutsf = f->qinssf = f->qoutssf = 0.0;
+		
+		/* Reporte la teneur en eau du pas de temps précédent */
+		if(n>0)
+			SWC(c)[swc_cur] = SWC(c)[swc_prev];
+		
+		/*****************************************
+		 * Calcul de l'évapotranspiration réelle *
+		 *****************************************/
+		if( (ZONE && c->waterbodies) || rain-etp >= 0.0 )
+			aet = etp;
+		else if (pp->rum==0.0)
+			aet = EPS;
+		else
+			aet = c->paw + rain - MAX(c->paw*exp((rain-etp)/pp->rum), 0.0);
+		
+		c->p	= ACCUM ? c->p + rain 	: rain;
+		c->pet	= ACCUM ? c->pet + etp 	: etp;
+		c->aet	= ACCUM ? c->aet + aet 	: aet;
+		f->aet	= aet;
+		
+		/**************************************
+		 * Calcul du ruissellement de surface *
+		 **************************************/
+		if(METHOD==1 || METHOD==3){
+			/* (l'eau en excès de toute la ligne est déjà calculée : c->sraw est à jour pour toutes ses cellules) */
+			
+			/* calcule le ruissellement entrant et sortant */
+			SurfaceRouting(c, &f->qinsf, &f->qoutsf);
+			
+			c->qinsf	= ACCUM ? c->qinsf + f->qinsf 	: f->qinsf;
+			c->qoutsf	= ACCUM ? c->qoutsf + f->qoutsf : f->qoutsf;
+		}
+		
+		/*****************************************
+		 * Calcul du ruissellement de subsurface *
+		 *****************************************/
+		if(METHOD==2 || METHOD==3){
+		
+			/* calcule le ruissellement entrant et sortant */
+			if(ROUTING)
+				CollectSubsurface(c, n, &f->qinssf, &f->qoutssf);
+			else
+				SubsurfaceRouting(c, n, &f->qinssf, &f->qoutssf);
+			
+			c->qinssf	= ACCUM ? c->qinssf + f->qinssf 	: f->qinssf;
+			c->qoutssf	= ACCUM ? c->qoutssf + f->qoutssf 	: f->qoutssf;
+		}
+		
+		/*************************************
+		 * Calcul de la teneur en eau du sol *
+		 *************************************/
+		water = SWC(c)[swc_cur] + rain - aet + f->qinsf - f->qoutsf + f->qinssf - f->qoutssf;
+		SWC(c)[swc_cur] = SoilWaterContent(c, pp, water, ZONE);
+		
+		/* L'eau au-delà de la capacité au champ est disponible au ruissellement de subsurface à partir du pas suivant */
+		if((METHOD==2 || METHOD==3) && SWC(c)[swc_cur] > pp->fc){
+			EventAppend(events, &c->raw, t_offset + n, SWC(c)[swc_cur] - pp->fc);
+			if(ROUTING)
+				ScatterExcess(c, t_offset + n, SWC(c)[swc_cur] - pp->fc, t_offset + n + 1);
+		}
+		
+		/*************************************
+		 * Calcul de la réserve utile du sol *
+		 *************************************/
+		c->paw = PlantAvailableWater(c, pp, SWC(c)[swc_cur], ZONE);
+		
+		return;
+	}
+	
+	/* *************************************************************** */
+	/* Teneur en eau du sol bornée par la saturation (et la capacité au */
+	/* champ dans la zone alluviale)                                    */
+	/* *************************************************************** */
+	
+	static inline double SoilWaterContent(const layer *c, const struct Parm *pp, double water, const int ZONE){
+		if(ZONE && c->waterbodies)
+			return pp->sat;
+		if(ZONE && c->riparian)
+			return MAX(MIN(water, pp->sat), pp->fc);
+		return MIN(water, pp->sat);
+	}
+	
+	/* ************************************************************ */
+	/* Réserve utile du sol correspondant à une teneur en eau donnée */
+	/* ************************************************************ */
+	
+	static inline double PlantAvailableWater(const layer *c, const struct Parm *pp, double swc, const int ZONE){
+		if( (ZONE && c->waterbodies) || swc >= pp->fc )
+			return pp->rum;
+		return MIN(pp->rum - (pp->fc - swc), 0.0);
+	}
+	
+	/* Instancie un noyau par combinaison (méthode, routage de subsurface, cumul, zone alluviale) */
+	#define DEFINE_CELL_KERNEL(M, R, A, Z) \
+	static void CellKernel_##M##_##R##_##A##_##Z(layer *c, const struct Parm *pp, int n, double rain, double etp, struct cell_flux *f){ \
+		CellKernel(c, pp, n, rain, etp, f, M, R, A, Z); \
+	}
+	#define DEFINE_CELL_KERNELS_Z(M, R, A)	DEFINE_CELL_KERNEL(M, R, A, 0) DEFINE_CELL_KERNEL(M, R, A, 1)
+	#define DEFINE_CELL_KERNELS_A(M, R)		DEFINE_CELL_KERNELS_Z(M, R, 0) DEFINE_CELL_KERNELS_Z(M, R, 1)
+	#define DEFINE_CELL_KERNELS_R(M)		DEFINE_CELL_KERNELS_A(M, 0) DEFINE_CELL_KERNELS_A(M, 1)
+	
+	DEFINE_CELL_KERNELS_R(0)
+	DEFINE_CELL_KERNELS_R(1)
+	DEFINE_CELL_KERNELS_R(2)
+	DEFINE_CELL_KERNELS_R(3)
+	
+	#define CELL_KERNELS_Z(M, R, A)	{ CellKernel_##M##_##R##_##A##_0, CellKernel_##M##_##R##_##A##_1 }
+	#define CELL_KERNELS_A(M, R)	{ CELL_KERNELS_Z(M, R, 0), CELL_KERNELS_Z(M, R, 1) }
+	#define CELL_KERNELS_R(M)		{ CELL_KERNELS_A(M, 0), CELL_KERNELS_A(M, 1) }
+	
+	/* Table des noyaux indexée par [méthode][routage de subsurface][cumul][zone alluviale] */
+	static const cell_kernel cell_kernels[4][2][2][2] = {
+		CELL_KERNELS_R(0), CELL_KERNELS_R(1), CELL_KERNELS_R(2), CELL_KERNELS_R(3)
+	};
+	
+	/* ******************************************************************** */
+	/* Sélectionne le noyau de calcul correspondant aux options d'un pas de temps */
+	/* ******************************************************************** */
+	
+	cell_kernel SelectCellKernel(int accumulate){
+		return cell_kernels[method][routing_mode==1 ? 1 : 0][accumulate ? 1 : 0][flag6->answer ? 1 : 0];
+	}
+	
+	/* ******************************************************************* */
+	/* Inscrit les sorties d'une cellule dans les tampons des cartes raster */
+	/* ******************************************************************* */
+	
+	void StoreCellOutputs(struct output *out, const int *types, int col, const layer *c, const struct Parm *pp,
+						  const struct cell_flux *f, double etp, int origin){
+	
+	double swc;
+	
+		for (i = 0; i < num_outputs_names; i++){
+			switch(types[i]){
+				case OUT_DE:
+					out[i].buf[col] = (options==1) ? (DCELL)(etp-f->aet):(DCELL)(c->pet-c->aet);
+				break;
+				
+				case OUT_PAW:
+					if(options==1 || !origin){
+						out[i].buf[col] = (DCELL)(c->paw);
+					}
+					else{
+						swc = SoilWaterContent(c, pp, SWC(c)[SWC_SLOT(origin)] + c->p - c->aet + c->qinsf - c->qoutsf + c->qinssf - c->qoutssf, flag6->answer);
+						out[i].buf[col] = (DCELL)PlantAvailableWater(c, pp, swc, flag6->answer);
+					}
+				break;
+				
+				case OUT_SWC:
+					if(options==1)
+						out[i].buf[col] = (DCELL)SWC(c)[SWC_SLOT(origin)];
+					else
+						out[i].buf[col] = (DCELL)SoilWaterContent(c, pp, SWC(c)[SWC_SLOT(origin)] + c->p - c->aet + c->qinsf - c->qoutsf + c->qinssf - c->qoutssf, flag6->answer);
+				break;
+				
+				case OUT_QINSSF:
+					out[i].buf[col] = (options==1) ? (DCELL)f->qinssf:(DCELL)(c->qinssf);
+				break;
+				
+				case OUT_QOUTSSF:
+					out[i].buf[col] = (options==1) ? (DCELL)f->qoutssf:(DCELL)(c->qoutssf);
+				break;
+				
+				case OUT_QINSF:
+					out[i].buf[col] = (options==1) ? (DCELL)f->qinsf:(DCELL)(c->qinsf);
+				break;
+				
+				case OUT_QOUTSF:
+					out[i].buf[col] = (options==1) ? (DCELL)f->qoutsf:(DCELL)(c->qoutsf);
+				break;
+				
+				case OUT_PE:
+					out[i].buf[col] = (options==1) ? (DCELL)f->pe:(DCELL)(c->pe);
+				break;
+			}
+		}
+		return;
+	}
+	
+	/* ************************************************************************** */
+	/* Construit le masque des cellules nulles d'une ligne et la liste des indices */
+	/* des colonnes à calculer. Retourne le nombre de colonnes valides.            */
+	/* ************************************************************************** */
+	
+	int RowNullMask(const DCELL *rain, const DCELL *etp, unsigned char *mask, int *valid){
+	
+	int c, nvalid;
+	
+		/* Une valeur nulle DCELL est codée par un NaN : la comparaison x != x la détecte
+		sans appel de fonction et la boucle peut être vectorisée par le compilateur */
+		for (c = 0; c < ncols; c++)
+			mask[c] = (rain[c] != rain[c]) | (etp[c] != etp[c]);
+		
+		/* Compaction sans branchement des indices des colonnes non nulles */
+		for (c = 0, nvalid = 0; c < ncols; c++){
+			valid[nvalid] = c;
+			nvalid += !mask[c];
+		}
+		return nvalid;
+	}
+	
+	/* ******************************************************* */
+	/* Alloue / libère les tampons du noyau climatique par ligne */
+	/* ******************************************************* */
+	
+	struct climate_row *CreateClimateRow(int n){
+	
+	struct climate_row *w = (struct climate_row *)G_malloc(sizeof(struct climate_row));
+	
+		w->rain = (double *)G_malloc(10 * n * sizeof(double));
+		w->etp 	= w->rain + n;
+		w->sat 	= w->etp + n;
+		w->fc 	= w->sat + n;
+		w->rum 	= w->fc + n;
+		w->paw 	= w->rum + n;
+		w->swc 	= w->paw + n;
+		w->aet 	= w->swc + n;
+		w->wb 	= w->aet + n;
+		w->rip 	= w->wb + n;
+		w->cell = (layer **)G_malloc(n * sizeof(layer *));
+		return w;
+	}
+	
+	void DestroyClimateRow(struct climate_row *w){
+		if(!w)
+			return;
+		G_free(w->rain);
+		G_free(w->cell);
+		G_free(w);
+	}
+	
+	/* ************************************************************************************ */
+	/* Bilan climatique (method=climat) d'une ligne entière : même calcul que CellKernel    */
+	/* mais sur des tableaux contigus. Chaque branche est évaluée puis choisie par un masque */
+	/* (sélection sans saut) et l'exponentielle est vexp : le compilateur vectorise la      */
+	/* boucle. ZONE est constant à chaque instanciation, comme pour les noyaux par cellule.  */
+	/* ************************************************************************************ */
+	
+	static inline void ClimateRow(const double *restrict rain, const double *restrict etp, const double *restrict sat,
+								  const double *restrict fc, const double *restrict rum, const double *restrict wb,
+								  const double *restrict rip, double *restrict paw, double *restrict swc, double *restrict aet,
+								  int count, const int ZONE){
+	
+	double d, e, a, s, p, x;
+	int v, water;
+	
+		for (v = 0; v < count; v++){
+			water = ZONE & (wb[v] != 0.0);
+			
+			/* Evapotranspiration réelle */
+			d 	= rain[v] - etp[v];
+			e 	= vexp(d / vselect(rum[v] != 0.0, rum[v], 1.0));
+			x 	= paw[v]*e;
+			a 	= paw[v] + rain[v] - vselect(x > 0.0, x, 0.0);
+			a 	= vselect(rum[v] == 0.0, EPS, a);
+			a 	= vselect((d >= 0.0) | water, etp[v], a);
+			
+			/* Teneur en eau du sol bornée par la saturation (et la capacité au champ dans la zone alluviale) */
+			x 	= swc[v] + rain[v] - a;
+			s 	= vselect(x < sat[v], x, sat[v]);
+			if(ZONE){
+				s 	= vselect((rip[v] != 0.0) & (s < fc[v]), fc[v], s);
+				s 	= vselect(water, sat[v], s);
+			}
+			
+			/* Réserve utile du sol */
+			x 	= rum[v] - (fc[v] - s);
+			p 	= vselect(x < 0.0, x, 0.0);
+			p 	= vselect((s >= fc[v]) | water, rum[v], p);
+			
+			aet[v] 	= a;
+			swc[v] 	= s;
+			paw[v] 	= p;
+		}
+	}
+	
+	WB_VECTORIZE void ClimateRowKernel(struct climate_row *w, int count, int zone){
+		if(zone)
+			ClimateRow(w->rain, w->etp, w->sat, w->fc, w->rum, w->wb, w->rip, w->paw, w->swc, w->aet, count, 1);
+		else ClimateRow(w->rain, w->etp, w->sat, w->fc, w->rum, w->wb, w->rip, w->paw, w->swc, w->aet, count, 0);
+	}
+	
+	/* ************************************************************** */
+	/* Alloue / libère les tampons du calcul de l'eau en excès par ligne */
+	/* ************************************************************** */
+	
+	struct excess_row *CreateExcessRow(int n){
+	
+	struct excess_row *w = (struct excess_row *)G_malloc(sizeof(struct excess_row));
+	
+		w->rain = (double *)G_malloc(7 * n * sizeof(double));
+		w->swc 	= w->rain + n;
+		w->pwp 	= w->swc + n;
+		w->smax = w->pwp + n;
+		w->ew1 	= w->smax + n;
+		w->w2 	= w->ew1 + n;
+		w->pe 	= w->w2 + n;
+		return w;
+	}
+	
+	void DestroyExcessRow(struct excess_row *w){
+		if(!w)
+			return;
+		G_free(w->rain);
+		G_free(w);
+	}
+	
+	/* ************************************************************************************ */
+	/* Eau en excès (SCS-CN) d'une ligne entière : même calcul que CellKernel sur des        */
+	/* tableaux contigus. exp(w1) est précalculé par cellule, S^1.15 de l'abstraction        */
+	/* initiale alternative est calculé une seule fois par vpow (fusion vlog/vexp) et le     */
+	/* seuil de ruissellement est un masque : le compilateur vectorise la boucle.           */
+	/* ************************************************************************************ */
+	
+	static inline void ExcessRow(const double *restrict rain, const double *restrict swc, const double *restrict pwp,
+								 const double *restrict smax, const double *restrict ew1, const double *restrict w2,
+								 double *restrict pe, int count, const int IA){
+	
+	double SW, S, ia, a, b, x;
+	int v;
+	
+		for (v = 0; v < count; v++){
+			/* calcule l'eau disponible en surface */
+			SW 	= swc[v] - pwp[v];
+			SW 	= vselect(SW > 0.0, SW, 0.0);
+			S 	= smax[v] * (1.0 - SW/(SW + ew1[v]*vexp(-w2[v]*SW)));
+			
+			/* abstraction initiale : seuil de ruissellement a et terme b du dénominateur */
+			if(IA){
+				ia 	= 1.33*vpow(S, 1.15);
+				a 	= 0.05*ia;
+				b 	= 0.95*ia;
+				x 	= 0.05*S;
+			}
+			else{
+				a 	= 0.2*S;
+				b 	= 0.8*S;
+				x 	= a;
+			}
+			pe[v] 	= vselect(rain[v] > x, (rain[v] - a)*(rain[v] - a)/(rain[v] + b), 0.0);
+		}
+	}
+	
+	WB_VECTORIZE void ExcessRowKernel(struct excess_row *w, int count, int ia){
+		if(ia)
+			ExcessRow(w->rain, w->swc, w->pwp, w->smax, w->ew1, w->w2, w->pe, count, 1);
+		else ExcessRow(w->rain, w->swc, w->pwp, w->smax, w->ew1, w->w2, w->pe, count, 0);
+	}
+	
+	/* ************************************************************************************ */
+	/* Même calcul cellule par cellule avec exp et pow de la libm, quand les noyaux par     */
+	/* ligne ne sont pas vectorisés (sans WB_ROW_KERNELS). L'eau en excès de la ligne est   */
+	/* calculée avant le ruissellement dans les deux cas : les cartes ne dépendent pas de   */
+	/* la cible de compilation.                                                             */
+	/* ************************************************************************************ */
+	
+	void ExcessRowScalar(struct excess_row *w, int count, int ia){
+	
+	double SW, S;
+	int v;
+	
+		for (v = 0; v < count; v++){
+			/* calcule l'eau disponible en surface */
+			SW 	= MAX(w->swc[v] - w->pwp[v], 0.0);
+			S 	= w->smax[v] * (1.0 - SW/(SW+w->ew1[v]*exp(-w->w2[v]*SW)));
+			
+			if(ia)
+				w->pe[v] = w->rain[v]>0.05*S ? pow(w->rain[v] - 0.05*(1.33*pow(S,1.15)),2.0)/(w->rain[v] + 0.95*(1.33*pow(S,1.15))) : 0.0;
+			else
+				w->pe[v] = w->rain[v]>0.2*S ? pow(w->rain[v] - 0.2*S,2.0)/(w->rain[v] + 0.8*S) : 0.0;
+		}
+	}
+	
 	/* *********************************** */
 	/* Exécute le calcul du bilan hydrique */
 	/* *********************************** */
@@ -2315,31 +4030,74 @@
 		* PROCESS *
 		***********/
 		
-		double aet;
 		int init 			= 0;
-		double PE, SW, S, Qinsf, Qoutsf, Qinssf, Qoutssf;
-		static layer *tmp 	=	NULL;
-		static int *ptr		=	NULL;
-		static int m, incr;
+		int accumulate, write_step, origin;
+		int v, nvalid;
+		int *out_types		= NULL;
+		int *valid			= NULL;
+		unsigned char *nullrow = NULL;
+		RowWriter *writer	= NULL;
+		cell_kernel kernel;
+		struct cell_flux flux;
+		struct Parm *row_parms = NULL;
+		struct climate_row *crow = NULL;
+		struct excess_row *erow = NULL;
+		layer *c;
+		double t0;
 		
 		struct input *prc	= NULL;
 		struct input *etp	= NULL;
 		struct output *out 	= NULL;
-		layer **p 			= landscape;
 		
-		if( (flag4 && !flag3 && !flag5) || (flag4 && flag5) ){
+		if( (flag4->answer && !flag3->answer && !flag5->answer) || (flag4->answer && flag5->answer) ){
 			month 		= atoi(parm.start->answer)-1;
 			sum_days 	= num_days[month];
 		}
 		
-		clock_t start 		= clock();
+		/* Résout une fois pour toutes le type de chaque carte de sortie */
+		out_types = (int *)G_malloc(num_outputs_names * sizeof(int));
+		for (i = 0; i < num_outputs_names; i++)
+			out_types[i] = parm.outputs->answers[i] ? find_output_name(parm.outputs->answers[i]) : OUT_PAW;
+		
+		/* Masque des valeurs nulles et indices des colonnes à calculer pour une ligne */
+		nullrow = (unsigned char *)G_malloc(ncols * sizeof(unsigned char));
+		valid 	= (int *)G_malloc(ncols * sizeof(int));
+		
+		/* Paramètres du sol d'une ligne, lus en une fois depuis le fichier segmenté */
+		row_parms = (struct Parm *)G_malloc(ncols * sizeof(struct Parm));
+		
+		/* Le bilan climatique est calculé par ligne sur des tableaux contigus quand la cible permet de le vectoriser */
+#ifdef WB_ROW_KERNELS
+		if(method==0)
+			crow = CreateClimateRow(ncols);
+#endif
+		/* L'eau en excès est calculée par ligne avec ou sans vectorisation (voir ExcessRowScalar) */
+		if(method==1 || method==3)
+			erow = CreateExcessRow(ncols);
+		
+		/* Démarre l'écriture asynchrone des cartes de sortie : un fil d'écriture par carte de sortie */
+		writer 	= CreateRowWriter(num_outputs_names, ncols);
+		
+		double start 		= TimeNow();
 		G_verbose_message(_("Calcul du bilan hydrique en cours..."));
+		if(pager)
+			pager->phase = PAGE_PROCESS;
 
 		/* DEBUT BOUCLE TEMPORELLE (CARTES D ENTREE) */
 		for (n = 0; n < num_inputs; n++){
 		
 		if(num_inputs>1)
 			G_percent(n, num_inputs, 2);
+			
+		/* Options de calcul du pas de temps : cumul sur la période et écriture des cartes de sortie */
+		accumulate 	= (options==2 && (n+1)<=sum_days) || (options==3 && (n+1)%outiter!=0);
+		write_step 	= options==1 || (options==2 && (n+1)==sum_days) || (options==3 && (n+1)%outiter==0);
+		origin 		= (options==2) ? n - num_days[(month>12)?month%12:month] : (options==3) ? (n+1) - outiter : n;
+		
+		/* Positions du pas courant et du précédent dans l'historique roulant de la teneur en eau */
+		swc_cur 	= SWC_SLOT(n);
+		swc_prev 	= (n>0) ? SWC_SLOT(n-1) : swc_cur;
+		kernel 		= SelectCellKernel(accumulate);
 
 		/* Ouvre les cartes d'entrée pour la lecture */
 		prc 				= &P[n]; 	
@@ -2353,23 +4111,24 @@
 		etp->fd 			= Rast_open_old(etp->name, "");
 		
 		/* Ouvre les cartes de sortie à l'écriture */		
-		if(options==1 || (options==2 && (n+1)==sum_days) || (options==3 && (n+1)%outiter==0) ){
+		if(write_step){
 			char *output_name;		
 			for (i = 0; i < num_outputs_names; i++){
 				out  			= &Outputs[init+i];
 				if(num_outputs_names){
 					 output_name = make_output_name(parm.outputs->answers[i]);
 				}else{ 
-					if(asprintf(&output_name, "%s%d%s", "PAW", n+1, menu[method].suffix)<0)
+					if(asprintf(&output_name, "%s%d%s", "PAW", t_offset+n+1, menu[method].suffix)<0)
 						fprintf(stderr, "Allocation de memoire lors de la creation du nom de raster de sortie a echoue\n");
 				}
 				if (G_legal_filename(output_name) < 0)
 					G_fatal_error(_("<%s> est un nom de fichier illegal"), output_name);		
 				out->name 		= output_name;
-				out->buf 		= Rast_allocate_d_buf();
+				out->buf 		= NULL;
 				out->fd 		= Rast_open_new(output_name, DCELL_TYPE);
 			}		
 		}
+		out = &Outputs[init];
 	
 			/* DEBUT BOUCLE SPATIALE (LIGNES) */ 
 			for (row = 0; row < nrows; row++) {
@@ -2379,560 +4138,146 @@
 				
 				Rast_get_d_row(P[n].fd, P[n].buf, row);
 				Rast_get_d_row(ETP[n].fd, ETP[n].buf, row);
+				
+				/* Identifie en une passe les cellules nulles de la ligne */
+				nvalid = RowNullMask(P[n].buf, ETP[n].buf, nullrow, valid);
 
-				/* DEBUT BOUCLE SPATIALE (COLONNES) */	
-				for (col = 0; col < ncols; col++){
-					
-					int null = 0;
-
-					double rain 	= (double)P[n].buf[col];
-					double etp		= (double)ETP[n].buf[col];
-					
-					if (Rast_is_d_null_value(&rain) || Rast_is_d_null_value(&etp)){
-						null = 1;
+				/* Les cellules nulles à ce pas gardent la teneur en eau du pas précédent */
+				if(n>0 && nvalid<ncols)
+					for (col = 0; col < ncols; col++)
+						if(nullrow[col])
+							SWC(LAYER(row,col))[swc_cur] = SWC(LAYER(row,col))[swc_prev];
+
+				/* Les lignes de sortie sont nulles par défaut, seules les cellules valides sont calculées */
+				if(write_step){
+					for (i = 0; i < num_outputs_names; i++){
+						out[i].buf = WriterGetBuffer(writer, i);
+						Rast_set_d_null_value(out[i].buf, ncols);
 					}
-					else{
-
-							/* Récupère les données sur la cellule depuis le fichier segmenté */
-							Segment_get(&parms_seg, &parms, row, col);
+				}
 
-							/*****************************************
-							 * Calcul de l'évapotranspiration réelle *
-							 *****************************************/	
-							 
-							if( (options==2 && (n+1)<=sum_days) || (options==3 && (n+1)%outiter!=0) ){
-						
-								p[row][col].p  += rain;
-								p[row][col].pet+= etp;
-										
-								if(flag6){								
-									if(p[row][col].waterbodies || rain-etp >= 0.0){
-										p[row][col].aet += aet = etp;								
-									}else if (parms.rum==0.0){
-										p[row][col].aet += aet = EPS;
-									}else{
-										p[row][col].aet += aet = p[row][col].paw + rain - MAX(p[row][col].paw*exp((rain-etp)/parms.rum), 0.0);
-									}
-								}
-								else if(rain-etp >= 0.0){
-									p[row][col].aet += aet = etp;								
-								}
-								else if (parms.rum==0.0){
-									p[row][col].aet += aet = EPS;
-								}
-								else{
-									p[row][col].aet += aet = p[row][col].paw + rain - MAX(p[row][col].paw*exp((rain-etp)/parms.rum), 0.0);
-								}
-					
-							}
-							else{		
-								p[row][col].p  = rain;
-								p[row][col].pet= etp;
-								
-								if(flag6){								
-									if(p[row][col].waterbodies || rain-etp >= 0.0){
-										p[row][col].aet = aet = etp;								
-									}
-									else if (parms.rum==0.0){
-										p[row][col].aet = aet = EPS;
-									}
-									else{
-										p[row][col].aet = aet = p[row][col].paw + rain - MAX(p[row][col].paw*exp((rain-etp)/parms.rum), 0.0);
-									}
-								}else if(rain-etp >= 0.0){
-									p[row][col].aet = aet = etp;								
-								}
-								else if (parms.rum==0.0){
-									p[row][col].aet = aet = EPS;
-								}else{
-									p[row][col].aet = aet = p[row][col].paw + rain - MAX(p[row][col].paw*exp((rain-etp)/parms.rum), 0.0);
-								}
-							}				
+				/* Récupère les données de la ligne depuis le fichier segmenté */
+				if(nvalid)
+					ParmGetRow(row, row_parms);
+				
+				t0 = TimeNow();
 				
-								switch(method){
-
-									case 0:
-										/*************************************
-										 * Calcul de la teneur en eau du sol *
-										 *************************************/
-										if(flag6){								
-											if(p[row][col].waterbodies){
-												p[row][col].swc[n]=parms.sat;								
-											}else if (p[row][col].riparian){
-												p[row][col].swc[n] = MAX( MIN(p[row][col].swc[n] + rain - aet, parms.sat), parms.fc);
-											}else{
-												p[row][col].swc[n] = MIN(p[row][col].swc[n] + rain - aet, parms.sat);
-											}
-										}else{
-												p[row][col].swc[n] = MIN(p[row][col].swc[n] + rain - aet, parms.sat);
-										}
-										/*************************************
-										 * Calcul de la réserve utile du sol *
-										 *************************************/
-										if(flag6){
-											if(p[row][col].waterbodies || p[row][col].swc[n] >= parms.fc){
-												p[row][col].paw = parms.rum;
-											}else{
-												p[row][col].paw = MIN(parms.rum - (parms.fc - p[row][col].swc[n]), 0.0);
-											}
-										}else if(p[row][col].swc[n] >= parms.fc){
-											p[row][col].paw = parms.rum;
-										}else{
-											p[row][col].paw = MIN(parms.rum - (parms.fc - p[row][col].swc[n]), 0.0);
-										}					
-									break;
-									
-									
-									case 1:									
-										/**************************************
-										 * Calcul du ruissellement de surface *
-										 **************************************/
-										Qinsf = 0.0, Qoutsf = 0.0;
-										//static int m, incr;
-										/*static layer *tmp 	=	NULL;
-										static int *ptr		=	NULL;*/
-
-										/* calcule l'eau disponible en surface */
-										SW 	= MAX(p[row][col].swc[n] - parms.pwp, 0.0);
-										S 	= p[row][col].smax * (1.0 - SW/(SW+exp(p[row][col].w1 - p[row][col].w2*SW)));
-
-										if(method_ia){						
-											if( (options==2 && (n+1)<=sum_days) || (options==3 && (n+1)%outiter!=0) )
-												p[row][col].sraw += PE = rain>0.05*S ? pow(rain - 0.05*(1.33*pow(S,1.15)),2.0)/(rain + 0.95*(1.33*pow(S,1.15))) : 0.0;
-											else 
-												p[row][col].sraw = PE = rain>0.05*S ? pow(rain - 0.05*(1.33*pow(S,1.15)),2.0)/(rain + 0.95*(1.33*pow(S,1.15))) : 0.0;
-										}else{	
-											if( (options==2 && (n+1)<=sum_days) || (options==3 && (n+1)%outiter!=0) )
-												p[row][col].sraw += PE = rain>0.2*S ? pow(rain - 0.2*S,2.0)/(rain + 0.8*S) : 0.0;
-											else
-												p[row][col].sraw = PE = rain>0.2*S ? pow(rain - 0.2*S,2.0)/(rain + 0.8*S) : 0.0;
-										}
-										
-										/* calcule le ruissellement entrant et sortant */
-										m = 1;
-										for(iter=0;iter<p[row][col].nbContribCells[id];iter++){						
-											tmp = &landscape[p[row][col].contribCells[iter].row][p[row][col].contribCells[iter].col];
-											//ptr = FindNonZeroTermIndices(tmp->sraw, num_inputs);
-												if(ptr==NULL) continue;
-													//for(n=ptr[0];n<=num_inputs;n++)
-													//{
-														//for(m=ptr[0],incr=0;m<=n;m=ptr[incr++])
-														//{
-															if(iter==0)
-																Qoutsf +=  tmp->sraw * CellOutletResponse(&p[row][col].contribCells[iter], n-m+1, id);											
-															else Qinsf +=  tmp->sraw * FlowPathUnitResponse(&p[row][col].contribCells[iter], n-m+1, id);
-														//}
-													//}
-										}
-										//for(iter=0;iter<p[row][col].nbContribCells[id];iter++)						
-										//	p[row][col].braw[n] += landscape[p[row][col].contribCells[iter]->row][p[row][col].contribCells[iter]->col].raw[n];
-										
-										//	ptr = FindNonZeroTermIndices(p[row][col].braw[n], num_inputs);
-										//		if(ptr){
-										//			for(n=ptr[0];n<=num_inputs;n++)
-										//			{
-										//				for(m=ptr[0],incr=0;m<=n;m=ptr[incr++])
-										//				{
-										//					if(iter==0)
-										//						Qoutssf +=  tmp->sraw * CellOutletResponse(p[row][col].contribCells[iter], n-m+1, id);											
-										//					else Qinssf +=  p[row][col].braw[m] * UHTsf[n-m+1];
-										//				}
-										//			} 
-										//		}
-																				
-										if( (options==2 && (n+1)<=sum_days) || (options==3 && (n+1)%outiter!=0) ){
-											p[row][col].qinsf  += Qinsf;
-											p[row][col].qoutsf += Qoutsf;
-										}
-										else{
-											p[row][col].qinsf  = Qinsf;
-											p[row][col].qoutsf = Qoutsf;
-										}
-										//for(iter=1;iter<p[row][col].nbContribCells;iter++)
-										//	Qinsf  +=  tmp.sraw * qromb(&FlowPathUnitResponse, p[row][col].contribCells[iter], 0.0, draining_time);
-										//  Qoutsf +=  Qinsf * qromb(&CellOutletResponse, p[row][col].contribCells[0], 0.0, draining_time);
-										/*************************************
-										 * Calcul de la teneur en eau du sol *
-										 *************************************/
-										if(flag6){								
-											if(p[row][col].waterbodies){
-												p[row][col].swc[n]=parms.sat;								
-											}else if (p[row][col].riparian){
-												p[row][col].swc[n] = MAX( MIN(p[row][col].swc[n] + rain - aet + Qinsf - Qoutsf, parms.sat),parms.fc);
-											}else{
-												p[row][col].swc[n] = MIN(p[row][col].swc[n] + rain - aet + Qinsf - Qoutsf, parms.sat);
-											}
-										}else{
-												p[row][col].swc[n] = MIN(p[row][col].swc[n] + rain - aet + Qinsf - Qoutsf, parms.sat);
-										}
-										/*************************************
-										 * Calcul de la réserve utile du sol *
-										 *************************************/
-										if(flag6){
-											if(p[row][col].waterbodies || p[row][col].swc[n] >= parms.fc){
-												p[row][col].paw = parms.rum;
-											}else{
-												p[row][col].paw = MIN(parms.rum - (parms.fc - p[row][col].swc[n]),0.0);
-											}
-										}else if(p[row][col].swc[n] >= parms.fc){
-											p[row][col].paw = parms.rum; 
-										}else{
-											p[row][col].paw = MIN(parms.rum - (parms.fc - p[row][col].swc[n]),0.0);
-										}
-									break;
-									
-									
-									case 2:									
-										/*****************************************
-										 * Calcul du ruissellement de subsurface *
-										 *****************************************/
-										Qinssf = 0.0, Qoutssf = 0.0;
-										//static int m, incr;
-										/*static layer *tmp 	=	NULL;
-										static int *ptr		=	NULL;*/
-
-										/* calcule le ruissellement entrant et sortant */
-										for(iter=0;iter<p[row][col].nbContribCells[id+1];iter++){						
-											tmp = &landscape[p[row][col].contribCells[iter].row][p[row][col].contribCells[iter].col];
-											ptr = FindNonZeroTermIndices(tmp->raw, num_inputs);
-												if(!ptr) continue;
-													/*for(n=ptr[0];n<=num_inputs;n++)
-													{*/
-														for(m=ptr[0],incr=0;m<=n;m=ptr[incr++])
-														{
-															if(iter==0)
-																Qoutssf +=  tmp->raw[m] * CellOutletResponse(&p[row][col].contribCells[iter], n-m+1, id+1);											
-															else Qinssf +=  tmp->raw[m] * FlowPathUnitResponse(&p[row][col].contribCells[iter], n-m+1, id+1);
-														}
-													/*}*/
-										}
-										
-										// for(iter=0;iter<p[row][col].nbContribCells[id+1];iter++)						
-										//	p[row][col].braw[n] += landscape[p[row][col].contribCells[iter]->row][p[row][col].contribCells[iter]->col].raw[n];
-										
-										//	ptr = FindNonZeroTermIndices(p[row][col].braw[n], num_inputs);
-										//		if(ptr){
-										//			for(n=ptr[0];n<=num_inputs;n++)
-										//			{
-										//				for(m=ptr[0],incr=0;m<=n;m=ptr[incr++])
-										//				{
-										//					if(iter==0)
-										//						Qoutssf +=  tmp->raw[m] * CellOutletResponse(p[row][col].contribCells[iter], n-m+1, id+1);											
-										//					else Qinssf +=  p[row][col].braw[m] * UHTssf[n-m+1];
-										//				}
-										//			} 
-										//		}
-
-
-										if( (options==2 && (n+1)<=sum_days) || (options==3 && (n+1)%outiter!=0) ){
-											p[row][col].qinssf  += Qinssf;
-											p[row][col].qoutssf += Qoutssf;
-										}
-										else{
-											p[row][col].qinssf  = Qinssf;
-											p[row][col].qoutssf = Qoutssf;
-										}
-
-										/*************************************
-										 * Calcul de la teneur en eau du sol *
-										 *************************************/
-										if(flag6){								
-											if(p[row][col].waterbodies){
-												p[row][col].swc[n] = parms.sat;								
-											}
-											else if (p[row][col].riparian){
-												p[row][col].swc[n] = MAX( MIN(p[row][col].swc[n] + rain - aet + Qinssf - Qoutssf, parms.sat),parms.fc);
-											}
-											else{
-												p[row][col].swc[n] = MIN(p[row][col].swc[n] + rain - aet + Qinssf - Qoutssf, parms.sat);
-											}
-										}
-										else{
-												p[row][col].swc[n] = MIN(p[row][col].swc[n] + rain - aet + Qinssf - Qoutssf, parms.sat);
-										}
-										/*************************************
-										 * Calcul de la réserve utile du sol *
-										 *************************************/
-										if(flag6){
-											if(p[row][col].waterbodies || p[row][col].swc[n] >= parms.fc){
-												p[row][col].paw = parms.rum;
-											}
-											else{
-												p[row][col].paw = MIN(parms.rum - (parms.fc - p[row][col].swc[n]),0.0);
-											}
-										}
-										else if(p[row][col].swc[n] >= parms.fc){
-											p[row][col].paw = parms.rum; 
-										}
-										else{
-											p[row][col].paw = MIN(parms.rum - (parms.fc - p[row][col].swc[n]),0.0);
-										}				
-									break;
-									
-									
-									case 3:									
-										/**************************************
-										 * Calcul du ruissellement de surface *
-										 **************************************/
-										Qinsf = 0.0, Qoutsf = 0.0;
-										/*static int m, incr;*/
-										/*static layer *tmp 	=	NULL;
-										static int *ptr		=	NULL;*/
-
-										/* calcule l'eau disponible en surface */
-										SW 	= MAX(p[row][col].swc[n] - parms.pwp, 0.0);
-										S 	= p[row][col].smax * (1.0 - SW/(SW+exp(p[row][col].w1 - p[row][col].w2*SW)));
-										
-										if(method_ia){						
-											if( (options==2 && (n+1)<=sum_days) || (options==3 && (n+1)%outiter!=0) )
-												p[row][col].sraw += PE = rain>0.05*S ? pow(rain - 0.05*(1.33*pow(S,1.15)),2.0)/(rain + 0.95*(1.33*pow(S,1.15))) : 0.0;
-											else 
-												p[row][col].sraw = PE = rain>0.05*S ? pow(rain - 0.05*(1.33*pow(S,1.15)),2.0)/(rain + 0.95*(1.33*pow(S,1.15))) : 0.0;
-										}else{	
-											if( (options==2 && (n+1)<=sum_days) || (options==3 && (n+1)%outiter!=0) )
-												p[row][col].sraw += PE = rain>0.2*S ? pow(rain - 0.2*S,2.0)/(rain + 0.8*S) : 0.0;
-											else
-												p[row][col].sraw = PE = rain>0.2*S ? pow(rain - 0.2*S,2.0)/(rain + 0.8*S) : 0.0;
-										}
-										
-										/* calcule le ruissellement entrant et sortant */
-										m = 1;
-										for(iter=0;iter<p[row][col].nbContribCells[id];iter++){						
-											tmp = &landscape[p[row][col].contribCells[iter].row][p[row][col].contribCells[iter].col];
-											//ptr = FindNonZeroTermIndices(tmp->sraw, num_inputs);
-												//if(!ptr) continue;
-													/*for(n=ptr[0];n<=num_inputs;n++)
-													{*/
-														for(m=ptr[0],incr=0;m<=n;m=ptr[incr++])
-														{
-															if(iter==0)
-																Qoutsf +=  tmp->sraw * CellOutletResponse(&p[row][col].contribCells[iter], n-m+1, id);											
-															else Qinsf +=  tmp->sraw * FlowPathUnitResponse(&p[row][col].contribCells[iter], n-m+1, id);
-														}
-													/*}*/
-										}
-										if( (options==2 && (n+1)<=sum_days) || (options==3 && (n+1)%outiter!=0) ){
-											p[row][col].qinsf  += Qinsf;
-											p[row][col].qoutsf += Qoutsf;
-										}
-										else{
-											p[row][col].qinsf  = Qinsf;
-											p[row][col].qoutsf = Qoutsf;
-										}
-										//for(iter=1;iter<p[row][col]->nbContribCells;iter++)
-										//	Qinsf  +=  tmp->sraw * qromb(&FlowPathUnitResponse, p[row][col]->contribCells[iter], 0.0, draining_time);
-										//  Qoutsf +=  Qinsf * qromb(&CellOutletResponse, p[row][col]->contribCells[0], 0.0, draining_time);						
-										/*****************************************
-										 * Calcul du ruissellement de subsurface *
-										 *****************************************/				 
-										Qinssf = 0.0, Qoutssf = 0.0;
-										//static int m, incr;
-										/*static layer *tmp 	=	NULL;
-										static int *ptr		=	NULL;*/
-
-										/* calcule le ruissellement entrant et sortant */
-										for(iter=0;iter<p[row][col].nbContribCells[id+1];iter++){						
-											tmp = &landscape[p[row][col].contribCells[iter].row][p[row][col].contribCells[iter].col];
-											ptr = FindNonZeroTermIndices(tmp->raw, num_inputs);
-												if(!ptr) continue;
-													/*for(n=ptr[0];n<=num_inputs;n++)
-													{*/
-														for(m=ptr[0],incr=0;m<=n;m=ptr[incr++])
-														{
-															if(iter==0)
-																Qoutssf +=  tmp->raw[m] * CellOutletResponse(&p[row][col].contribCells[iter], n-m+1, id+1);
-															else Qinssf +=  tmp->raw[m] * FlowPathUnitResponse(&p[row][col].contribCells[iter], n-m+1, id+1);
-														}
-													/*}*/
-										}
-										/*for(iter=0;iter<p[row][col].nbContribCells[id+1];iter++)						
-											p[row][col].braw[n] += landscape[p[row][col].contribCells[iter]->row][p[row][col].contribCells[iter]->col].raw[n];
-										
-											ptr = FindNonZeroTermIndices(p[row][col].braw[n], num_inputs);
-												if(ptr){
-													for(n=ptr[0];n<=num_inputs;n++)
-													{
-														for(m=ptr[0],incr=0;m<=n;m=ptr[incr++])
-														{
-															if(iter==0)
-																Qoutssf +=  tmp->raw[m] * CellOutletResponse(p[row][col].contribCells[iter], n-m+1, id+1);											
-															else Qinssf +=  p[row][col].braw[m] * UHTssf[n-m+1];
-														}
-													} 
-												}
-										*/						
-										
-										if( (options==2 && (n+1)<=sum_days) || (options==3 && (n+1)%outiter!=0) ){
-											p[row][col].qinssf  += Qinssf;
-											p[row][col].qoutssf += Qoutssf;
-										}else{
-											p[row][col].qinssf  = Qinssf;
-											p[row][col].qoutssf = Qoutssf;
-										}
-
-										/*************************************
-										 * Calcul de la teneur en eau du sol *
-										 *************************************/
-										if(flag6){								
-											if(p[row][col].waterbodies){
-												p[row][col].swc[n]=parms.sat;								
-											}
-											else if (p[row][col].riparian){
-												p[row][col].swc[n] = MAX( MIN(p[row][col].swc[n] + rain - aet + Qinsf - Qoutsf + Qinssf - Qoutssf, parms.sat),parms.fc);
-											}
-											else{
-												p[row][col].swc[n] = MIN(p[row][col].swc[n] + rain - aet + Qinsf - Qoutsf + Qinssf - Qoutssf, parms.sat);
-											}
-										}
-										else{
-											p[row][col].swc[n] = MIN(p[row][col].swc[n] + rain - aet + Qinsf - Qoutsf + Qinssf - Qoutssf, parms.sat);
-										}
-										/*************************************
-										 * Calcul de la réserve utile du sol *
-										 *************************************/
-										if(flag6){
-											if(p[row][col].waterbodies || p[row][col].swc[n] >= parms.fc){
-												p[row][col].paw = parms.rum;
-											}
-											else{
-												p[row][col].paw = MIN(parms.rum - (parms.fc - p[row][col].swc[n]),0.0);
-											}
-										}
-										else if(p[row][col].swc[n] >= parms.fc){
-											p[row][col].paw = parms.rum; 
-										}
-										else{
-											p[row][col].paw = MIN(parms.rum - (parms.fc - p[row][col].swc[n]),0.0);
-										}					
-										break;
-								}
+				if(crow){
+					/* Rassemble les entrées des cellules valides dans des tableaux contigus */
+					for (v = 0; v < nvalid; v++){
+						col 			= valid[v];
+						c 				= LAYER(row,col);
+						crow->cell[v] 	= c;
+						crow->rain[v] 	= (double)P[n].buf[col];
+						crow->etp[v] 	= (double)ETP[n].buf[col];
+						crow->sat[v] 	= row_parms[col].sat;
+						crow->fc[v] 	= row_parms[col].fc;
+						crow->rum[v] 	= row_parms[col].rum;
+						crow->paw[v] 	= c->paw;
+						crow->swc[v] 	= SWC(c)[swc_prev];
+						crow->wb[v] 	= c->waterbodies ? 1.0 : 0.0;
+						crow->rip[v] 	= c->riparian ? 1.0 : 0.0;
 					}
-					// fin du else (null ou pas)					
-					/* Inscrit le calcul dans la carte de sortie */
-					if(options==1 || (options==2 && (n+1)==sum_days) || (options==3 && (n+1)%outiter==0) ){
-						
-						double swc; 
-						int origin = (options==2) ? n - num_days[(month>12)?month%12:month] : (options==3) ? (n+1) - outiter : 0;
 					
-						for (i = 0; i < num_outputs_names; i++){
-							out  = &Outputs[init+i];
-							if(null){
-								Rast_set_d_null_value(&out->buf[col], 1);
-							}
-							else{
-								int output_options = find_output_name(parm.outputs->answers[i]);
-								switch(output_options){
-									case 0:
-										out->buf[col] = (options==1) ? (DCELL)(etp-aet):(DCELL)(p[row][col].pet-p[row][col].aet);
-									break;
-									
-									case 1:
-										if(options==1 || !origin){
-											out->buf[col] = (DCELL)(p[row][col].paw);
-										}
-										else{ 
-											if(flag6){								
-												if(p[row][col].waterbodies){
-													swc 	= parms.sat;								
-												}else if (p[row][col].riparian){
-													swc 	= MAX(MIN(p[row][col].swc[origin] + p[row][col].p - p[row][col].aet + p[row][col].qinsf - p[row][col].qoutsf + p[row][col].qinssf - p[row][col].qoutssf, parms.sat), parms.fc);
-												}else{
-													swc 	= MIN(p[row][col].swc[origin] + p[row][col].p - p[row][col].aet + p[row][col].qinsf - p[row][col].qoutsf + p[row][col].qinssf - p[row][col].qoutssf, parms.sat);
-												}
-											}else{
-													swc 	= MIN(p[row][col].swc[origin] + p[row][col].p - p[row][col].aet + p[row][col].qinsf - p[row][col].qoutsf + p[row][col].qinssf - p[row][col].qoutssf, parms.sat);
-												}
-											if(flag6){
-												if(p[row][col].waterbodies || swc >= parms.fc){
-													out->buf[col] = (DCELL)parms.rum;
-												}else{
-													out->buf[col] = (DCELL) MIN(parms.rum - (parms.fc - swc),0.0);
-												}
-											}else if(swc >= parms.fc){
-												out->buf[col] = (DCELL)parms.rum; 
-											}else{
-												out->buf[col] = (DCELL)MIN(parms.rum - (parms.fc - swc),0.0);
-											}
-										}
-									break;
-									
-									case 2:
-										if(options==1){
-											out->buf[col] 			= (DCELL)p[row][col].swc[origin];
-										}
-										else if(flag6){								
-											if(p[row][col].waterbodies){
-												out->buf[col] 	= (DCELL)parms.sat;								
-											}
-											else if (p[row][col].riparian){
-												out->buf[col] 	= (DCELL) (MAX(MIN(p[row][col].swc[origin] + p[row][col].p - p[row][col].aet + p[row][col].qinsf - p[row][col].qoutsf + p[row][col].qinssf - p[row][col].qoutssf, parms.sat), parms.fc));
-											}
-											else{
-												out->buf[col] 	= (DCELL) (MIN(p[row][col].swc[origin] + p[row][col].p - p[row][col].aet + p[row][col].qinsf - p[row][col].qoutsf + p[row][col].qinssf - p[row][col].qoutssf, parms.sat));
-											}
-										}
-										else{
-											out->buf[col] 	= (DCELL) (MIN(p[row][col].swc[origin] + p[row][col].p - p[row][col].aet + p[row][col].qinsf - p[row][col].qoutsf + p[row][col].qinssf - p[row][col].qoutssf, parms.sat));
-										}
-									break;
-									
-									case 3:
-										out->buf[col] = (options==1) ? (DCELL)Qinssf:(DCELL)(p[row][col].qinssf);
-									break;
-									
-									case 4:
-										out->buf[col] = (options==1) ? (DCELL)Qoutssf:(DCELL)(p[row][col].qoutssf);
-									break;
-									
-									case 5:
-										out->buf[col] = (options==1) ? (DCELL)Qinsf:(DCELL)(p[row][col].qinsf);
-									break;
-									
-									case 6:
-										out->buf[col] = (options==1) ? (DCELL)Qoutsf:(DCELL)(p[row][col].qoutsf);
-									break;
-									
-									case 7:
-										out->buf[col] = (options==1) ? (DCELL)PE:(DCELL)(p[row][col].sraw);
-									break;							
-								}
-							}
+					ClimateRowKernel(crow, nvalid, flag6->answer);
+					
+					/* Disperse les résultats vers les cellules et les cartes de sortie */
+					flux.pe = flux.qinsf = flux.qoutsf = flux.qinssf = flux.qoutssf = 0.0;
+					for (v = 0; v < nvalid; v++){
+						col 		= valid[v];
+						c 			= crow->cell[v];
+						SWC(c)[swc_cur] 	= crow->swc[v];
+						c->paw 		= crow->paw[v];
+						c->p		= accumulate ? c->p + crow->rain[v] 	: crow->rain[v];
+						c->pet		= accumulate ? c->pet + crow->etp[v] 	: crow->etp[v];
+						c->aet		= accumulate ? c->aet + crow->aet[v] 	: crow->aet[v];
+						flux.aet 	= crow->aet[v];
+						if(write_step)
+							StoreCellOutputs(out, out_types, col, c, &row_parms[col], &flux, crow->etp[v], origin);
+					}
+				}
+				else{
+					if(erow){
+						/* Calcule l'eau en excès de toute la ligne avant le ruissellement des cellules */
+						for (v = 0; v < nvalid; v++){
+							col 			= valid[v];
+							c 				= LAYER(row,col);
+							erow->rain[v] 	= (double)P[n].buf[col];
+							erow->swc[v] 	= SWC(c)[swc_prev];
+							erow->pwp[v] 	= row_parms[col].pwp;
+							erow->smax[v] 	= c->smax;
+							erow->ew1[v] 	= c->ew1;
+							erow->w2[v] 	= c->w2;
+						}
+						
+#ifdef WB_ROW_KERNELS
+						ExcessRowKernel(erow, nvalid, method_ia);
+#else
+						ExcessRowScalar(erow, nvalid, method_ia);
+#endif
+						
+						for (v = 0; v < nvalid; v++){
+							c 			= LAYER(row,valid[v]);
+							c->sraw 	= erow->pe[v];
+							c->pe 		= accumulate ? c->pe + erow->pe[v] : erow->pe[v];
 						}
 					}
-					// fin calcul sortie
-				}				
-				/* FIN BOUCLE SPATIALE (COLONNES) */
+					
+					/* DEBUT BOUCLE SPATIALE (COLONNES) */	
+					for (v = 0; v < nvalid; v++){
+						
+						col 			= valid[v];
+						double rain 	= (double)P[n].buf[col];
+						double etp		= (double)ETP[n].buf[col];
+						
+						flux.pe 		= erow ? erow->pe[v] : 0.0;
+						kernel(LAYER(row,col), &row_parms[col], n, rain, etp, &flux);
+						
+						/* Inscrit le calcul dans la carte de sortie */
+						if(write_step)
+							StoreCellOutputs(out, out_types, col, LAYER(row,col), &row_parms[col], &flux, etp, origin);
+					}				
+					/* FIN BOUCLE SPATIALE (COLONNES) */
+				}
+				kernel_time 	+= TimeNow() - t0;
+				kernel_cells 	+= nvalid;
 				
-				/* Inscrit la ligne dans la carte de sortie */
-				if(options==1 || (options==2 && (n+1)==sum_days) || (options==3 && (n+1)%outiter==0) ){
-					for (i = 0; i < num_outputs_names; i++)
-						Rast_put_d_row(Outputs[init+i].fd, Outputs[init+i].buf);
+				/* Confie la ligne à l'écriture asynchrone et passe à la ligne suivante */
+				if(write_step){
+					for (i = 0; i < num_outputs_names; i++){
+						WriterPutRow(writer, i, out[i].fd, out[i].buf);
+						out[i].buf = NULL;
+					}
 				}
 				if(num_inputs==1)
 					G_percent(1, 1, 1);
 			}
 			/* FIN BOUCLE SPATIALE (LIGNES) */
 				
+			/* Attend que toutes les lignes soient écrites avant de fermer les cartes */
+			WriterFlush(writer);
+				
 			/* Ferme les cartes d'entrée */	
 			Rast_close(P[n].fd);
 			Rast_close(ETP[n].fd);
+			G_free(P[n].buf);
+			G_free(ETP[n].buf);
 			
 			/* Ferme les cartes de sortie */
-			if(options==1 || (options==2 && (n+1)==sum_days) || (options==3 && (n+1)%outiter==0) ){
+			if(write_step){
 				for (i = 0; i < num_outputs_names; i++)
 				{
-					out = &Outputs[init+i];
-					Rast_close(out->fd);
-					Rast_short_history(out->name, "raster", &history);
+					WriterClose(writer, out[i].fd);
+					Rast_short_history(out[i].name, "raster", &history);
 					Rast_command_history(&history);
-					Rast_write_history(out->name, &history);
-					G_verbose_message(_("La carte raster <%s> a ete cree"), out->name);
-					G_free(out->name);
+					Rast_write_history(out[i].name, &history);
+					G_verbose_message(_("La carte raster <%s> a ete cree"), out[i].name);
+					G_free(out[i].name);
 				}
 			}
 			
 			/* (Re)Définit l'indice mémoire du prochain point d'écriture */
-			if(options==1 || (options==2 && (n+1)==sum_days) || (options==3 && (n+1)%outiter==0) )		
+			if(write_step)		
 				init = init + num_outputs_names;
 				
 			/* Détermine le prochain point d'écriture */
@@ -2943,14 +4288,63 @@
 				G_percent(1,1,1);
 		}
 		/* FIN BOUCLE TEMPORELLE (CARTES D ENTREE) */
+		
+		double end 			= TimeNow();
+		
+		if(flag7->answer){
+			if(method>0){
+				if(depression_mode==DEPRESSIONS_FILL)
+					G_message(_("Conditionnement des altitudes: %.2fs, %ld cellules relevees (profondeur moyenne %.3f m, maximale %.3f m),"
+								" %ld cellules de zones plates drainees, file de priorite: %ld cellules, cuvettes: %ld cellules"),
+							  condition_time, flood_stats.filled, flood_stats.filled ? flood_stats.fill_sum / flood_stats.filled : 0.0,
+							  flood_stats.fill_max, flood_stats.flats, flood_stats.radix_pushes, flood_stats.pit_pushes);
+				G_message(_("Directions d ecoulement (%s): %.2fs soit %.0f cellules/s"), menu_algorithm[algorithm].name, flowdir_time,
+						  flowdir_time > 0.0 ? (double)nrows * ncols / flowdir_time : 0.0);
+				G_message(_("Temps de construction des bassins de drainage: %.2fs (rangement %s)"), basin_time, menu_layout[layout_mode].name);
+				G_message(_("Recherche des bassins (search=%s): %ld cellules traitees, %ld temps de trajet diminues, %lld contributeurs"),
+						  menu_search[search_mode].name, basin_search.visits, basin_search.updates, contrib_records);
+			}
+			G_message(_("Temps ecoule pour le calcul: %.2fs soit %.2fmin"), end - start, (end - start)/60.0);
+			G_message(_("Boucle des cellules (noyau %s): %.2fs pour %ld cellules soit %.3f cellules/ns"),
+					  crow ? "ligne vectorise" : erow ? "exces par ligne vectorise" : "par cellule", kernel_time, kernel_cells,
+					  kernel_time > 0.0 ? kernel_cells / kernel_time * 1e-9 : 0.0);
+			WriterReport(writer);
+			if(pager)
+				PageShadowReport(pager);
+			if(method>0 && kernel_windows>0){
+				G_message(_("Fonctions de reponse: %ld evaluations, %ld evitees par les fenetres de support (epsilon=%g)"),
+						  kernel_visits, kernel_skips, kernel_eps);
+				G_message(_("Classes de fonctions de reponse: %d pour %ld contributeurs (quantum=%g, ecart relatif maximal des parametres %.2e)"),
+						  kernels->nclasses, kernels->lookups, kernel_quantum, kernels->max_rel_error);
+				G_message(_("Masse des fonctions de reponse ignoree: %.3e en moyenne, %.3e au maximum"),
+						  kernel_lost_sum / kernel_windows, kernel_lost_max);
+				if(events)
+					G_message(_("Evenements d eau en exces: %ld dans %ld blocs"), events->nevents, events->nblocks);
+				if(tiles)
+					G_message(_("Tuiles de contributeurs: %.1f MB sur disque, %.1f MB relus, taux de succes du cache %.1f%% (%ld/%ld)"),
+							  tiles->file_bytes / 1048576., tiles->read_bytes / 1048576.,
+							  (tiles->hits + tiles->misses) ? 100.0 * tiles->hits / (tiles->hits + tiles->misses) : 100.0,
+							  tiles->hits, tiles->hits + tiles->misses);
+			}
+		}
+		DestroyRowWriter(writer);
+		G_free(out_types);
+		G_free(nullrow);
+		G_free(valid);
+		G_free(row_parms);
+		DestroyClimateRow(crow);
+		DestroyExcessRow(erow);
+
+		/* Sauvegarde l'état de fin de calcul pour une reprise à chaud */
+		if(parm.state_out->answer)
+			SaveState(parm.state_out->answer);
 
 		/* Libère la mémoire */
 		Segment_close(&parms_seg);
+		FreeParmRecord();
+		DestroyPageShadow(pager);
 		FreeLandscape();
 
-		clock_t end 		= clock();
-		double time_elapsed = (double)(end - start);
-		G_verbose_message(_("Temps ecoule pour le calcul: %fsec soit %fmin\n"), time_elapsed/1000.0, time_elapsed/60000.0);
 		G_done_msg(_("Le calcul du bilan hydrique est a present termine."));
 			
 	return;
@@ -3520,8 +4914,8 @@
 		}
 		for(k=0; k<8; k++)
 		{
-			landscape[row][col].prop[k]							= portion[k];
-			landscape[row+dy[k]][col+dx[k]].neighbors[(k+4)%8]	= &landscape[row][col];
+			LAYER(row,col)->prop[k]							= portion[k];
+			LAYER(row+dy[k],col+dx[k])->neighbors[(k+4)%8]	= LAYER(row,col);
 		}
     }
 }
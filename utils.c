@@ -2,6 +2,7 @@
 #include <stdio.h>
 #include <math.h>
 #include <string.h>
+#include <time.h>
 #include "utils.h"
 
 #define END 1
@@ -11,8 +12,9 @@
 double dstdDev(double data[], int n)
 {
     double sum = 0.0, stdDev = 0.0, mean;
+    int i;
 
-    for(int i=0; i<n; ++i)
+    for(i=0; i<n; ++i)
         sum += data[i];
 
     mean = sum/n;
@@ -23,6 +25,14 @@ double dstdDev(double data[], int n)
     return sqrt(stdDev/n);
 }
 
+double TimeNow(void)
+/* renvoie le temps écoulé en secondes selon une horloge monotone (temps réel, pas temps processeur)*/
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + 1e-9 * (double)ts.tv_nsec;
+}
+
 
 
 
@@ -121,16 +131,14 @@ void free_dvector(double *v, long nl, long nh)
 	return;			
 }
 
-void polint(double xa[], double ya[], int n, double x, double *y, double *dy)
+void polint_r(const double xa[], const double ya[], int n, double x, double *y, double *dy, double c[], double d[])
 /* Connaissant les vecteurs xa[1..n] et ya[1..n], et une valeur x, la routine retourne une valeur y, et une erreur d'estimation dy.
-Si P(x) est le polynôme de degré N-1 tel que P(xai) = yai, i = 1, . . . , n, alors la valeur retournée y est y = P(x).*/
+Si P(x) est le polynôme de degré N-1 tel que P(xai) = yai, i = 1, . . . , n, alors la valeur retournée y est y = P(x).
+Les tableaux de travail c[1..n] et d[1..n] sont fournis par l'appelant : la routine n'alloue rien.*/
 {
 	int i, m, ns=1;			
 	double den, dif, dift, ho, hp, w;
-	double *c, *d;
 	dif = fabs(x-xa[1]);
-	c = dvector(1,n);
-	d = dvector(1,n);
 	
 	for (i=1;i<=n;i++) { 									/* Ici on trouve l'index ns de la table d'entrée la plus proche, et itnitialise le tableau des valeurs de c et de d.*/
 		if ( (dift=fabs(x-xa[i])) < dif) {
@@ -160,8 +168,23 @@ Si P(x) est le polynôme de degré N-1 tel que P(xai) = yai, i = 1, . . . , n, a
 		where we are. This route keeps the partial approximations centered (insofar as possible)
 		on the target x. The last dy added is thus the error indication. */
 	}
-	free_dvector(d,1,n);
-	free_dvector(c,1,n);
+}
+
+void polint(double xa[], double ya[], int n, double x, double *y, double *dy)
+/* Comme polint_r() avec des tableaux de travail sur la pile ; ils ne sont alloués que pour un grand nombre de points. */
+{
+	double cs[QUAD_JMAX+2], ds[QUAD_JMAX+2];
+	double *c = cs, *d = ds;
+	
+	if (n > QUAD_JMAX+1) {
+		c = dvector(1,n);
+		d = dvector(1,n);
+	}
+	polint_r(xa, ya, n, x, y, dy, c, d);
+	if (c != cs) {
+		free_dvector(d,1,n);
+		free_dvector(c,1,n);
+	}
 }
 
 #define FUNC(a, b, x) (*func)(a, b, x)
@@ -228,17 +251,33 @@ Les appels aux valeurs n=2,3,...(par ordre séquentiel) améliorera la précisio
 	}
 }
 
+/* Adapte une intégrande de l'ancienne interface (fonction de time, sigma et t) à l'interface vectorisée quad_func */
+struct legacy_ctx
+{
+	double (*func)(double time, double sigma, double t);
+	double time, sigma;
+};
+
+static void legacy_func(const double *x, double *fx, int n, void *ctx)
+{
+	struct legacy_ctx *l = (struct legacy_ctx *)ctx;
+	int j;
+	for(j=0;j<n;j++) fx[j] = (*l->func)(l->time, l->sigma, x[j]);
+}
+
 double qtrap(double (*func) (double time, double sigma, double t), double time, double sigma, double a, double b)
 /* Retourne l'intégrale de la fonction func de a à b. Le paramètre EPS peut être fixé à la précision désirée et JMAX tel que 2 à la puissance JMAX-1 est le 
 nombre de pas maximum autorisé. L'intégration est effectuée par la règle du trapèze. */
 {
-	double trapzd(double (*func)(double time, double sigma, double t), double time, double sigma, double a, double b, int n);
+	struct legacy_ctx l = {func, time, sigma};
+	quad_work w;
 	int j;
 	double s, olds;
 	
+	quad_init(&w);
 	olds = -1.0e-30;			/* N'importe quel nombre improbable d'etre la moyenne de la fonction à ces points terminaux */
 	for(j=1;j<=JMAX;j++){
-	s = trapzd(func, time, sigma, a, b, j);
+	s = trapzd_r(legacy_func, &l, a, b, j, &w);
 	if(j>5)						/* Evite une convergence ennuyeuse trop précoce */
 		if(fabs(s-olds) < EPS*fabs(olds) || (s == 0.0 && olds == 0.0)) return s;
 	olds = s;
@@ -281,20 +320,13 @@ double qsimp(double (*func) (double time, double sigma, double t), double time,
 /* Retourne l'intégrale de la fonction func de a à b. Le paramètre EPS peut être fixé à la précision désirée et JMAX tel que 2 à la puissance JMAX-1 est le 
 nombre de pas maximum autorisé. L'intégration est effectuée par la règle de Simpson. */
 {
-	double trapzd(double (*func)(double time, double sigma, double t), double time, double sigma, double a, double b, int n);
-	int j;
-	double s, st, ost=0.0, os=0.0;
+	struct legacy_ctx l = {func, time, sigma};
+	quad_work w;
+	double s;
 	
-	for(j=1;j<=JMAX;j++){
-	st = trapzd(func, time, sigma, a, b, j);
-	s = (4.0*st-ost)/3.0;
-	if(j>5)						/* Evite une convergence ennuyeuse trop précoce */
-		if(fabs(s-os) < EPS*fabs(os) || (s == 0.0 && os == 0.0)) return s;
-	os = s;
-	ost = st;
-	}
-	fprintf(stderr,"Trop d iteration dans la routine qsimp\n");exit(1);
-	return 0.0;
+	s = qsimp_r(legacy_func, &l, a, b, EPS, &w);
+	if(w.status){fprintf(stderr,"Trop d iteration dans la routine qsimp\n");exit(1);}
+	return s;
 }
 #undef JMAX
 
@@ -332,24 +364,13 @@ double qromb(double (*func)(double time, double sigma, double t), double time, d
 /* Retourne l'intégrale de la fonction func de a à b. L'intégration est effectué par la méthode de Romberg d'ordre 2K,
  où, par exemple K=2 est la règle de Simpson.*/
 {
-	void polint(double xa[], double ya[], int n, double x, double *y, double *dy);
-	double trapzd(double (*func)(double time, double sigma, double t), double time, double sigma, double a, double b, int n);
-	double ss, dss, s[JMAXP], h[JMAXP+1]; 			/* Stocke les approximations trapezoidales successives et leur longueurs de pas successives.*/
-	int j; 
+	struct legacy_ctx l = {func, time, sigma};
+	quad_work w;
+	double s;
 	
-	h[1] = 1.0;
-	for (j=1;j<=JMAX;j++) {
-		s[j] = trapzd(func, time, sigma, a, b, j);
-		if (j >= K) {
-			polint(&h[j-K],&s[j-K],K,0.0,&ss,&dss);
-			if (fabs(dss) <= EPS*fabs(ss)) return ss;
-		}
-		h[j+1] = 0.25*h[j];
-		/* C'est l'étape clé: le facteur est 0.25 même si la longueur du pas est diminuée par 0.5 seulement. 
-		Cela permet l'extrapolation d'un polynôme en h2, pas juste un polynôme en h.*/
-	}
-	fprintf(stderr,"Trop d iterations dans la routine qromb\n");exit(1);
-	return 0.0; 
+	s = qromb_r(legacy_func, &l, a, b, EPS, &w);
+	if(w.status){fprintf(stderr,"Trop d iterations dans la routine qromb\n");exit(1);}
+	return s; 
 }
 #undef JMAX
 
@@ -379,3 +400,251 @@ Les paramètres ont la même signification que dans la routine qromb. */
 }
 #undef EPS
 #undef JMAX
+
+/*******************************
+* Loi inverse gaussienne       *
+********************************/
+
+double erfcx(double x)
+/* Fonction d'erreur complémentaire mise à l'échelle exp(x²)erfc(x). Pour x grand, exp(x²) et erfc(x) sortent
+de la plage des doubles : on utilise alors le développement asymptotique, dont l'erreur relative est inférieure à 1e-13 pour x >= 25. */
+{
+	double a, s;
+	
+	if(x < 25.0)
+		return exp(x*x)*erfc(x);
+	a = 1.0/(2.0*x*x);
+	s = 1.0 - a*(1.0 - 3.0*a*(1.0 - 5.0*a*(1.0 - 7.0*a)));
+	return s/(x*sqrt(M_PI));
+}
+
+double invgauss_pdf(double t, double mu, double lambda)
+/* Densité de la loi inverse gaussienne de moyenne mu et de paramètre de forme lambda :
+f(t) = sqrt(lambda/(2 pi t³)) exp(-lambda (t-mu)²/(2 mu² t)), nulle pour t <= 0. */
+{
+	if(t <= 0.0)
+		return 0.0;
+	return sqrt(lambda/(2.0*M_PI*t*t*t))*exp(-lambda*(t - mu)*(t - mu)/(2.0*mu*mu*t));
+}
+
+double invgauss_cdf(double t, double mu, double lambda)
+/* Fonction de répartition de la loi inverse gaussienne de moyenne mu et de paramètre de forme lambda :
+F(t) = Phi(r(t/mu-1)) + exp(2 lambda/mu) Phi(-r(t/mu+1)), r = sqrt(lambda/t).
+Le second terme est calculé avec erfcx() : exp(2 lambda/mu) n'est jamais formé et il ne reste que exp(-a²/2) <= 1. */
+{
+	double r, a, z;
+	
+	if(t <= 0.0)
+		return 0.0;
+	if(mu <= 0.0)
+		return 1.0;
+	if(!(lambda < HUGE_VAL))						/* Variance nulle : toute la masse arrive à t = mu */
+		return (t >= mu) ? 1.0 : 0.0;
+	r = sqrt(lambda/t);
+	a = r*(t/mu - 1.0);
+	z = r*(t/mu + 1.0);
+	return 0.5*erfc(-a/M_SQRT2) + 0.5*erfcx(z/M_SQRT2)*exp(-0.5*a*a);
+}
+
+/*********************************************************************
+* Intégration réentrante : état dans un espace de travail quad_work, *
+* intégrande évaluée par blocs de QUAD_CHUNK abscisses               *
+**********************************************************************/
+
+void quad_init(quad_work *w)
+/* Réinitialise l'espace de travail avant une nouvelle intégrale */
+{
+	w->s = 0.0;
+	w->neval = 0;
+	w->status = 0;
+}
+
+static double quad_sum(quad_func f, void *ctx, quad_work *w, int n)
+/* Evalue l'intégrande aux n abscisses w->x[0..n-1] et retourne la somme pondérée par w->wx[0..n-1] */
+{
+	double sum = 0.0;
+	int j;
+	
+	(*f)(w->x, w->fx, n, ctx);
+	for(j=0;j<n;j++) sum += w->wx[j]*w->fx[j];
+	w->neval += n;
+	return sum;
+}
+
+double trapzd_r(quad_func f, void *ctx, double a, double b, int n, quad_work *w)
+/* Version réentrante de trapzd() : la somme courante est dans w->s et les 2^n-2 nouvelles abscisses
+du niveau n sont évaluées par blocs. Les appels doivent se faire pour n=1,2,3... avec le même w. */
+{
+	double tnm, sum, del;
+	long it, j, m;
+	
+	if(n == 1) {
+		w->x[0] = a; w->x[1] = b;
+		w->wx[0] = w->wx[1] = 1.0;
+		return (w->s = 0.5*(b-a)*quad_sum(f, ctx, w, 2));
+	}
+	for(it=1,j=1;j<n-1;j++) it <<= 1;
+	tnm = (double)it;
+	del = (b-a)/tnm;					/* Espacement entre les points à ajouter */
+	for(sum=0.0,j=0;j<it;j+=m){
+		for(m=0;m<QUAD_CHUNK && j+m<it;m++){
+			w->x[m] = a+(j+m+0.5)*del;
+			w->wx[m] = 1.0;
+		}
+		sum += quad_sum(f, ctx, w, (int)m);
+	}
+	w->s = 0.5*(w->s+(b-a)*sum/tnm);	/* Remplace s par sa valeur réajustée */
+	return w->s;
+}
+
+double qsimp_r(quad_func f, void *ctx, double a, double b, double eps, quad_work *w)
+/* Intégrale de f de a à b par la règle de Simpson (voir qsimp()). w->status vaut 1 si la précision eps n'est pas atteinte
+en QUAD_JMAX raffinements ; la meilleure estimation est alors retournée. */
+{
+	int j;
+	double s=0.0, st, ost=0.0, os=0.0;
+	
+	quad_init(w);
+	for(j=1;j<=QUAD_JMAX;j++){
+		st = trapzd_r(f, ctx, a, b, j, w);
+		s = (4.0*st-ost)/3.0;
+		if(j>5)							/* Evite une convergence ennuyeuse trop précoce */
+			if(fabs(s-os) < eps*fabs(os) || (s == 0.0 && os == 0.0)) return s;
+		os = s;
+		ost = st;
+	}
+	w->status = 1;
+	return s;
+}
+
+double qromb_r(quad_func f, void *ctx, double a, double b, double eps, quad_work *w)
+/* Intégrale de f de a à b par la méthode de Romberg d'ordre 2K (voir qromb()). w->status vaut 1 si la précision eps
+n'est pas atteinte en QUAD_JMAX raffinements ; la meilleure estimation est alors retournée. */
+{
+	double ss=0.0, dss;
+	int j;
+	
+	quad_init(w);
+	w->h[1] = 1.0;
+	for (j=1;j<=QUAD_JMAX;j++) {
+		w->st[j] = trapzd_r(f, ctx, a, b, j, w);
+		if (j >= QUAD_K) {
+			polint_r(&w->h[j-QUAD_K],&w->st[j-QUAD_K],QUAD_K,0.0,&ss,&dss,w->c,w->d);
+			if (fabs(dss) <= eps*fabs(ss) || (ss == 0.0 && dss == 0.0)) return ss;
+		}
+		w->h[j+1] = 0.25*w->h[j];		/* Extrapolation d'un polynôme en h^2 */
+	}
+	w->status = 1;
+	return ss;
+}
+
+/* Abscisses et poids de la règle de Gauss-Kronrod à 15 points et de la règle de Gauss à 7 points emboîtée */
+static const double xgk[8] = {
+	0.991455371120812639206854697526329, 0.949107912342758524526189684047851,
+	0.864864423359769072789712788640926, 0.741531185599394439863864773280788,
+	0.586087235467691130294144845693013, 0.405845151377397166906606412076961,
+	0.207784955007898467600689403773245, 0.000000000000000000000000000000000
+};
+static const double wgk[8] = {
+	0.022935322010529224963732008058970, 0.063092092629978553290700663189204,
+	0.104790010322250183839876322541518, 0.140653259715525918745189590510238,
+	0.169004726639267902826583426598550, 0.190350578064785409913256402421014,
+	0.204432940075298892414161999234649, 0.209482141084727828012999174891714
+};
+static const double wg[4] = {
+	0.129484966168869693270611432679082, 0.279705391489276667901467771423780,
+	0.381830050505118944950369775488975, 0.417959183673469387755102040816327
+};
+
+double qgk15(quad_func f, void *ctx, double a, double b, double *abserr, quad_work *w)
+/* Intégrale de f de a à b par la règle de Gauss-Kronrod à 15 points, évaluée en un seul appel de l'intégrande.
+abserr reçoit l'écart avec la règle de Gauss à 7 points emboîtée. */
+{
+	double c = 0.5*(a+b), hl = 0.5*(b-a);
+	double resk = 0.0, resg = 0.0;
+	int j;
+	
+	for(j=0;j<7;j++){
+		w->x[2*j]   = c - hl*xgk[j];
+		w->x[2*j+1] = c + hl*xgk[j];
+	}
+	w->x[14] = c;
+	(*f)(w->x, w->fx, 15, ctx);
+	w->neval += 15;
+	
+	for(j=0;j<7;j++){
+		resk += wgk[j]*(w->fx[2*j]+w->fx[2*j+1]);
+		if(j%2 == 1) resg += wg[j/2]*(w->fx[2*j]+w->fx[2*j+1]);		/* Les noeuds de Gauss sont les noeuds impairs de Kronrod */
+	}
+	resk += wgk[7]*w->fx[14];
+	resg += wg[3]*w->fx[14];
+	
+	*abserr = fabs((resk-resg)*hl);
+	return resk*hl;
+}
+
+double qgk_adapt(quad_func f, void *ctx, double a, double b, double eps, int depth, quad_work *w)
+/* Intégrale de f de a à b par bissections successives de la règle de Gauss-Kronrod à 15 points jusqu'à ce que l'erreur estimée
+soit inférieure à eps en valeur relative, au plus depth fois. w->status vaut 1 si une bissection n'a pas convergé. */
+{
+	double err, res, m;
+	
+	res = qgk15(f, ctx, a, b, &err, w);
+	if(err <= eps*fabs(res) || err < 1.0e-300)
+		return res;
+	if(depth <= 0){
+		w->status = 1;
+		return res;
+	}
+	m = 0.5*(a+b);
+	return qgk_adapt(f, ctx, a, m, eps, depth-1, w) + qgk_adapt(f, ctx, m, b, eps, depth-1, w);
+}
+
+#define TS_TMAX		4.0			/* Borne de la variable de la règle tanh-sinh au-delà de laquelle les poids sont négligeables */
+#define TS_LEVELS	10			/* Nombre maximal de dédoublements du pas */
+
+double qtanhsinh(quad_func f, void *ctx, double a, double b, double eps, quad_work *w)
+/* Intégrale de f de a à b par la règle tanh-sinh (double exponentielle). L'intégrande n'est jamais évaluée aux bornes,
+ce qui convient aux fonctions singulières ou indéterminées en a ou en b. Chaque niveau divise le pas par deux et n'évalue
+que les nouvelles abscisses. w->status vaut 1 si la précision eps n'est pas atteinte. */
+{
+	double hl = 0.5*(b-a), h = 1.0, t, u, e, del, wt, sum, s = 0.0, olds;
+	int level, m, k, step;
+	
+	quad_init(w);
+	for(level=0;level<=TS_LEVELS;level++){
+		sum = 0.0;
+		m = 0;
+		/* Au niveau 0 tous les points k*h, ensuite seulement les points impairs */
+		step = (level == 0) ? 1 : 2;
+		for(k=(level == 0) ? 0 : 1; k*h <= TS_TMAX; k+=step){
+			t = k*h;
+			u = M_PI_2*sinh(t);
+			e = exp(-2.0*u);
+			del = hl*2.0*e/(1.0+e);							/* Distance de l'abscisse à la borne la plus proche */
+			wt = hl*M_PI_2*cosh(t)*4.0*e/((1.0+e)*(1.0+e));
+			if(del <= 0.0 || wt <= 0.0)
+				break;
+			w->x[m] = b-del; w->wx[m] = wt; m++;
+			if(k > 0){
+				w->x[m] = a+del; w->wx[m] = wt; m++;
+			}
+			if(m >= QUAD_CHUNK-1){
+				sum += quad_sum(f, ctx, w, m);
+				m = 0;
+			}
+		}
+		if(m > 0)
+			sum += quad_sum(f, ctx, w, m);
+		
+		olds = s;
+		s = (level == 0) ? h*sum : 0.5*s + h*sum;
+		if(level > 2 && (fabs(s-olds) <= eps*fabs(s) || (s == 0.0 && olds == 0.0)))
+			return s;
+		h *= 0.5;
+	}
+	w->status = 1;
+	return s;
+}
+#undef TS_TMAX
+#undef TS_LEVELS
@@ -2,10 +2,38 @@
 #include <stdio.h>
 #include <math.h>
 #include <string.h>
+#include <stdint.h>
 
 #ifndef _UTILS_H
 #define _UTILS_H
 
+// Précision du stockage de l'état du paysage et des paramètres des cellules.
+// Compiler avec -DWB_SINGLE_PRECISION pour les stocker en simple précision : les cartes d'entrée
+// n'ont qu'environ 3 chiffres significatifs et la mémoire occupée par le paysage et le fichier segmenté
+// est divisée par deux. Les calculs intermédiaires et les cumuls sur une période restent en double précision.
+#ifdef WB_SINGLE_PRECISION
+typedef float real;
+#define rvector			vector
+#define free_rvector	free_vector
+#else
+typedef double real;
+#define rvector			dvector
+#define free_rvector	free_dvector
+#endif
+
+// Noyaux de calcul par ligne (tableaux contigus, sélections par masques et vexp) : ils ne sont plus rapides que le
+// calcul par cellule que s'ils sont vectorisés, ce qui demande des comparaisons sur 64 bits (AVX2, ou aarch64).
+// Ils sont donc utilisés quand la cible les fournit (make EXTRA_CFLAGS=-march=native), sauf avec -DWB_SCALAR_KERNELS.
+// WB_VECTORIZE compile une fonction avec la vectorisation complète de -O3 quel que soit le niveau d'optimisation.
+#if !defined(WB_SCALAR_KERNELS) && (defined(__AVX2__) || defined(__aarch64__))
+#define WB_ROW_KERNELS
+#endif
+#if defined(__GNUC__) && !defined(__clang__)
+#define WB_VECTORIZE	__attribute__((optimize("O3")))
+#else
+#define WB_VECTORIZE
+#endif
+
 float *vector(long nl, long nh);						/* Alloue un vecteur de décimaux avec une précision simple allant de nl à nh [nl..nh].*/
 int *ivector(long nl, long nh); 						/* Alloue un vecteur d'entier allant de nl à nh [nl..nh].*/
 unsigned char *cvector(long nl, long nh); 				/* Alloue un vecteur de caractère non signé allant de nl à nh [nl..nh].*/
@@ -16,6 +44,7 @@ void free_ivector(int *v, long nl, long nh);			/* Déalloue un vecteur d'entier
 void free_cvector(unsigned char *v, long nl, long nh);	/* Déalloue un vecteur de caractère non signé allant de nl à nh [nl..nh].*/
 void free_lvector(unsigned long *v, long nl, long nh);	/* Déalloue un vecteur d'entier long non signé allant de nl à nh [nl..nh].*/
 void free_dvector(double *v, long nl, long nh);			/* Déalloue un vecteur de décimaux avec une précision double allant de nl à nh [nl..nh].*/
+double TimeNow(void);									/* Renvoie le temps réel écoulé en secondes (horloge monotone).*/
 void polint(double xa[], double ya[], int n, double x, double *y, double *dy);
 
 double trapzd(double (*func)(double, double, double), double, double, double a, double b, int n);
@@ -26,4 +55,126 @@ double qsimp(double (*func) (double, double, double), double, double, double a,
 double qsimp_modif(double (*func) (double time, double sigma, double t), double time, double sigma, double a, double b);
 double qromb(double (*func)(double, double, double), double, double, double a, double b);
 double qromo(double (*func)(double, double, double), double, double, double a, double b, double (*choose)(double(*)(double, double, double), double, double, double, double, int));
+
+/* Intégration numérique réentrante : tout l'état est dans un espace de travail fourni par l'appelant
+   (aucune variable statique ni allocation) et l'intégrande est évaluée par blocs d'abscisses. */
+#define QUAD_JMAX	20									/* Nombre maximal de raffinements de la règle du trapèze */
+#define QUAD_K		5									/* Nombre de points de l'extrapolation de Romberg */
+#define QUAD_CHUNK	64									/* Nombre maximal d'abscisses par appel de l'intégrande */
+
+typedef void (*quad_func)(const double *x, double *fx, int n, void *ctx);	/* Evalue fx[i] = f(x[i]), i = 0..n-1 */
+
+typedef struct quad_work
+{
+	double s;											/* Somme courante de la règle du trapèze */
+	double h[QUAD_JMAX+2], st[QUAD_JMAX+2];				/* Longueurs de pas et approximations successives */
+	double c[QUAD_JMAX+2], d[QUAD_JMAX+2];				/* Tableaux de l'interpolation polynomiale */
+	double x[QUAD_CHUNK], fx[QUAD_CHUNK], wx[QUAD_CHUNK];	/* Abscisses, valeurs et poids d'un bloc */
+	long neval;											/* Nombre d'évaluations de l'intégrande */
+	int status;											/* 0 si la précision demandée a été atteinte */
+} quad_work;
+
+double erfcx(double x);								/* Fonction d'erreur complémentaire mise à l'échelle exp(x²)erfc(x) */
+double invgauss_pdf(double t, double mu, double lambda);	/* Densité de la loi inverse gaussienne */
+double invgauss_cdf(double t, double mu, double lambda);	/* Fonction de répartition de la loi inverse gaussienne */
+
+void quad_init(quad_work *w);
+void polint_r(const double xa[], const double ya[], int n, double x, double *y, double *dy, double c[], double d[]);
+double trapzd_r(quad_func f, void *ctx, double a, double b, int n, quad_work *w);
+double qsimp_r(quad_func f, void *ctx, double a, double b, double eps, quad_work *w);
+double qromb_r(quad_func f, void *ctx, double a, double b, double eps, quad_work *w);
+double qgk15(quad_func f, void *ctx, double a, double b, double *abserr, quad_work *w);
+double qgk_adapt(quad_func f, void *ctx, double a, double b, double eps, int depth, quad_work *w);
+double qtanhsinh(quad_func f, void *ctx, double a, double b, double eps, quad_work *w);
+
+/* Sélection sans branchement : a si cond est vrai, b sinon, par un masque sur les bits. Avec les options de calcul
+   flottant par défaut (-ftrapping-math), le compilateur ne transforme pas un x ? a : b dont les branches font des calculs
+   en sélection vectorielle : ce masque entier le permet. */
+static inline double vselect(int cond, double a, double b)
+{
+	int64_t m = -(int64_t)(cond != 0), ia, ib;
+
+	memcpy(&ia, &a, sizeof(ia));
+	memcpy(&ib, &b, sizeof(ib));
+	ia 	= (ia & m) | (ib & ~m);
+	memcpy(&a, &ia, sizeof(a));
+	return a;
+}
+
+/* Exponentielle sans branchement ni appel de fonction, que le compilateur peut vectoriser dans une boucle :
+   x = n ln2 + r avec |r| <= ln2/2, exp(r) par son développement de Taylor à l'ordre 11 (erreur relative < 1e-14),
+   puis 2^n construit directement dans l'exposant. L'arrondi de x/ln2 à l'entier le plus proche (ajout et retrait
+   de 1.5*2^52) donne aussi n dans les bits de poids faible. x est borné à [-708, 709] par vselect : pas de
+   dénormalisés ni d'infini. */
+static inline double vexp(double x)
+{
+	const double shift = 6755399441055744.0;			/* 1.5*2^52 */
+	double t, n, r, p, scale;
+	int64_t k;
+
+	x 	= vselect(x < -708.0, -708.0, x);
+	x 	= vselect(x > 709.0, 709.0, x);
+	t 	= x * 1.4426950408889634 + shift;
+	n 	= t - shift;
+	r 	= x - n * 6.93147180369123816490e-01;			/* ln2 en deux parties (Cody-Waite) */
+	r 	= r - n * 1.90821492927058770002e-10;
+	p 	= 1.0/39916800.0;
+	p 	= p*r + 1.0/3628800.0;
+	p 	= p*r + 1.0/362880.0;
+	p 	= p*r + 1.0/40320.0;
+	p 	= p*r + 1.0/5040.0;
+	p 	= p*r + 1.0/720.0;
+	p 	= p*r + 1.0/120.0;
+	p 	= p*r + 1.0/24.0;
+	p 	= p*r + 1.0/6.0;
+	p 	= p*r + 0.5;
+	p 	= p*r + 1.0;
+	p 	= p*r + 1.0;
+	memcpy(&k, &t, sizeof(k));
+	k 	= (k - 0x4338000000000000LL + 1023) << 52;
+	memcpy(&scale, &k, sizeof(scale));
+	return p * scale;
+}
+
+/* Logarithme népérien sans branchement, vectorisable comme vexp : x = m 2^e avec m dans [sqrt(2)/2, sqrt(2)[,
+   ln(m) = 2 atanh(f) avec f = (m-1)/(m+1), |f| <= 0.172, par sa série jusqu'à f^23 (erreur relative < 1e-15).
+   L'exposant est converti en double par ses bits (pas de conversion entier 64 bits -> double, absente d'AVX2).
+   x est défini pour x > 0 : 0 et les dénormalisés sont ramenés au plus petit double normalisé (ln = -708.4). */
+static inline double vlog(double x)
+{
+	const double two52 = 4503599627370496.0;			/* 2^52 */
+	double m, e, f, f2, p;
+	int64_t bits, ebits;
+
+	x 	= vselect(x < 2.2250738585072014e-308, 2.2250738585072014e-308, x);
+	memcpy(&bits, &x, sizeof(bits));
+	ebits 	= (bits >> 52) | 0x4330000000000000LL;		/* 2^52 + exposant biaisé */
+	memcpy(&e, &ebits, sizeof(e));
+	e 	= e - two52 - 1023.0;
+	bits 	= (bits & 0x000FFFFFFFFFFFFFLL) | 0x3FF0000000000000LL;
+	memcpy(&m, &bits, sizeof(m));
+	e 	= e + vselect(m > 1.4142135623730951, 1.0, 0.0);
+	m 	= vselect(m > 1.4142135623730951, 0.5*m, m);
+	f 	= (m - 1.0)/(m + 1.0);
+	f2 	= f*f;
+	p 	= 1.0/23.0;
+	p 	= p*f2 + 1.0/21.0;
+	p 	= p*f2 + 1.0/19.0;
+	p 	= p*f2 + 1.0/17.0;
+	p 	= p*f2 + 1.0/15.0;
+	p 	= p*f2 + 1.0/13.0;
+	p 	= p*f2 + 1.0/11.0;
+	p 	= p*f2 + 1.0/9.0;
+	p 	= p*f2 + 1.0/7.0;
+	p 	= p*f2 + 1.0/5.0;
+	p 	= p*f2 + 1.0/3.0;
+	p 	= p*f2 + 1.0;
+	return e * 6.93147180369123816490e-01 + (2.0*f*p + e * 1.90821492927058770002e-10);
+}
+
+/* Puissance d'une base positive par fusion de vlog et vexp : x^y = exp(y ln x) */
+static inline double vpow(double x, double y)
+{
+	return vexp(y * vlog(x));
+}
  #endif
\ No newline at end of file